@@ -23,6 +23,14 @@
  ******************************************************************************/
 #include "accessor.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 Accessor::Accessor(std::string& filename) : filename(filename) {
     std::fstream s(filename, s.binary | s.in);
     if (!s.is_open()) {
@@ -42,7 +50,7 @@ Accessor::Accessor(std::string& filename) : filename(filename) {
 
     // Check version
     if (header.version != 2 and header.version != 3) {
-        if (header.version == 4) {
+        if (header.version == 4 or header.version == 5) {
             //std::cerr << "Experimental version" << std::endl;
         } else {
             std::cerr << "Bad version" << std::endl;
@@ -52,22 +60,41 @@ Accessor::Accessor(std::string& filename) : filename(filename) {
 
     // Extract the sample list
     sample_list.clear();
-    s.seekg(header.samples_offset);
+    s.seekg(get_samples_offset(header));
     std::string str;
     while(std::getline(s, str, '\0').good() and (sample_list.size() < (header.hap_samples/header.ploidy))) {
         sample_list.push_back(str);
     }
+
+    // Map the position index
+    contigs.clear();
+    if (header.version >= 5 and header.position_index_offset_64) {
+        map_position_index();
+    }
+
+    // Extract the block zone maps
+    zone_map.clear();
+    if (header.version >= 5 and header.zone_map_offset_64) {
+        s.clear();
+        s.seekg(header.zone_map_offset_64);
+        zone_map.resize(header.number_of_ssas);
+        s.read((char *)zone_map.data(), zone_map.size() * sizeof(zone_map_entry_t));
+        if (!s.good()) {
+            std::cerr << "Failed to read the block zone maps" << std::endl;
+            throw "Bad zone maps";
+        }
+    }
     s.close();
 
     if (header.aet_bytes == 2) {
-        if (header.version == 4) {
+        if (header.version >= 4) {
             internals = make_unique<AccessorInternalsNewTemplate<uint16_t> >(filename);
         } else {
             std::cerr << "Unsupported version : " << header.version << std::endl;
             throw "Unsupported version";
         }
     } else if (header.aet_bytes == 4) {
-        if (header.version == 4) {
+        if (header.version >= 4) {
             internals = make_unique<AccessorInternalsNewTemplate<uint32_t> >(filename);
         } else {
             std::cerr << "Unsupported version : " << header.version << std::endl;
@@ -86,4 +113,170 @@ Accessor::~Accessor() {
         free(values);
         values = NULL;
     }
-}
\ No newline at end of file
+    if (file_mmap_p) {
+        munmap(file_mmap_p, file_size);
+        close(fd);
+    }
+}
+
+void Accessor::map_position_index() {
+    file_size = fs::file_size(filename);
+    const size_t offset = header.position_index_offset_64;
+    if ((offset > file_size) or
+        (header.position_index_entries > (file_size - offset) / sizeof(position_index_entry_t))) {
+        std::cerr << "File " << filename << " has a position index outside of the file" << std::endl;
+        throw "Bad position index";
+    }
+
+    fd = open(filename.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "Failed to open file " << filename << std::endl;
+        throw "Failed to open file";
+    }
+    file_mmap_p = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (file_mmap_p == MAP_FAILED) {
+        std::cerr << "Failed to memory map file " << filename << std::endl;
+        file_mmap_p = nullptr;
+        close(fd);
+        throw "Failed to mmap file";
+    }
+    const char* base = (const char*)file_mmap_p;
+    position_index = PositionIndexView((const position_index_entry_t*)(base + offset), header.position_index_entries);
+
+    // The contig names follow the entries
+    const char* p = base + offset + position_index.size() * sizeof(position_index_entry_t);
+    const char* file_end = base + file_size;
+    while ((contigs.size() < header.number_of_contigs) and (p < file_end)) {
+        const char* name_end = (const char*)memchr(p, '\0', file_end - p);
+        if (!name_end) break;
+        contigs.push_back(std::string(p, name_end));
+        p = name_end + 1;
+    }
+    if (contigs.size() != header.number_of_contigs) {
+        std::cerr << "Failed to read the position index" << std::endl;
+        throw "Bad position index";
+    }
+
+    // Sorted input gives entries sorted by contig and min_pos
+    position_index_sorted = true;
+    contig_max_span.assign(contigs.size(), 0);
+    for (size_t i = 0; i < position_index.size(); ++i) {
+        const auto& entry = position_index[i];
+        if (entry.contig_id >= contigs.size()) {
+            std::cerr << "Bad contig in the position index" << std::endl;
+            throw "Bad position index";
+        }
+        contig_max_span[entry.contig_id] = std::max(contig_max_span[entry.contig_id], (int64_t)(entry.max_end - entry.min_pos));
+        if (i and ((position_index[i-1].contig_id > entry.contig_id) or
+                   ((position_index[i-1].contig_id == entry.contig_id) and (position_index[i-1].min_pos > entry.min_pos)))) {
+            position_index_sorted = false;
+        }
+    }
+}
+void Accessor::parse_region(const std::string& region, std::string& contig, int64_t& beg, int64_t& end) {
+    contig = region;
+    beg = 1;
+    end = std::numeric_limits<int64_t>::max();
+    auto colon = region.find_last_of(':');
+    if (colon != std::string::npos) {
+        contig = region.substr(0, colon);
+        std::string range = region.substr(colon+1);
+        auto dash = range.find('-');
+        try {
+            beg = std::stoll(range.substr(0, dash));
+            if (dash == std::string::npos) {
+                end = beg;
+            } else if (dash+1 < range.length()) {
+                end = std::stoll(range.substr(dash+1));
+            }
+        } catch (...) {
+            std::cerr << "Could not parse region " << region << std::endl;
+            throw "Bad region";
+        }
+    }
+}
+
+void Accessor::print_zone_map_info(bool per_block) const {
+    if (zone_map.empty()) {
+        std::cerr << "No block zone maps" << std::endl;
+        return;
+    }
+
+    size_t sparse_lines = 0;
+    size_t wah_lines = 0;
+    size_t blocks_with_missing = 0;
+    size_t blocks_with_eovs = 0;
+    size_t blocks_with_phasing = 0;
+    size_t blocks_with_contigs = 0;
+    size_t min_ac = (size_t)-1;
+    size_t max_ac = 0;
+    for (size_t block_id = 0; block_id < zone_map.size(); ++block_id) {
+        const auto& zone = zone_map[block_id];
+        sparse_lines += zone.n_sparse_lines;
+        wah_lines += zone.n_wah_lines;
+        blocks_with_missing += (zone.flags & ZONE_MAP_HAS_MISSING) ? 1 : 0;
+        blocks_with_eovs += (zone.flags & ZONE_MAP_HAS_END_OF_VECTORS) ? 1 : 0;
+        blocks_with_phasing += (zone.flags & ZONE_MAP_HAS_NON_UNIFORM_PHASING) ? 1 : 0;
+        blocks_with_contigs += (zone.flags & ZONE_MAP_MULTIPLE_CONTIGS) ? 1 : 0;
+        min_ac = std::min(min_ac, (size_t)zone.min_ac);
+        max_ac = std::max(max_ac, (size_t)zone.max_ac);
+
+        if (per_block) {
+            const std::string contig = (zone.contig_id < contigs.size()) ? contigs[zone.contig_id] : std::to_string(zone.contig_id);
+            std::cerr << "Block " << block_id << " : " << contig << ":" << zone.min_pos+1 << "-" << zone.max_end
+                      << ((zone.flags & ZONE_MAP_MULTIPLE_CONTIGS) ? " (multiple contigs)" : "")
+                      << ", " << zone.n_records << " VCF records, " << zone.n_binary_lines << " binary lines ("
+                      << zone.n_sparse_lines << " sparse, " << zone.n_wah_lines << " WAH), AC "
+                      << zone.min_ac << "-" << zone.max_ac
+                      << ((zone.flags & ZONE_MAP_HAS_MISSING) ? ", missing" : "")
+                      << ((zone.flags & ZONE_MAP_HAS_END_OF_VECTORS) ? ", end of vectors" : "")
+                      << ((zone.flags & ZONE_MAP_HAS_NON_UNIFORM_PHASING) ? ", non uniform phasing" : "") << std::endl;
+        }
+    }
+
+    std::cerr << "Block zone maps : " << zone_map.size() << " blocks" << std::endl;
+    std::cerr << "Sparse binary lines : " << sparse_lines << ", WAH binary lines : " << wah_lines << std::endl;
+    std::cerr << "Block AC range : " << min_ac << "-" << max_ac << std::endl;
+    std::cerr << "Blocks with missing : " << blocks_with_missing << ", with end of vectors : " << blocks_with_eovs
+              << ", with non uniform phasing : " << blocks_with_phasing << ", with multiple contigs : " << blocks_with_contigs << std::endl;
+}
+
+std::vector<position_index_entry_t> Accessor::query_position_index(const std::string& region) const {
+    std::vector<position_index_entry_t> result;
+
+    std::string contig;
+    int64_t beg, end;
+    parse_region(region, contig, beg, end);
+
+    auto contig_it = std::find(contigs.begin(), contigs.end(), contig);
+    if (contig_it == contigs.end()) {
+        return result; // Contig not in file
+    }
+    const uint32_t contig_id = contig_it - contigs.begin();
+
+    // Entries are 0-based, [min_pos, max_end)
+    const int64_t beg0 = beg-1;
+    auto overlaps = [&](const position_index_entry_t& entry) {
+        return (entry.contig_id == contig_id) and (entry.min_pos < end) and (entry.max_end > beg0);
+    };
+
+    if (!position_index_sorted) {
+        for (const auto& entry : position_index) {
+            if (overlaps(entry)) result.push_back(entry);
+        }
+        return result;
+    }
+
+    // An entry overlapping beg0 starts at most max span before it
+    auto before = [](const position_index_entry_t& entry, const std::pair<uint32_t, int64_t>& key) {
+        return (entry.contig_id < key.first) or ((entry.contig_id == key.first) and (entry.min_pos < key.second));
+    };
+    const int64_t span = contig_max_span[contig_id];
+    const int64_t lo_pos = (beg0 > std::numeric_limits<int64_t>::min() + span) ? beg0 - span : std::numeric_limits<int64_t>::min();
+    auto it = std::lower_bound(position_index.begin(), position_index.end(), std::make_pair(contig_id, lo_pos), before);
+    for (; (it != position_index.end()) and (it->contig_id == contig_id) and (it->min_pos < end); ++it) {
+        if (overlaps(*it)) result.push_back(*it);
+    }
+
+    return result;
+}
@@ -27,6 +27,7 @@
 #include "xcf.hpp"
 
 #include "accessor.hpp"
+#include "block_parallel.hpp"
 
 #include "vcf.h"
 #include "hts.h"
@@ -36,6 +37,7 @@
 #include <unistd.h>
 
 #include <filesystem>
+#include <numeric>
 
 using namespace wah;
 
@@ -48,9 +50,10 @@ public:
      * @brief Constructor of the Decompressor class
      *
      * @param filename compressed genotype data file
-     * @param bcf_nosamples corresponding bcf file with variant info
+     * @param ofname the output file name
+     * @param n_threads number of threads, the blocks are split between the threads if more than 1
      * */
-    Annotator(std::string filename, std::string ofname) : filename(filename), ofname(ofname), bcf_nosamples(Accessor::get_variant_filename(filename)), accessor(filename), sample_list(accessor.get_sample_list()) {
+    Annotator(std::string filename, std::string ofname, size_t n_threads = 1) : filename(filename), ofname(ofname), n_threads(n_threads), bcf_nosamples(Accessor::get_variant_filename(filename)), accessor(filename), sample_list(accessor.get_sample_list()) {
         std::fstream s(filename, s.binary | s.in);
         if (!s.is_open()) {
             std::cerr << "Failed to open file " << filename << std::endl;
@@ -82,7 +85,11 @@ public:
      * */
     void decompress() {
         decompress_checks();
-        decompress_core();
+        if (n_threads > 1) {
+            decompress_parallel();
+        } else {
+            decompress_core();
+        }
     }
 
     /**
@@ -102,11 +109,46 @@ public:
     }
 
 private:
+    void decompress_parallel() {
+        BlockParallelTraversal bpt(filename, n_threads);
+        create_output_file(ofname, bpt.get_variant_header());
+
+        // The records are annotated by the workers and written in file order
+        bpt.traverse([&](size_t thread_id, size_t block_id, Accessor& acc, const bcf_hdr_t *variant_hdr, bcf1_t *rec, size_t bm_index) {
+            (void)thread_id; (void)block_id; (void)variant_hdr;
+            annotate(acc, rec, bm_index);
+        }, [&](bcf1_t *rec) {
+            int ret = bcf_write1(fp, hdr, rec);
+            if (ret) {
+                std::cerr << "Failed to write record" << std::endl;
+                throw "Failed to write record";
+            }
+        });
+
+        if (hdr) { bcf_hdr_destroy(hdr); hdr = NULL; }
+        if (fp) { hts_close(fp); fp = NULL; }
+    }
+
+    // Sets the AC and AN INFO fields of a record
+    inline void annotate(Accessor& acc, bcf1_t *rec, size_t bm_index) {
+        acc.fill_allele_counts(rec->n_allele, bm_index); // Because fill genotype array is not called
+        const auto& allele_counts = acc.get_allele_counts();
+        // Missing and end of vector entries are not in the allele counts
+        const int32_t n_haps = std::accumulate(allele_counts.begin(), allele_counts.end(), 0);
+        std::vector<int32_t> ac(allele_counts.size()-1);
+        for (size_t i = 0; i < ac.size(); ++i) {
+            ac[i] = allele_counts[i+1];
+        }
+
+        bcf_update_info_int32(hdr, rec, "AC", (int32_t*)ac.data(), rec->n_allele-1);
+        bcf_update_info_int32(hdr, rec, "AN", &n_haps, 1);
+    }
+
     void decompress_core() {
         // Read the bcf without the samples (variant info)
         initialize_bcf_file_reader(bcf_fri, bcf_nosamples);
 
-        create_output_file(ofname);
+        create_output_file(ofname, bcf_fri.sr->readers[0].header);
 
         // Decompress and add the genotype data to the new file
         // This is the main loop, where most of the time is spent
@@ -139,8 +181,7 @@ private:
                 offset = 0;
                 block_id++;
             }
-            /// @todo replace this constant by the BM bits
-            v4_bm_index = block_id << 15 | offset;
+            v4_bm_index = accessor.bm_index(block_id, offset);
             offset += bcf_fri.line->n_allele-1;
             current_block_lines++;
 
@@ -154,7 +195,7 @@ private:
                 // Non linear access (returns immediately if dp is already at correct position)
                 bm_index = values[0];
             } else {
-                if (header.version == 4) {
+                if (header.version >= 4) {
                     bm_index = v4_bm_index;
                 } else {
                     /// @todo this is the old way, (not new bm)
@@ -165,16 +206,7 @@ private:
 
             // Fill the genotype array (as bcf_get_genotypes() would do)
             //accessor.fill_genotype_array(genotypes, header.hap_samples, bcf_fri.line->n_allele, bm_index);
-            accessor.fill_allele_counts(bcf_fri.line->n_allele, bm_index); // Because fill genotype array is not called
-            auto allele_counts = accessor.get_allele_counts();
-            const int32_t n_haps = accessor.get_number_of_samples()*2;
-            std::vector<int32_t> ac(allele_counts.size()-1);
-            for (size_t i = 0; i < ac.size(); ++i) {
-                ac[i] = allele_counts[i+1];
-            }
-
-            bcf_update_info_int32(hdr, rec, "AC", (int32_t*)ac.data(), bcf_fri.line->n_allele-1);
-            bcf_update_info_int32(hdr, rec, "AN", &n_haps, 1);
+            annotate(accessor, rec, bm_index);
 
             int ret = bcf_write1(fp, hdr, rec);
             if (ret) {
@@ -226,7 +258,7 @@ private:
         }
     }
 
-    inline void create_output_file(const std::string& ofname) {
+    inline void create_output_file(const std::string& ofname, const bcf_hdr_t *variant_hdr) {
         // Open the output file
         bool fast_pipe = false;
         fp = hts_open(ofname.c_str(), ofname.compare("-") ? "wb" : (fast_pipe ? "wbu" : "wu")); // "-" for stdout
@@ -236,7 +268,7 @@ private:
         }
 
         // Duplicate the header from the bcf with the variant info
-        hdr = bcf_hdr_dup(bcf_fri.sr->readers[0].header);
+        hdr = bcf_hdr_dup(variant_hdr);
         if (!hdr) {throw "Could not dup the header"; }
 #if 0
         bcf_hdr_remove(hdr, BCF_HL_FMT, "BM");
@@ -284,6 +316,7 @@ private:
 protected:
     std::string filename;
     std::string ofname;
+    const size_t n_threads;
     header_t header;
 
     std::string bcf_nosamples;
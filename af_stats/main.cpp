@@ -28,9 +28,9 @@
 
 #include <iostream>
 
-void recompute_ac_an(std::string& filename, std::string& ofname) {
+void recompute_ac_an(std::string& filename, std::string& ofname, size_t n_threads) {
     std::cout << "Loading gt data from file " << filename << "\n";
-    Annotator nl(filename, ofname);
+    Annotator nl(filename, ofname, n_threads);
     auto start = std::chrono::steady_clock::now();
     nl.decompress();
     auto end = std::chrono::steady_clock::now();
@@ -44,7 +44,9 @@ int main(int argc, const char *argv[]) {
     std::string filename = "-";
     std::string ofname = "-";
     app.add_option("-f,--file", filename, "Input file name (XSI)");
+    size_t n_threads = 1;
     app.add_option("-o,--output", ofname, "Output file name (new variant BCF)");
+    app.add_option("-t,--threads", n_threads, "Number of threads, XSI blocks are split between the threads");
 
     CLI11_PARSE(app, argc, argv);
 
@@ -55,7 +57,7 @@ int main(int argc, const char *argv[]) {
 
     if ((filename.substr(filename.find_last_of(".") + 1) == "bin") || (filename.substr(filename.find_last_of(".") + 1) == "xsi")) {
         try {
-            recompute_ac_an(filename, ofname);
+            recompute_ac_an(filename, ofname, n_threads);
         } catch (char const* e) {
             std::cerr << e << std::endl;
         }
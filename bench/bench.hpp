@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __BENCH_HPP__
+#define __BENCH_HPP__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Minimal benchmark harness, runs a kernel in batches and reports the median time per call
+ *
+ * The batch size is increased until a batch takes at least min_batch_ns, so that
+ * timer resolution does not matter, then the median of a fixed number of batches
+ * is taken, which is stable with respect to outliers (e.g., page faults).
+ * */
+namespace bench {
+
+    // Results are accumulated here so that the compiler cannot remove the kernels
+    static volatile uint64_t sink = 0;
+
+    inline void keep(const uint64_t value) {
+        sink = sink + value;
+    }
+
+    template<class F>
+    inline double median_ns_per_call(F&& kernel, const uint64_t min_batch_ns = 2000000, const size_t samples = 11) {
+        kernel(); // Warm up (caches, allocations)
+
+        size_t batch = 1;
+        uint64_t elapsed = 0;
+        for (;;) {
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < batch; ++i) {
+                kernel();
+            }
+            elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            if (elapsed >= min_batch_ns or batch >= (1ull << 30)) break;
+            batch *= 2;
+        }
+
+        std::vector<double> times;
+        times.reserve(samples);
+        for (size_t s = 0; s < samples; ++s) {
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < batch; ++i) {
+                kernel();
+            }
+            elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            times.push_back((double)elapsed / (double)batch);
+        }
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+
+    /**
+     * @brief Prints one result line, bits is the number of haplotypes (bits) handled
+     *        per call and bytes the number of bytes read per call
+     * */
+    inline void report(std::ostream& os, const bool csv, const std::string& kernel, const size_t haps, const double density,
+                       const double ns, const size_t bits, const size_t bytes) {
+        const double ns_per_bit = ns / (double)bits;
+        const double gb_per_s = (double)bytes / ns; // bytes per ns is GB/s
+        if (csv) {
+            os << kernel << "," << haps << "," << density << "," << ns << "," << ns_per_bit << "," << gb_per_s << std::endl;
+        } else {
+            os << std::left << std::setw(36) << kernel << std::right
+               << std::setw(10) << haps << std::setw(10) << density
+               << std::setw(14) << std::fixed << std::setprecision(1) << ns
+               << std::setw(12) << std::setprecision(4) << ns_per_bit
+               << std::setw(10) << std::setprecision(3) << gb_per_s << std::endl;
+            os.unsetf(std::ios_base::floatfield);
+            os << std::setprecision(6);
+        }
+    }
+
+    /**
+     * @brief Returns the q-quantile (e.g., 0.95) of the values (nearest rank), the values are sorted
+     * */
+    inline double percentile(std::vector<double>& values, const double q) {
+        if (values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        size_t rank = (size_t)std::ceil(q * (double)values.size());
+        return values[rank ? rank-1 : 0];
+    }
+
+    inline void report_header(std::ostream& os, const bool csv) {
+        if (csv) {
+            os << "kernel,haps,density,ns_per_call,ns_per_bit,gb_per_s" << std::endl;
+        } else {
+            os << std::left << std::setw(36) << "kernel" << std::right
+               << std::setw(10) << "haps" << std::setw(10) << "density"
+               << std::setw(14) << "ns/call" << std::setw(12) << "ns/bit" << std::setw(10) << "GB/s" << std::endl;
+        }
+    }
+}
+
+#endif /* __BENCH_HPP__ */
@@ -0,0 +1,165 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "CLI11.hpp"
+#include "vcf.h"
+#include "block.hpp"
+#include "gt_block.hpp"
+#include "bench.hpp"
+
+#include <iostream>
+#include <numeric>
+#include <random>
+
+using A_T = uint32_t;
+using WAH_T = uint16_t;
+
+/**
+ * @brief Times the WAH, PBWT and sparse kernels on one random haplotype line
+ *
+ * The line has N_HAPS haplotypes, each one carries the ALT allele with probability
+ * density (i.i.d.), the same seed always gives the same line. The throughput is
+ * given for the bytes read and written by the kernel.
+ * */
+void bench_line(const size_t N_HAPS, const double density, std::mt19937_64& rng, const bool csv) {
+    // Random GT line (phased diploid)
+    std::vector<int32_t> gt_arr(N_HAPS);
+    std::bernoulli_distribution alt(density);
+    for (size_t i = 0; i < N_HAPS; ++i) {
+        const int32_t allele = alt(rng);
+        gt_arr[i] = (i & 1) ? bcf_gt_phased(allele) : bcf_gt_unphased(allele);
+    }
+    std::vector<A_T> a(N_HAPS);
+    std::vector<A_T> b(N_HAPS);
+    std::iota(a.begin(), a.end(), 0);
+    std::vector<bool> y(N_HAPS);
+    for (size_t i = 0; i < N_HAPS; ++i) {
+        y[i] = bcf_gt_allele(gt_arr[i]) == 1;
+    }
+
+    const size_t GT_BYTES = N_HAPS * sizeof(int32_t);
+    double ns;
+
+    // WAH encoding
+    uint32_t alt_allele_count = 0;
+    bool has_missing = false;
+    auto wah = wah::wah_encode2_with_size<WAH_T, A_T>(gt_arr.data(), 1, a, N_HAPS, alt_allele_count, has_missing);
+    const size_t WAH_BYTES = wah.size() * sizeof(WAH_T);
+    ns = bench::median_ns_per_call([&]{
+        auto w = wah::wah_encode2_with_size<WAH_T, A_T>(gt_arr.data(), 1, a, N_HAPS, alt_allele_count, has_missing);
+        bench::keep(w.size());
+    });
+    bench::report(std::cout, csv, "wah_encode2_with_size", N_HAPS, density, ns, N_HAPS, GT_BYTES + N_HAPS * sizeof(A_T) + WAH_BYTES);
+
+    // WAH decoding
+    std::vector<bool> bits(N_HAPS + sizeof(WAH_T)*8);
+    ns = bench::median_ns_per_call([&]{
+        size_t _;
+        bench::keep((uint64_t)wah::wah2_extract_template<WAH_T, false>(wah.data(), bits, N_HAPS, _));
+    });
+    bench::report(std::cout, csv, "wah2_extract_template", N_HAPS, density, ns, N_HAPS, WAH_BYTES + N_HAPS / 8);
+    ns = bench::median_ns_per_call([&]{
+        size_t count;
+        wah::wah2_extract_template<WAH_T, true>(wah.data(), bits, N_HAPS, count);
+        bench::keep(count);
+    });
+    bench::report(std::cout, csv, "wah2_extract_template<count>", N_HAPS, density, ns, N_HAPS, WAH_BYTES + N_HAPS / 8);
+    ns = bench::median_ns_per_call([&]{
+        WAH_T* p = wah.data();
+        wah::wah2_advance_pointer(p, N_HAPS);
+        bench::keep((uint64_t)p);
+    });
+    bench::report(std::cout, csv, "wah2_advance_pointer", N_HAPS, density, ns, N_HAPS, WAH_BYTES);
+    ns = bench::median_ns_per_call([&]{
+        WAH_T* p = wah.data();
+        bench::keep(wah::wah2_advance_pointer_count_ones(p, N_HAPS));
+    });
+    bench::report(std::cout, csv, "wah2_advance_pointer_count_ones", N_HAPS, density, ns, N_HAPS, WAH_BYTES);
+
+    // PBWT partitions (the arrangement is updated in place, each call partitions the previous one)
+    PBWTSorter sorter;
+    ns = bench::median_ns_per_call([&]{
+        sorter.bool_pbwt_sort(a, b, y, N_HAPS);
+        bench::keep(a[0]);
+    });
+    bench::report(std::cout, csv, "PBWTSorter::bool_pbwt_sort", N_HAPS, density, ns, N_HAPS, 2 * N_HAPS * sizeof(A_T) + N_HAPS / 8);
+    ns = bench::median_ns_per_call([&]{
+        sorter.pred_pbwt_sort<A_T, wah::DefaultPred>(a, b, gt_arr.data(), N_HAPS, 1);
+        bench::keep(a[0]);
+    });
+    bench::report(std::cout, csv, "PBWTSorter::pred_pbwt_sort", N_HAPS, density, ns, N_HAPS, 2 * N_HAPS * sizeof(A_T) + GT_BYTES);
+
+    // Sparse encoding
+    SparseGtLine<A_T> sparse_line(0, gt_arr.data(), N_HAPS, 1);
+    const size_t SPARSE_BYTES = sparse_line.sparse_encoding.size() * sizeof(A_T);
+    ns = bench::median_ns_per_call([&]{
+        Sparse<A_T> s(0, gt_arr.data(), N_HAPS, 1);
+        bench::keep(s.sparse_encoding.size());
+    });
+    bench::report(std::cout, csv, "Sparse", N_HAPS, density, ns, N_HAPS, GT_BYTES + SPARSE_BYTES);
+    ns = bench::median_ns_per_call([&]{
+        SparseGtLine<A_T> s(0, gt_arr.data(), N_HAPS, 1);
+        bench::keep(s.sparse_encoding.size());
+    });
+    bench::report(std::cout, csv, "SparseGtLine", N_HAPS, density, ns, N_HAPS, GT_BYTES + SPARSE_BYTES);
+
+    // Sparse decoding (same memory layout as SparseGtLine::write_to_stream())
+    std::vector<A_T> sparse_buffer(1, (A_T)sparse_line.sparse_encoding.size());
+    sparse_buffer.insert(sparse_buffer.end(), sparse_line.sparse_encoding.begin(), sparse_line.sparse_encoding.end());
+    std::vector<size_t> sparse;
+    ns = bench::median_ns_per_call([&]{
+        bool negated;
+        sparse_decode(sparse_buffer.data(), sparse, negated);
+        bench::keep(sparse.size());
+    });
+    bench::report(std::cout, csv, "sparse_decode", N_HAPS, density, ns, N_HAPS, SPARSE_BYTES + sizeof(A_T) + sparse.size() * sizeof(size_t));
+}
+
+int main(int argc, const char *argv[]) {
+    CLI::App app{"Kernel microbenchmarks (WAH, PBWT, sparse)"};
+    std::vector<size_t> haps = {10000, 100000, 1000000};
+    std::vector<double> densities = {0.0001, 0.001, 0.01, 0.1, 0.5};
+    uint64_t seed = 42;
+    bool csv = false;
+    app.add_option("-n,--haps", haps, "Comma-separated list of haplotype counts")->delimiter(',');
+    app.add_option("-d,--densities", densities, "Comma-separated list of ALT allele densities")->delimiter(',');
+    app.add_option("--seed", seed, "Random seed");
+    app.add_flag("--csv", csv, "Output CSV");
+
+    CLI11_PARSE(app, argc, argv);
+
+    std::mt19937_64 rng(seed);
+    bench::report_header(std::cout, csv);
+    for (const auto n : haps) {
+        if (n > std::numeric_limits<A_T>::max()) {
+            std::cerr << "Too many haplotypes " << n << std::endl;
+            exit(-1);
+        }
+        for (const auto d : densities) {
+            bench_line(n, d, rng, csv);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "CLI11.hpp"
+#include "accessor.hpp"
+#include "stats.hpp"
+#include "xcf.hpp"
+#include "bench.hpp"
+
+#include <iostream>
+#include <random>
+
+/**
+ * @brief A random query, all the records in [beg, end] of contig, restricted
+ *        to the given samples if not empty (positions are 1-based)
+ * */
+struct Query {
+    enum Type : size_t {
+        POINT = 0,
+        REGION,
+        SAMPLES,
+        NUM_TYPES
+    };
+
+    Type type;
+    std::string contig;
+    int64_t beg;
+    int64_t end;
+    std::vector<size_t> samples;
+
+    std::string region() const {
+        return contig + ":" + std::to_string(beg) + "-" + std::to_string(end);
+    }
+};
+
+/**
+ * @brief Answers a query with the CSI index of a BCF file, the genotypes are decoded
+ *        by the derived classes, the BCF is used either as the variant file of an
+ *        XSI file or as the BCF counterpart
+ * */
+class QueryEngine {
+public:
+    QueryEngine(const std::string& bcf_filename) {
+        fp = hts_open(bcf_filename.c_str(), "r");
+        if (!fp) {
+            std::cerr << "Could not open " << bcf_filename << std::endl;
+            throw "File open error";
+        }
+        hdr = bcf_hdr_read(fp);
+        idx = bcf_index_load(bcf_filename.c_str());
+        if (!hdr or !idx) {
+            std::cerr << "Could not load the header or the CSI index of " << bcf_filename << std::endl;
+            throw "File open error";
+        }
+        rec = bcf_init();
+    }
+
+    virtual ~QueryEngine() {
+        bcf_destroy(rec);
+        hts_idx_destroy(idx);
+        bcf_hdr_destroy(hdr);
+        hts_close(fp);
+    }
+
+    virtual std::string name() const = 0;
+
+    /**
+     * @brief Runs the query and returns the number of records, the bytes of the records
+     *        read are added to bytes
+     * */
+    size_t run(const Query& q, uint64_t& bytes) {
+        size_t records = 0;
+        hts_itr_t* itr = bcf_itr_querys(idx, hdr, q.region().c_str());
+        if (!itr) {
+            return 0;
+        }
+        prepare(q);
+        while (bcf_itr_next(fp, itr, rec) >= 0) {
+            if (rec->pos + 1 < q.beg) continue; // Starts before, overlaps the region
+            bcf_unpack(rec, BCF_UN_ALL);
+            bytes += rec->shared.l + rec->indiv.l;
+            decode(q);
+            records++;
+        }
+        hts_itr_destroy(itr);
+        return records;
+    }
+
+protected:
+    virtual void prepare(const Query& q) = 0;
+    virtual void decode(const Query& q) = 0;
+
+    htsFile* fp = nullptr;
+    bcf_hdr_t* hdr = nullptr;
+    hts_idx_t* idx = nullptr;
+    bcf1_t* rec = nullptr;
+};
+
+class XsiQueryEngine : public QueryEngine {
+public:
+    XsiQueryEngine(std::string& filename) : QueryEngine(Accessor::get_variant_filename(filename)), accessor(filename),
+        gt_arr(accessor.get_header_ref().hap_samples) {}
+
+    std::string name() const override {return "xsi";}
+    size_t num_samples() const {return accessor.get_number_of_samples();}
+
+protected:
+    void prepare(const Query& q) override {
+        // With sample tiles only the tiles of the samples are decoded
+        accessor.set_sample_subset(q.samples);
+    }
+
+    void decode(const Query& q) override {
+        (void)q; // Unused
+        const size_t position = accessor.position_from_bm_entry(hdr, rec);
+        accessor.fill_genotype_array(gt_arr.data(), gt_arr.size(), rec->n_allele, position);
+        bench::keep(gt_arr[0]);
+    }
+
+    Accessor accessor;
+    std::vector<int32_t> gt_arr;
+};
+
+class BcfQueryEngine : public QueryEngine {
+public:
+    BcfQueryEngine(const std::string& filename) : QueryEngine(filename) {}
+
+    ~BcfQueryEngine() {
+        free(gt_arr);
+    }
+
+    std::string name() const override {return "bcf";}
+
+protected:
+    void prepare(const Query& q) override {(void)q;}
+
+    void decode(const Query& q) override {
+        const int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &size_gt_arr);
+        if (ngt <= 0) {
+            std::cerr << "Failed to get genotypes" << std::endl;
+            throw "Failed to get genotypes";
+        }
+        if (q.samples.empty()) {
+            bench::keep(gt_arr[0]);
+        } else {
+            // BCF has no random access to the samples, all genotypes are decoded
+            const size_t ploidy = ngt / bcf_hdr_nsamples(hdr);
+            int32_t acc = 0;
+            for (const auto s : q.samples) {
+                acc += gt_arr[s * ploidy];
+            }
+            bench::keep(acc);
+        }
+    }
+
+    int32_t* gt_arr = nullptr;
+    int size_gt_arr = 0;
+};
+
+/**
+ * @brief Reads the position of every record of a BCF file, queries are drawn from these sites
+ * */
+void read_sites(const std::string& filename, std::vector<std::string>& contigs, std::vector<std::pair<int32_t, int64_t> >& sites) {
+    bcf_file_reader_info_t bcf_fri;
+    initialize_bcf_file_reader(bcf_fri, filename);
+    bcf_hdr_t* hdr = bcf_fri.sr->readers[0].header;
+    int nseqs = 0;
+    const char** seqnames = bcf_hdr_seqnames(hdr, &nseqs);
+    for (int i = 0; i < nseqs; ++i) {
+        contigs.push_back(seqnames[i]);
+    }
+    free(seqnames);
+    while (bcf_next_line(bcf_fri)) {
+        sites.push_back(std::make_pair(bcf_fri.line->rid, (int64_t)bcf_fri.line->pos + 1));
+    }
+    destroy_bcf_file_reader(bcf_fri);
+}
+
+int main(int argc, const char *argv[]) {
+    CLI::App app{"Random access latency benchmark"};
+    std::string filename;
+    std::string bcf_filename;
+    size_t num_queries = 1000;
+    int64_t region_size = 10000;
+    size_t subset_size = 10;
+    uint64_t seed = 42;
+    app.add_option("-f,--file", filename, "XSI file")->required();
+    app.add_option("-b,--bcf", bcf_filename, "BCF counterpart of the XSI file (indexed), optional");
+    app.add_option("-q,--queries", num_queries, "Number of queries of each type");
+    app.add_option("--region-size", region_size, "Size of the region queries in bp");
+    app.add_option("--subset-size", subset_size, "Number of samples of the sample subset queries");
+    app.add_option("--seed", seed, "Random seed");
+
+    CLI11_PARSE(app, argc, argv);
+
+    try {
+        if (is_xsi_container(filename)) {
+            std::cerr << "Single-file containers are not supported, the variant BCF file and its index are required" << std::endl;
+            throw "Unsupported file";
+        }
+
+        // Queries are drawn from the sites of the variant file
+        std::vector<std::string> contigs;
+        std::vector<std::pair<int32_t, int64_t> > sites;
+        read_sites(Accessor::get_variant_filename(filename), contigs, sites);
+        if (sites.empty()) {
+            std::cerr << "No sites in " << filename << std::endl;
+            throw "Empty file";
+        }
+
+        std::vector<std::unique_ptr<QueryEngine> > engines;
+        auto xsi_engine = make_unique<XsiQueryEngine>(filename);
+        const size_t num_samples = xsi_engine->num_samples();
+        engines.push_back(std::move(xsi_engine));
+        if (!bcf_filename.empty()) {
+            engines.push_back(make_unique<BcfQueryEngine>(bcf_filename));
+        }
+
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<size_t> site_dist(0, sites.size()-1);
+        std::uniform_int_distribution<size_t> sample_dist(0, num_samples ? num_samples-1 : 0);
+        std::vector<Query> queries;
+        for (size_t t = 0; t < Query::NUM_TYPES; ++t) {
+            for (size_t i = 0; i < num_queries; ++i) {
+                const auto& site = sites[site_dist(rng)];
+                Query q;
+                q.type = (Query::Type)t;
+                q.contig = contigs.at(site.first);
+                q.beg = site.second;
+                q.end = (q.type == Query::REGION) ? site.second + region_size - 1 : site.second;
+                if (q.type == Query::SAMPLES) {
+                    for (size_t s = 0; s < subset_size; ++s) {
+                        q.samples.push_back(sample_dist(rng));
+                    }
+                    std::sort(q.samples.begin(), q.samples.end());
+                    q.samples.erase(std::unique(q.samples.begin(), q.samples.end()), q.samples.end());
+                }
+                queries.push_back(q);
+            }
+        }
+        std::shuffle(queries.begin(), queries.end(), rng);
+
+        // Counters only, the stage timers would add to the latency
+        Stats::enable(true, false);
+
+        static const char* type_names[Query::NUM_TYPES] = {"point", "region", "samples"};
+        std::cout << std::left << std::setw(6) << "file" << std::setw(9) << "query" << std::right
+                  << std::setw(8) << "queries" << std::setw(12) << "p50[us]" << std::setw(12) << "p95[us]" << std::setw(12) << "p99[us]"
+                  << std::setw(10) << "records" << std::setw(10) << "blocks" << std::setw(12) << "zstd_blocks" << std::setw(14) << "bytes" << std::endl;
+        for (auto& engine : engines) {
+            std::vector<std::vector<double> > latencies(Query::NUM_TYPES);
+            std::vector<uint64_t> records(Query::NUM_TYPES, 0);
+            std::vector<uint64_t> blocks(Query::NUM_TYPES, 0);
+            std::vector<uint64_t> zstd_blocks(Query::NUM_TYPES, 0);
+            std::vector<uint64_t> bytes(Query::NUM_TYPES, 0);
+            for (const auto& q : queries) {
+                const uint64_t blocks_before = Stats::get(Stats::COUNTER_BLOCKS_LOADED);
+                const uint64_t zstd_before = Stats::get(Stats::COUNTER_BLOCKS_DECOMPRESSED);
+                const uint64_t bytes_before = Stats::get(Stats::COUNTER_BYTES_DECOMPRESSED);
+                uint64_t record_bytes = 0;
+                auto begin = std::chrono::steady_clock::now();
+                records[q.type] += engine->run(q, record_bytes);
+                auto end = std::chrono::steady_clock::now();
+                latencies[q.type].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / 1000.0);
+                blocks[q.type] += Stats::get(Stats::COUNTER_BLOCKS_LOADED) - blocks_before;
+                zstd_blocks[q.type] += Stats::get(Stats::COUNTER_BLOCKS_DECOMPRESSED) - zstd_before;
+                bytes[q.type] += record_bytes + Stats::get(Stats::COUNTER_BYTES_DECOMPRESSED) - bytes_before;
+            }
+            for (size_t t = 0; t < Query::NUM_TYPES; ++t) {
+                const double n = (double)latencies[t].size();
+                std::cout << std::left << std::setw(6) << engine->name() << std::setw(9) << type_names[t] << std::right
+                          << std::setw(8) << latencies[t].size() << std::fixed << std::setprecision(1)
+                          << std::setw(12) << bench::percentile(latencies[t], 0.50)
+                          << std::setw(12) << bench::percentile(latencies[t], 0.95)
+                          << std::setw(12) << bench::percentile(latencies[t], 0.99)
+                          << std::setw(10) << records[t] / n << std::setprecision(2)
+                          << std::setw(10) << blocks[t] / n << std::setw(12) << zstd_blocks[t] / n
+                          << std::setw(14) << std::setprecision(0) << bytes[t] / n << std::endl;
+            }
+        }
+    } catch (const char* e) {
+        std::cerr << e << std::endl;
+        exit(-1);
+    }
+
+    return 0;
+}
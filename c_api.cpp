@@ -33,6 +33,8 @@
 #include "c_api.h"
 
 #include "xsi_mixed_vcf.hpp"
+#include "id_index.hpp"
+#include "rare_stream.hpp"
 
 extern "C" {
     c_xcf *c_xcf_new() {
@@ -75,6 +77,14 @@ extern "C" {
         return nsamples;
     }
 
+    int c_xcf_bcf_sr_add_reader(bcf_srs_t* readers, const char* fname) {
+        try {
+            return xsi_bcf_sr_add_reader(readers, fname);
+        } catch (...) {
+            return 0;
+        }
+    }
+
     int __c__xcf__get__genotypes__void(c_xcf *x, int reader_id, const bcf_hdr_t *hdr, bcf1_t *line, void **dst, int *ndst) {
         return reinterpret_cast<Xcf*>(x)->get_genotypes(reader_id, hdr, line, dst, ndst);
     }
@@ -83,4 +93,61 @@ extern "C" {
         delete reinterpret_cast<Xcf*>(x);
     }
 
+    c_xsi_id_index *c_xsi_id_index_open(const char* fname) {
+        try {
+            auto idx = new VariantIdIndex(fname);
+            if (idx->empty()) {
+                delete idx;
+                return NULL;
+            }
+            return (c_xsi_id_index *)idx;
+        } catch (...) {
+            return NULL;
+        }
+    }
+
+    int c_xsi_id_index_lookup(c_xsi_id_index *idx, const char* id, uint32_t* bm, int max_bm) {
+        auto entries = reinterpret_cast<VariantIdIndex*>(idx)->lookup(id);
+        for (int i = 0; i < (int)entries.size() and i < max_bm; ++i) {
+            bm[i] = entries[i].bm;
+        }
+        return entries.size();
+    }
+
+    void c_xsi_id_index_close(c_xsi_id_index *idx) {
+        delete reinterpret_cast<VariantIdIndex*>(idx);
+    }
+
+    c_xsi_rare_stream *c_xsi_rare_stream_open(const char* fname) {
+        try {
+            auto rs = new RareVariantStream(fname);
+            if (rs->empty()) {
+                delete rs;
+                return NULL;
+            }
+            return (c_xsi_rare_stream *)rs;
+        } catch (...) {
+            return NULL;
+        }
+    }
+
+    int c_xsi_rare_stream_carriers(c_xsi_rare_stream *rs, uint32_t bm, uint32_t* haps, int max_haps) {
+        std::vector<uint32_t> carriers;
+        try {
+            if (!reinterpret_cast<RareVariantStream*>(rs)->carriers(bm, carriers)) {
+                return -1;
+            }
+        } catch (...) {
+            return -1;
+        }
+        for (int i = 0; i < (int)carriers.size() and i < max_haps; ++i) {
+            haps[i] = carriers[i];
+        }
+        return carriers.size();
+    }
+
+    void c_xsi_rare_stream_close(c_xsi_rare_stream *rs) {
+        delete reinterpret_cast<RareVariantStream*>(rs);
+    }
+
 }
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include "xcf.hpp"
 
 #include "accessor.hpp"
+#include "block_parallel.hpp"
 
 #include "vcf.h"
 #include "hts.h"
@@ -61,6 +62,54 @@ void fill_with_random_normal_values(std::vector<T>& v, double mean, double stdde
     }
 }
 
+// Visitor (see gt_visitor.hpp) that sums the phenotypes of the samples of the set haplotypes
+template <typename Y_T>
+class PhenotypeSum {
+public:
+    PhenotypeSum(const std::vector<Y_T>& y, const size_t ploidy) : y(y), PLOIDY(ploidy) {}
+
+    template <typename A_T>
+    inline void on_run(size_t begin, size_t length, const A_T* a) {
+        for (size_t j = 0; j < length; ++j) {
+            Sxy += y[a[begin+j]/PLOIDY];
+        }
+    }
+
+    template <typename A_T, typename WAH_T>
+    inline void on_literal(size_t begin, WAH_T bits, size_t n_bits, const A_T* a) {
+        for (size_t j = 0; j < n_bits; ++j) {
+            if ((bits >> j) & 0x1) {
+                Sxy += y[a[begin+j]/PLOIDY];
+            }
+        }
+    }
+
+    template <typename A_T>
+    inline void on_sparse(const A_T* indices, size_t num, bool negated) {
+        double sum = 0;
+        for (size_t i = 0; i < num; ++i) {
+            #if DEBUG_VERBOSE
+            std::cout << "Add pheno for hap " << indices[i] << std::endl;
+            #endif
+            sum += y[indices[i]/PLOIDY];
+        }
+        if (negated) {
+            // All haplotypes but the listed ones
+            for (const auto& v : y) {
+                Sxy += v * PLOIDY;
+            }
+            Sxy -= sum;
+        } else {
+            Sxy += sum;
+        }
+    }
+
+    double Sxy = 0;
+protected:
+    const std::vector<Y_T>& y;
+    const size_t PLOIDY;
+};
+
 class DotProd {
 public:
     const size_t PLOIDY = 2;
@@ -119,129 +168,14 @@ public:
         }
     }
 
-    template <typename Y_T, typename A_T>
-    DotProd(const A_T* s_p, const std::vector<Y_T>& y) {
-        constexpr A_T MSB_BIT = (A_T)1 << (sizeof(A_T)*8-1);
-        A_T num = *s_p;
-        num &= ~MSB_BIT; // Remove the bit !
-        s_p++;
-        Sxy = 0;
-        for (A_T i = 0; i < num; i++) {
-            auto s = *s_p;
-            #if DEBUG_VERBOSE
-            std::cout << "Add pheno for hap " << s << std::endl;
-            #endif
-            Sxy += y[s>>1];
-            s_p++;
-        }
-    }
-
-    // From WAH encoded x (gt : 0,1,2)
-    template <typename Y_T, typename ARRANGEMENT_T, typename WAH_ARRAY_T = std::vector<uint16_t> >
-    DotProd(const WAH_ARRAY_T& wah, const ARRANGEMENT_T& a, const std::vector<Y_T>& y) {
-        #define NEWCODE 1
-        #if NEWCODE
-        constexpr size_t WAH_BITS = sizeof(wah[0])*8-1;
-        constexpr uint16_t WAH_HIGH_BIT = 1 << WAH_BITS;
-        constexpr uint16_t WAH_COUNT_1_BIT = WAH_HIGH_BIT >> 1;
-        constexpr uint16_t WAH_MAX_COUNTER = (WAH_HIGH_BIT>>1)-1;
-
-        //const size_t WAH_SIZE = wah.size();
-        const size_t MAX_SIZE = y.size()*PLOIDY;
-        size_t counter = 0;
-
-        n = y.size();
-        Sxy = 0;
-        //for (size_t i = 0; i < WAH_SIZE; ++i) {
-        for (size_t i = 0; counter < MAX_SIZE; ++i) {
-            uint16_t word = wah[i];
-            if (word & WAH_HIGH_BIT) {
-                if (word & WAH_COUNT_1_BIT) {
-                    // Ones
-                    size_t ones = (wah[i] & WAH_MAX_COUNTER)*WAH_BITS;
-                    if (counter+ones <= MAX_SIZE) {
-                        for (size_t j = 0; j < ones; ++j) {
-                            #if DEBUG_VERBOSE
-                            std::cout << "Added pheno for hap " << a[counter+j/PLOIDY] << std::endl;
-                            #endif
-                            Sxy += y[a[counter+j]/PLOIDY];
-                        }
-                    } else {
-                        // Unlikely
-                        // Put this as an edge case because slower
-                        // The likely loop doesnot have the internal "if"
-                        for (size_t j = 0; j < ones; ++j) {
-                            if (counter+j >= MAX_SIZE) {
-                                counter=MAX_SIZE;
-                                break; // We have reached the end
-                            }
-                            #if DEBUG_VERBOSE
-                            std::cout << "Added pheno for hap " << a[counter+j/PLOIDY] << std::endl;
-                            #endif
-                            Sxy += y[a[counter+j]/PLOIDY];
-                        }
-                    }
-
-                    counter += ones;
-                } else {
-                    // Zeros
-                    size_t zeros = (wah[i] & WAH_MAX_COUNTER)*WAH_BITS;
-
-                    counter += zeros;
-                }
-            } else {
-                // Mix of values
-                if (counter+WAH_BITS <= MAX_SIZE) {
-                    for (size_t j = 0; j < WAH_BITS; ++j) {
-                        if ((word >> j) & 0x1) {
-                            //std::cout << "counter = " << counter << ", j = " << j << std::endl;
-                            //std::cout << "i = " << a[counter+j]/PLOIDY << ", y = " << y[a[counter+j]/PLOIDY] << std::endl;
-                            #if DEBUG_VERBOSE
-                            std::cout << "Added pheno for hap " << a[counter+j/PLOIDY] << std::endl;
-                            #endif
-                            Sxy += y[a[counter+j]/PLOIDY];
-                        }
-                    }
-                } else {
-                    // Unlikely
-                    // The likely loop does not have the internal "if"
-                    for (size_t j = 0; j < WAH_BITS; ++j) {
-                        if (counter+j >= MAX_SIZE) {
-                            counter=MAX_SIZE;
-                            break; // We have reached the end
-                        }
-                        if ((word >> j) & 0x1) {
-                            //std::cout << "i = " << a[counter+j]/PLOIDY << ", y = " << y[a[counter+j]/PLOIDY] << std::endl;
-                            #if DEBUG_VERBOSE
-                            std::cout << "Added pheno for hap " << a[counter+j/PLOIDY] << std::endl;
-                            #endif
-                            Sxy += y[a[counter+j]/PLOIDY];
-                        }
-                    }
-                }
-                counter += WAH_BITS;
-            }
-        }
-
-        // Old (Slow) code below
-        #else
-        std::vector<bool> bits(y.size()*PLOIDY+sizeof(uint16_t)*8);
-        std::vector<size_t> x(y.size());
-
+    // From the internal access of a binary line (sparse or WAH), the line is not decoded
+    template <typename Y_T>
+    DotProd(const InternalGtAccess& ia, const std::vector<Y_T>& y) {
         n = y.size();
-
-        // Extract WAH (still in a order)
-        wah2_extract((uint16_t*)wah.data(), bits, y.size()*PLOIDY);
-
-        for(size_t i = 0; i < x.size()*PLOIDY; ++i) {
-            // Because we don't have reverse arrangement we have to do this step before the dot product
-            x[a[i]/PLOIDY] += bits[i];
-        }
-        for(size_t i = 0; i < y.size(); ++i) {
-            std::cout << "i = " << i << ", x = " << x[i] << ", y = " << y[i] << std::endl;
-            Sxy += x[i] * y[i];
-        }
-        #endif
+        // Haploid lines have one haplotype per sample
+        PhenotypeSum<Y_T> ps(y, ia.n_haps / y.size());
+        visit_binary_line(ia, ps);
+        Sxy = ps.Sxy;
     }
 
     double Sxy = 0;
@@ -280,9 +214,9 @@ public:
      * @brief Constructor of the Decompressor class
      *
      * @param filename compressed genotype data file
-     * @param bcf_nosamples corresponding bcf file with variant info
+     * @param n_threads number of threads, the blocks are split between the threads if more than 1
      * */
-    DotProductTraversalXSI(std::string filename) : filename(filename), bcf_nosamples(Accessor::get_variant_filename(filename)), accessor(filename), sample_list(accessor.get_sample_list()) {
+    DotProductTraversalXSI(std::string filename, size_t n_threads = 1) : filename(filename), n_threads(n_threads), bcf_nosamples(Accessor::get_variant_filename(filename)), accessor(filename), sample_list(accessor.get_sample_list()) {
         std::fstream s(filename, s.binary | s.in);
         if (!s.is_open()) {
             std::cerr << "Failed to open file " << filename << std::endl;
@@ -316,7 +250,11 @@ public:
      * */
     void decompress() {
         decompress_checks();
-        decompress_core();
+        if (n_threads > 1) {
+            decompress_parallel();
+        } else {
+            decompress_core();
+        }
     }
 
     /**
@@ -336,6 +274,42 @@ public:
     }
 
 private:
+    void decompress_parallel() {
+        BlockParallelTraversal bpt(filename, n_threads);
+        // Per block sums, reduced in block order so that the checksum does not depend on the scheduling
+        std::vector<double> block_sums(bpt.get_number_of_blocks(), 0);
+        std::vector<std::vector<int32_t> > thread_genotypes(bpt.get_number_of_threads(), std::vector<int32_t>(header.hap_samples));
+
+        bpt.traverse([&](size_t thread_id, size_t block_id, Accessor& acc, const bcf_hdr_t *hdr, bcf1_t *rec, size_t bm_index) {
+            (void)hdr;
+            if (rec->n_allele != 2) {
+                return;
+            }
+            // The binary lines of files with sample tiles are split between the tiles, these are decoded
+            bool decode = acc.has_sample_tiles();
+            InternalGtAccess gt;
+            if (!decode) {
+                gt = acc.get_internal_binary_access(bm_index, 1, rec->n_allele);
+                // If default is non REF decompress and do normal dot product
+                decode = gt.sparse[0] && gt.default_allele;
+            }
+            if (decode) {
+                int32_t *gt_arr = thread_genotypes[thread_id].data();
+                acc.fill_genotype_array(gt_arr, header.hap_samples, rec->n_allele, bm_index);
+                DotProd dp(gt_arr, header.hap_samples, phenotypes, true);
+                block_sums[block_id] += dp.Sxy;
+            } else {
+                DotProd dp(gt, phenotypes);
+                block_sums[block_id] += dp.Sxy;
+            }
+        });
+
+        checksum = 0;
+        for (const auto& sum : block_sums) {
+            checksum += sum;
+        }
+    }
+
     void decompress_core() {
         // Read the bcf without the samples (variant info)
         initialize_bcf_file_reader(bcf_fri, bcf_nosamples);
@@ -376,13 +350,13 @@ private:
                 // Non linear access (returns immediately if dp is already at correct position)
                 bm_index = values[0];
             } else {
-                if (header.version == 4) {
+                if (header.version >= 4) {
                     if (current_block_lines == header.ss_rate) {
                         current_block_lines = 0;
                         offset = 0;
                         block_id++;
                     }
-                    bm_index = block_id << 15 | offset;
+                    bm_index = accessor.bm_index(block_id, offset);
                     offset += bcf_fri.line->n_allele-1;
                     current_block_lines++;
                 } else {
@@ -410,43 +384,25 @@ private:
             if (rec->n_allele != 2) {
                 //std::cerr << "Skipping entry with more (or less) than 2 alleles" << std::endl;
             } else {
-                InternalGtAccess gt = accessor.get_internal_access(bcf_fri.sr->readers[0].header, rec);
-                //gt.print_info();
+                // The binary lines of files with sample tiles are split between the tiles, these are decoded
+                bool decode = accessor.has_sample_tiles();
+                InternalGtAccess gt;
+                if (!decode) {
+                    gt = accessor.get_internal_access(bcf_fri.sr->readers[0].header, rec);
+                    //gt.print_info();
+                    decode = gt.sparse[0] && gt.default_allele;
+                }
                 double result = 0;
-                if (gt.sparse[0]) {
-                    if (gt.default_allele) {
-                        // If default is non REF...
-                        // Then decompress and do normal dot product
-                        accessor.fill_genotype_array(genotypes, header.hap_samples, bcf_fri.line->n_allele, bm_index);
-                        DotProd dp(genotypes, header.hap_samples, phenotypes, true);
-                        result = dp.Sxy;
-                    } else {
-                        if (gt.sparse_bytes == 2) {
-                            uint16_t *sp_p = (uint16_t*)gt.pointers[0];
-                            DotProd dp(sp_p, phenotypes);
-                            result = dp.Sxy;
-                        } else if (gt.sparse_bytes == 4) {
-                            uint32_t *sp_p = (uint32_t*)gt.pointers[0];
-                            DotProd dp(sp_p, phenotypes);
-                            result = dp.Sxy;
-                        } else {
-                            throw "Sparse bytes not supported";
-                        }
-                    }
-                } else { /* WAH */
-                    if (gt.a_bytes == 2) {
-                        uint16_t *wah_p = (uint16_t*)gt.pointers[0];
-                        uint16_t *a = (uint16_t*)gt.a;
-                        DotProd dp(wah_p, a, phenotypes);
-                        result = dp.Sxy;
-                    } else if (gt.a_bytes == 4) {
-                        uint16_t *wah_p = (uint16_t*)gt.pointers[0];
-                        uint32_t *a = (uint32_t*)gt.a;
-                        DotProd dp(wah_p, a, phenotypes);
-                        result = dp.Sxy;
-                    } else {
-                        throw "Sparse bytes not supported";
-                    }
+                if (decode) {
+                    // If default is non REF...
+                    // Then decompress and do normal dot product
+                    accessor.fill_genotype_array(genotypes, header.hap_samples, bcf_fri.line->n_allele, bm_index);
+                    DotProd dp(genotypes, header.hap_samples, phenotypes, true);
+                    result = dp.Sxy;
+                } else {
+                    // Sparse or WAH, computed on the compressed line
+                    DotProd dp(gt, phenotypes);
+                    result = dp.Sxy;
                 }
                 //std::cout << "Dot product " << counter++ << " = " << result << std::endl;
                 checksum += result;
@@ -481,6 +437,7 @@ private:
 
 protected:
     std::string filename;
+    const size_t n_threads;
     header_t header;
 
     std::string bcf_nosamples;
@@ -38,9 +38,9 @@ void load_from_bcf(std::string& filename) {
     printElapsedTime(start, end);
 }
 
-void load_from_bin(std::string& filename) {
+void load_from_bin(std::string& filename, size_t n_threads) {
     std::cout << "Dot product benchmark with gt data from file " << filename << "\n";
-    DotProductTraversalXSI xsit(filename);
+    DotProductTraversalXSI xsit(filename, n_threads);
     auto start = std::chrono::steady_clock::now();
     xsit.decompress();
     auto end = std::chrono::steady_clock::now();
@@ -53,7 +53,9 @@ int main(int argc, const char *argv[]) {
 
     CLI::App app{"BCF vs XSI (compressive genomics) dot product app"};
     std::string filename = "-";
+    size_t n_threads = 1;
     app.add_option("-f,--file", filename, "Input file name");
+    app.add_option("-t,--threads", n_threads, "Number of threads, XSI blocks are split between the threads (XSI files only)");
 
     CLI11_PARSE(app, argc, argv);
 
@@ -65,7 +67,7 @@ int main(int argc, const char *argv[]) {
     if (filename.substr(filename.find_last_of(".") + 1) == "bcf") {
         load_from_bcf(filename);
     } else if (filename.substr(filename.find_last_of(".") + 1) == "bin" || filename.substr(filename.find_last_of(".") + 1) == "xsi") {
-        load_from_bin(filename);
+        load_from_bin(filename, n_threads);
     } else {
         std::cerr << "Unrecognized file type\n";
         exit(-1);
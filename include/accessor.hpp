@@ -26,8 +26,28 @@
 
 #include "accessor_internals.hpp"
 #include "accessor_internals_new.hpp"
+#include "gt_visitor.hpp"
 #include "fs.hpp"
 
+/**
+ * @brief Read only view of the position index entries (memory mapped)
+ * */
+class PositionIndexView {
+public:
+    PositionIndexView(const position_index_entry_t* entries = nullptr, size_t n_entries = 0) :
+        entries(entries), n_entries(n_entries) {}
+
+    const position_index_entry_t* begin() const {return entries;}
+    const position_index_entry_t* end() const {return entries + n_entries;}
+    const position_index_entry_t& operator[](size_t i) const {return entries[i];}
+    size_t size() const {return n_entries;}
+    bool empty() const {return n_entries == 0;}
+
+private:
+    const position_index_entry_t* entries;
+    size_t n_entries;
+};
+
 class Accessor {
 public:
 
@@ -55,6 +75,21 @@ public:
 
     inline const std::vector<size_t>& get_allele_counts() const {return internals->get_allele_counts();}
 
+    bool has_allele_counts(size_t position) {
+        return internals->has_allele_counts(position);
+    }
+
+    bool get_block_allele_count_range(size_t position, size_t& min_ac, size_t& max_ac) {
+        if (!zone_map.empty()) {
+            // Answered from the zone map, without touching the block
+            const auto& zone = zone_map.at((position & 0xFFFFFFFF) >> get_bm_offset_bits(header));
+            min_ac = zone.min_ac;
+            max_ac = zone.max_ac;
+            return true;
+        }
+        return internals->get_block_allele_count_range(position, min_ac, max_ac);
+    }
+
     int get_genotypes(const bcf_hdr_t *hdr, bcf1_t *line, void **gt_arr, int *gt_arr_size) {
         size_t ngt = header.hap_samples; /// @todo ploidy
 
@@ -66,27 +101,90 @@ public:
         return fill_genotype_array((int32_t*)*gt_arr, ngt, line->n_allele, position);
     }
 
+    /**
+     * @brief Restricts the genotypes decoded by fill_genotype_array() to a subset of samples
+     *
+     * With sample tiles (--sample-tile-size) only the tiles holding the samples are
+     * decoded, the entries of the other samples in the genotype array are left
+     * untouched. The allele counts are those of the decoded tiles. An empty subset
+     * decodes all samples.
+     * */
+    void set_sample_subset(const std::vector<size_t>& samples) {
+        internals->set_sample_subset(samples);
+    }
+
+    bool has_sample_tiles() const {return header.sample_tile_size != 0;}
+
+    /**
+     * @brief Internal access to the binary genotype lines of a BCF line
+     *
+     * The internal accesses describe the lines of a single GT block, they throw on
+     * files with sample tiles (see has_sample_tiles()), decode the genotypes of those
+     * */
     InternalGtAccess get_internal_access(const bcf_hdr_t *hdr, bcf1_t *line) {
         size_t position = position_from_bm_entry(hdr, line);
         return internals->get_internal_access(line->n_allele, position);
     }
 
+    /**
+     * @brief Internal access to the binary genotype line of one ALT allele of a BCF line
+     *
+     * @param alt_allele the ALT allele, 1 is the first ALT
+     * */
+    InternalGtAccess get_internal_binary_access(const bcf_hdr_t *hdr, bcf1_t *line, size_t alt_allele = 1) {
+        return get_internal_binary_access(position_from_bm_entry(hdr, line), alt_allele, line->n_allele);
+    }
+
+    /**
+     * @brief Internal access to the binary genotype line of one ALT allele of the record at a BM index
+     *
+     * @param position BM index of the record
+     * @param alt_allele the ALT allele, 1 is the first ALT
+     * @param n_alleles number of alleles of the record
+     * */
+    InternalGtAccess get_internal_binary_access(size_t position, size_t alt_allele, size_t n_alleles) {
+        if (alt_allele < 1 || alt_allele >= n_alleles) {
+            std::cerr << "ALT allele " << alt_allele << " requested for a line with " << n_alleles << " alleles" << std::endl;
+            throw "Bad ALT allele";
+        }
+        return internals->get_internal_binary_access(position, alt_allele);
+    }
+
+    /**
+     * @brief Visits the haplotypes carrying an ALT allele without decoding the genotypes
+     *
+     * See gt_visitor.hpp for the visitor callbacks
+     * */
+    template <class Visitor>
+    void visit_binary_gt_line(const bcf_hdr_t *hdr, bcf1_t *line, size_t alt_allele, Visitor& v) {
+        visit_binary_line(get_internal_binary_access(hdr, line, alt_allele), v);
+    }
+
     #define XSI_BCF_VAR_EXTENSION "_var.bcf"
 
     /// @todo All these dependencies on the filenames are dirty and should be fixed ...
     std::string get_variant_filename() {
+        if (has_embedded_variant_file(header)) {
+            return filename; // Single-file container
+        }
         std::stringstream ss;
 		ss << filename << XSI_BCF_VAR_EXTENSION;
 		return ss.str();
     }
 
     static std::string get_variant_filename(const std::string& fname) {
+        if (is_xsi_container(fname)) {
+            return fname; // Single-file container
+        }
         std::stringstream ss;
 		ss << fname << XSI_BCF_VAR_EXTENSION;
 		return ss.str();
     }
 
     static std::string get_filename_from_variant_file(const std::string& fname) {
+        if (is_xsi_container(fname)) {
+            return fname; // Single-file container
+        }
         try {
             auto basename = get_entry_from_bcf(fname, "XSI");
             std::string filename(dirname((char *)fname.c_str()));
@@ -110,17 +208,187 @@ public:
         }
     }
 
+    size_t get_number_of_blocks() const {return header.number_of_ssas;}
+
+    // Position in the binary matrix (BM) from block and offset (in binary lines) in block
+    size_t bm_index(const size_t block_id, const size_t offset) const {
+        return block_id << get_bm_offset_bits(header) | offset;
+    }
+
+    bool fill_block_n_alleles(size_t block_id, std::vector<size_t>& n_alleles) {
+        return internals->fill_block_n_alleles(block_id, n_alleles);
+    }
+
+    bool has_sites() const {return header.has_sites;}
+
+    /**
+     * @brief Decodes the columnar site store (CHROM, POS, ID, REF, ALT, INFO) of a block
+     *
+     * @return false if the file was compressed without site store (--sites)
+     * */
+    bool fill_block_sites(size_t block_id, DecodedSites& sites) {
+        return internals->fill_block_sites(block_id, sites);
+    }
+
+    bool has_position_index() const {return !position_index.empty();}
+    const PositionIndexView& get_position_index() const {return position_index;}
+    const std::vector<std::string>& get_contigs() const {return contigs;}
+
+    bool has_zone_map() const {return !zone_map.empty();}
+    // Summaries of the blocks (one per block), empty for files without zone maps
+    const std::vector<zone_map_entry_t>& get_zone_map() const {return zone_map;}
+
+    /**
+     * @brief Tells if a block may have missing genotypes, without decompressing it
+     *
+     * @return true if the block has missing genotypes or if the file has no zone maps
+     * */
+    bool block_may_have_missing(size_t block_id) const {
+        return zone_map.empty() or (zone_map.at(block_id).flags & ZONE_MAP_HAS_MISSING);
+    }
+
+    /**
+     * @brief Tells if all the genotypes of the block of a BM index are called (no missing, no end of vectors)
+     *
+     * @return false if the block may have missing genotypes or end of vectors (e.g., no zone maps)
+     * */
+    bool block_is_fully_called(size_t position) const {
+        if (zone_map.empty()) {
+            return false;
+        }
+        const auto& zone = zone_map.at((position & 0xFFFFFFFF) >> get_bm_offset_bits(header));
+        return !(zone.flags & (ZONE_MAP_HAS_MISSING | ZONE_MAP_HAS_END_OF_VECTORS));
+    }
+
+    /**
+     * @brief Prints the summary of the block zone maps (and each block if per_block is set)
+     * */
+    void print_zone_map_info(bool per_block = false) const;
+
+    /**
+     * @brief Finds the runs of BCF lines that may overlap a region, without the variant BCF file
+     *
+     * The position index has block granularity, the returned entries hold all
+     * the lines of the region but may also hold lines outside of the region.
+     * The entries of sorted files are found by binary search in the memory
+     * mapped index, unsorted files fall back to a scan.
+     *
+     * @param region chr|chr:pos|chr:beg-end|chr:beg- (1-based, inclusive)
+     * @return the position index entries overlapping the region, in file order
+     * */
+    std::vector<position_index_entry_t> query_position_index(const std::string& region) const;
+
+    /**
+     * @brief Parses a chr|chr:pos|chr:beg-end|chr:beg- region, positions are 1-based, inclusive
+     * */
+    static void parse_region(const std::string& region, std::string& contig, int64_t& beg, int64_t& end);
+
     std::vector<std::string>& get_sample_list() {return sample_list;}
     size_t get_number_of_samples() const {return sample_list.size();}
     const header_t& get_header_ref() const {return header;}
 
 protected:
+    // Maps the file and checks the position index, reads the contig names
+    void map_position_index();
+
     std::unique_ptr<AccessorInternals> internals;
     std::string filename;
     header_t header;
     std::vector<std::string> sample_list;
+    size_t file_size = 0;
+    int fd = -1;
+    void* file_mmap_p = nullptr;
+    PositionIndexView position_index;
+    // Entries are sorted by contig then min_pos (sorted input), allows binary search
+    bool position_index_sorted = false;
+    // Largest max_end - min_pos of an entry per contig, bounds the entries overlapping a position
+    std::vector<int64_t> contig_max_span;
+    std::vector<std::string> contigs;
+    std::vector<zone_map_entry_t> zone_map;
     int *values{NULL};
     int nvalues{0};
 };
 
+/**
+ * @brief Iterates over all BCF lines of an XSI file without the variant BCF file
+ *
+ * The number of alleles of each line is read from the blocks, this allows
+ * to traverse the genotype data only (e.g., matrix exports, compressive kernels)
+ * */
+class XsiLineIterator {
+public:
+    XsiLineIterator(Accessor& accessor) : accessor(accessor), end_block(accessor.get_number_of_blocks()) {}
+
+    /**
+     * @brief Iterates only over the BCF lines of a position index entry
+     * */
+    XsiLineIterator(Accessor& accessor, const position_index_entry_t& entry) :
+        accessor(accessor), next_block(entry.block_id), end_block(entry.block_id+1),
+        first_line(entry.first_record - (size_t)entry.block_id * accessor.get_header_ref().ss_rate),
+        first_offset(entry.first_offset), bcf_line(entry.first_record), lines_left(entry.n_records) {}
+
+    /**
+     * @brief Advances to the next BCF line
+     *
+     * @return false when all the lines have been visited
+     * */
+    bool next() {
+        if (line_in_block < n_alleles.size()) {
+            offset += n_alleles[line_in_block]-1;
+            line_in_block++;
+            bcf_line++;
+        }
+        if (!lines_left) {
+            return false;
+        }
+        // Go to next block (loop in case of empty blocks)
+        while (line_in_block >= n_alleles.size()) {
+            if (next_block >= end_block) {
+                return false;
+            }
+            if (!accessor.fill_block_n_alleles(next_block, n_alleles)) {
+                std::cerr << "Block " << next_block << " does not store the number of alleles per line" << std::endl;
+                throw "Cannot traverse file without variant file";
+            }
+            block_id = next_block++;
+            // Only the first block visited may start in the middle
+            line_in_block = first_line;
+            offset = first_offset;
+            first_line = 0;
+            first_offset = 0;
+        }
+        lines_left--;
+        return true;
+    }
+
+    size_t get_block_id() const {return block_id;}
+    size_t get_line_in_block() const {return line_in_block;}
+    size_t get_bcf_line() const {return bcf_line;}
+    size_t get_n_alleles() const {return n_alleles[line_in_block];}
+    size_t get_bm_index() const {return accessor.bm_index(block_id, offset);}
+
+    size_t fill_genotype_array(int32_t* gt_arr, size_t gt_arr_size) {
+        return accessor.fill_genotype_array(gt_arr, gt_arr_size, get_n_alleles(), get_bm_index());
+    }
+
+    void fill_allele_counts() {
+        accessor.fill_allele_counts(get_n_alleles(), get_bm_index());
+    }
+
+    inline const std::vector<size_t>& get_allele_counts() const {return accessor.get_allele_counts();}
+
+protected:
+    Accessor& accessor;
+    std::vector<size_t> n_alleles;
+    size_t next_block = 0;
+    size_t end_block = 0;
+    size_t first_line = 0;
+    size_t first_offset = 0;
+    size_t block_id = 0;
+    size_t line_in_block = 0;
+    size_t offset = 0; // In binary lines
+    size_t bcf_line = 0;
+    size_t lines_left = (size_t)-1;
+};
+
 #endif /* __ACCESSOR_HPP__ */
\ No newline at end of file
@@ -31,6 +31,7 @@
 #include "compression.hpp"
 #include "xcf.hpp"
 #include "block.hpp"
+#include "site_block.hpp"
 #include "make_unique.hpp"
 
 #include <fcntl.h>
@@ -379,7 +380,12 @@ public:
     size_t wah_bytes;
     size_t a_bytes;
     int32_t default_allele;
-    const void *a;
+    size_t n_haps = 0; // Haplotypes in the binary lines (samples for haploid lines)
+    const void *a; // Arrangement of the last binary line (haploid arrangement for haploid lines)
+    // Binary accesses only, lines of the same block with the same sort count share the arrangement
+    size_t block_id = 0;
+    size_t sort_count = 0; // PBWT sorts applied to the arrangement since the start of the block
+    bool sorting = false; // The line sorts the arrangement, its set haplotypes are the last ones of the next
     std::vector<bool> sparse;
     std::vector<void *> pointers;
 
@@ -403,13 +409,25 @@ public:
     // Fill genotype array also fills allele counts, so this is only to be used when fill_genotype_array is not called (e.g., to recompute AC only)
     virtual void fill_allele_counts(size_t n_alleles, size_t position) = 0;
     virtual inline const std::vector<size_t>& get_allele_counts() const {return allele_counts;}
+    // Returns true if fill_allele_counts does not require to decode the genotypes (does not move the decompression)
+    virtual bool has_allele_counts(size_t position) {(void)position; return false;}
+    // Min and max non reference allele counts of the block the position is in, returns false if unknown
+    virtual bool get_block_allele_count_range(size_t position, size_t& min_ac, size_t& max_ac) {(void)position; (void)min_ac; (void)max_ac; return false;}
+    // Fills the number of alleles of each BCF line of the block, returns false if they are not stored in the block
+    virtual bool fill_block_n_alleles(size_t block_id, std::vector<size_t>& n_alleles) {(void)block_id; (void)n_alleles; return false;}
+    virtual bool fill_block_sites(size_t block_id, DecodedSites& sites) {(void)block_id; (void)sites; return false;}
     virtual inline InternalGtAccess get_internal_access(size_t n_alleles, size_t position) = 0;
+    // Internal access to the binary line of one ALT allele (1 is the first ALT) with its own arrangement
+    virtual inline InternalGtAccess get_internal_binary_access(size_t position, size_t alt_allele) = 0;
+    // Restricts the genotypes filled to the given samples (other samples may be left untouched), all if empty
+    virtual void set_sample_subset(const std::vector<size_t>& samples) {(void)samples;}
     //virtual const std::unordered_map<size_t, std::vector<size_t> >& get_missing_sparse_map() const = 0;
     //virtual const std::unordered_map<size_t, std::vector<size_t> >& get_phase_sparse_map() const = 0;
 protected:
     std::vector<size_t> allele_counts;
 
-    const size_t BM_BLOCK_BITS = 15;
+    // Number of offset bits in the BM index (the name is historical), set from the header
+    size_t BM_BLOCK_BITS = BM_OFFSET_BITS_DEFAULT;
 };
 
 #if 0
@@ -39,6 +39,7 @@
 
 #include "fs.hpp"
 #include "wah.hpp"
+#include "stats.hpp"
 
 using namespace wah;
 
@@ -49,8 +50,8 @@ using namespace wah;
 template <typename A_T = uint32_t, typename WAH_T = uint16_t>
 class DecompressPointerGTBlock : /* public DecompressPointer<A_T, WAH_T>, */ public GTBlockDict, protected PBWTSorter {
 public:
-    DecompressPointerGTBlock(const header_t& header, void* block_p) :
-        header(header), block_p(block_p), N_SAMPLES(header.num_samples), N_HAPS(N_SAMPLES ? N_SAMPLES*2 : header.hap_samples), /// @todo fix ploidy
+    DecompressPointerGTBlock(const header_t& header, void* block_p, const size_t num_samples = 0 /* 0 is all samples, else samples of the tile */) :
+        header(header), block_p(block_p), N_SAMPLES(num_samples ? num_samples : header.num_samples), N_HAPS(N_SAMPLES ? N_SAMPLES*2 : header.hap_samples), /// @todo fix ploidy
         internal_binary_gt_line_position(0),
         internal_binary_weirdness_position(0),
         internal_binary_phase_position(0),
@@ -59,7 +60,12 @@ public:
         y_missing(N_HAPS+sizeof(WAH_T)*8-1, false),
         y_eovs(N_HAPS+sizeof(WAH_T)*8-1, false),
         y_phase(N_HAPS+sizeof(WAH_T)*8-1, false),
-        a_weird(N_HAPS), b_weird(N_HAPS) {
+        a_weird(N_HAPS), b_weird(N_HAPS),
+        arrangement_bytes((a.size() + b.size() + a_weird.size() + b_weird.size()) * sizeof(A_T)),
+        decode_buffer_bytes((y.size() + y_missing.size() + y_eovs.size() + y_phase.size()) / 8) {
+        MemStats::add(MemStats::MEM_ARRANGEMENTS, arrangement_bytes);
+        MemStats::add(MemStats::MEM_DECODE_BUFFERS, decode_buffer_bytes);
+        StageTimer timer(Stats::STAGE_DICTIONARY_PARSE);
         // Load dictionary
         read_dictionary(dictionary, (uint32_t*)block_p);
 
@@ -141,12 +147,20 @@ public:
         non_uniform_phasing_p = non_uniform_phasing_origin_p;
         //if (non_uniform_phasing_origin_p) { std::cerr << "Block has non uniform phasing data" << std::endl; }
 
+        // Per binary line counts (will be nullptr if not present, e.g., older files)
+        allele_counts_origin_p = get_pointer_from_dict<A_T>(KEY_LINE_ALLELE_COUNTS);
+        missing_counts_origin_p = get_pointer_from_dict<A_T>(KEY_LINE_MISSING_COUNTS);
+        bcf_line_alt_alleles_p = get_pointer_from_dict<uint16_t>(KEY_BCF_LINE_ALT_ALLELES);
+
         std::iota(a.begin(), a.end(), 0);
         if (block_has_weirdness) {
             std::iota(a_weird.begin(), a_weird.end(), 0);
         }
     }
-    virtual ~DecompressPointerGTBlock() {}
+    virtual ~DecompressPointerGTBlock() {
+        MemStats::sub(MemStats::MEM_ARRANGEMENTS, arrangement_bytes);
+        MemStats::sub(MemStats::MEM_DECODE_BUFFERS, decode_buffer_bytes);
+    }
 
     /**
      * @brief Updates all internal structures to point to the requested binary gt entry
@@ -167,7 +181,10 @@ public:
                     /// @todo
                     // Resize y based on the vector length
                     if (binary_gt_line_is_sorting[internal_binary_gt_line_position]) {
+                        StageTimer wah_timer(Stats::STAGE_WAH_EXPAND);
                         wah_p = wah2_extract(wah_p, y, CURRENT_N_HAPS);
+                        wah_timer.stop();
+                        Stats::count(Stats::COUNTER_WAH_LINES_EXPANDED);
                     } else {
                         /* reference advance */ wah2_advance_pointer(wah_p, CURRENT_N_HAPS);
                     }
@@ -218,7 +235,10 @@ public:
                 gt_arr[i] = bcf_gt_unphased(sparse_gt) | ((i & 1) & DEFAULT_PHASING);
             }
         } else { /* SORTED WAH */
+            StageTimer wah_timer(Stats::STAGE_WAH_EXPAND);
             wah_p = wah2_extract_count_ones(wah_p, y, CURRENT_N_HAPS, ones);
+            wah_timer.stop();
+            Stats::count(Stats::COUNTER_WAH_LINES_EXPANDED);
             if (haploid_binary_gt_line[internal_binary_gt_line_position]) {
                 auto a1 = haploid_rearrangement_from_diploid(a);
                 for (size_t i = 0; i < CURRENT_N_HAPS; ++i) {
@@ -261,7 +281,10 @@ public:
                     }
                 }
             } else { /* SORTED WAH */
+                StageTimer wah_timer(Stats::STAGE_WAH_EXPAND);
                 wah_p = wah2_extract_count_ones(wah_p, y, CURRENT_N_HAPS, ones);
+                wah_timer.stop();
+                Stats::count(Stats::COUNTER_WAH_LINES_EXPANDED);
                 if (haploid_binary_gt_line[internal_binary_gt_line_position]) {
                     auto a1 = haploid_rearrangement_from_diploid(a);
                     for (size_t i = 0; i < CURRENT_N_HAPS; ++i) {
@@ -386,6 +409,7 @@ public:
     void reset() {
         // Reset internal structures
         std::iota(a.begin(), a.end(), 0);
+        sort_count = 0;
         internal_binary_gt_line_position = 0;
         wah_p = wah_origin_p;
         sparse_p = sparse_origin_p;
@@ -409,13 +433,17 @@ public:
         size_t total_alt = 0;
 
         const size_t CURRENT_N_HAPS = ((haploid_binary_gt_line[internal_binary_gt_line_position]) ? N_SAMPLES : N_HAPS);
+        const size_t START_OFFSET = internal_binary_gt_line_position;
 
         for (size_t alt_allele = 1; alt_allele < n_alleles; ++alt_allele) {
             if (binary_gt_line_is_wah[internal_binary_gt_line_position]) {
                 /// @todo
                 // Resize y based on the vector length
                 if (binary_gt_line_is_sorting[internal_binary_gt_line_position]) {
+                    StageTimer wah_timer(Stats::STAGE_WAH_EXPAND);
                     wah_p = wah2_extract_count_ones(wah_p, y, CURRENT_N_HAPS, ones);
+                    wah_timer.stop();
+                    Stats::count(Stats::COUNTER_WAH_LINES_EXPANDED);
                 } else {
                     /* reference advance */ ones = wah2_advance_pointer_count_ones(wah_p, CURRENT_N_HAPS);
                 }
@@ -434,7 +462,82 @@ public:
             total_alt += ones;
         }
 
-        allele_counts[0] = CURRENT_N_HAPS - total_alt; // - total missing/eovs ?
+        // Missing and end of vector entries are not REF (as in fill_genotype_array_advance())
+        size_t n_missing = 0;
+        size_t n_eovs = 0;
+        if (block_has_weirdness) {
+            if (START_OFFSET != internal_binary_weirdness_position) {
+                std::cerr << "Block decompression corruption on missing or end of vectors" << std::endl;
+            }
+            count_weirdness(START_OFFSET, CURRENT_N_HAPS, n_missing, n_eovs);
+            weirdness_advance(n_alleles-1, CURRENT_N_HAPS);
+        }
+        if (block_has_non_uniform_phasing) {
+            phase_advance(n_alleles-1, CURRENT_N_HAPS);
+        }
+
+        allele_counts[0] = CURRENT_N_HAPS - (total_alt + n_missing + n_eovs);
+    }
+
+    inline bool has_allele_counts() const {
+        return allele_counts_origin_p != nullptr;
+    }
+
+    // Ploidy of the BCF line at the current position (after seek)
+    inline size_t current_line_ploidy() const {
+        return haploid_binary_gt_line[internal_binary_gt_line_position] ? 1 : 2;
+    }
+
+    /**
+     * @brief Fills the allele counts from the per binary line counts stored in the block
+     *
+     * This does not decode genotypes and does not move the decompression pointer
+     * */
+    inline void fill_allele_counts_at(const size_t position, const size_t n_alleles) {
+        allele_counts.resize(n_alleles);
+        size_t total_alt = 0;
+
+        const size_t CURRENT_N_HAPS = ((haploid_binary_gt_line[position]) ? N_SAMPLES : N_HAPS);
+
+        for (size_t alt_allele = 1; alt_allele < n_alleles; ++alt_allele) {
+            allele_counts[alt_allele] = allele_counts_origin_p[position+alt_allele-1];
+            total_alt += allele_counts[alt_allele];
+        }
+
+        const size_t n_missing = missing_counts_origin_p ? missing_counts_origin_p[position] : 0;
+        allele_counts[0] = CURRENT_N_HAPS - (total_alt + n_missing);
+    }
+
+    /**
+     * @brief Gets the min and max non reference allele counts of the BCF lines in the block
+     *
+     * @return false if the block has no such summary
+     * */
+    inline bool get_block_allele_count_range(size_t& min_ac, size_t& max_ac) const {
+        auto min_it = dictionary.find(KEY_MIN_AC);
+        auto max_it = dictionary.find(KEY_MAX_AC);
+        if ((min_it == dictionary.end()) or (max_it == dictionary.end())) {
+            return false;
+        }
+        min_ac = min_it->second;
+        max_ac = max_it->second;
+        return true;
+    }
+
+    /**
+     * @brief Fills the number of alleles of each BCF line in the block
+     *
+     * @return false if the block does not store them (older files)
+     * */
+    inline bool fill_bcf_lines_n_alleles(std::vector<size_t>& n_alleles) const {
+        if (!bcf_line_alt_alleles_p) {
+            return false;
+        }
+        n_alleles.resize(bcf_lines_in_block);
+        for (size_t i = 0; i < bcf_lines_in_block; ++i) {
+            n_alleles[i] = bcf_line_alt_alleles_p[i] + 1; // + REF
+        }
+        return true;
     }
 
     inline const std::vector<size_t>& get_allele_count_ref() const {
@@ -451,9 +554,11 @@ public:
         ia.a_bytes = sizeof(A_T);
 
         if (n_alleles == 0) return ia;
+        const size_t line_position = internal_binary_gt_line_position;
         for (size_t i = 0; i < n_alleles-1; ++i) {
-            seek(internal_binary_gt_line_position+i);
-            ia.a = a.data();
+            seek(line_position+i);
+            ia.a = current_line_arrangement();
+            ia.n_haps = current_line_n_haps();
             if (!binary_gt_line_is_wah[internal_binary_gt_line_position]) {
                 if (i == 0)
                     ia.default_allele = ((*sparse_p) & MSB_BIT) ? 1 : 0; // If REF is sparse then MSB bit is set and ALT1 is default
@@ -470,11 +575,83 @@ public:
         return ia;
     }
 
+    /**
+     * @brief Internal access to the binary genotype line of a single ALT allele
+     *
+     * Unlike get_internal_access() the arrangement is the one the binary line was
+     * encoded with, so this is the access to use for the ALT alleles of multi-allelic lines.
+     *
+     * @param line_position binary line position of the first ALT allele of the BCF line
+     * @param alt_allele the ALT allele (1 for the first ALT)
+     * */
+    InternalGtAccess get_internal_binary_access(size_t line_position, size_t alt_allele) {
+        InternalGtAccess ia;
+        constexpr A_T MSB_BIT = (A_T)1 << (sizeof(A_T)*8-1);
+        seek(line_position + alt_allele - 1);
+        ia.position = internal_binary_gt_line_position;
+        ia.n_alleles = 2;
+        ia.sparse_bytes = sizeof(A_T);
+        ia.wah_bytes = sizeof(WAH_T);
+        ia.a_bytes = sizeof(A_T);
+        ia.a = current_line_arrangement();
+        ia.n_haps = current_line_n_haps();
+        ia.sort_count = sort_count;
+        ia.sorting = binary_gt_line_is_sorting[internal_binary_gt_line_position];
+        if (!binary_gt_line_is_wah[internal_binary_gt_line_position]) {
+            ia.default_allele = ((*sparse_p) & MSB_BIT) ? 1 : 0;
+            ia.sparse.push_back(true);
+            ia.pointers.push_back(sparse_p);
+        } else {
+            ia.default_allele = 0;
+            ia.sparse.push_back(false);
+            ia.pointers.push_back(wah_p);
+        }
+
+        return ia;
+    }
+
     bool current_position_is_sparse() const {
         return !binary_gt_line_is_wah[internal_binary_gt_line_position];
     }
 
 protected:
+    // Fully haploid lines are encoded with the haploid arrangement derived from a
+    inline const A_T* current_line_arrangement() {
+        if (haploid_binary_gt_line[internal_binary_gt_line_position]) {
+            a_haploid = haploid_rearrangement_from_diploid(a);
+            return a_haploid.data();
+        }
+        return a.data();
+    }
+
+    inline size_t current_line_n_haps() const {
+        return (haploid_binary_gt_line[internal_binary_gt_line_position]) ? N_SAMPLES : N_HAPS;
+    }
+
+    // Counts the missing and end of vector entries of a BCF line without advancing the pointers
+    inline void count_weirdness(const size_t position, const size_t CURRENT_N_HAPS, size_t& n_missing, size_t& n_eovs) {
+        if (line_has_missing.size() and line_has_missing[position]) {
+            if (weirdness_strat == WS_SPARSE) {
+                (void) sparse_extract(sparse_missing_p, sparse_missing);
+                n_missing = sparse_missing.size();
+            } else if ((weirdness_strat == WS_PBWT_WAH) or (weirdness_strat == WS_WAH)) {
+                (void) wah2_extract_count_ones(missing_p, y_missing, CURRENT_N_HAPS, n_missing);
+            } else {
+                throw "Unsupported weirdness strategy";
+            }
+        }
+        if (line_has_end_of_vector.size() and line_has_end_of_vector[position]) {
+            if (weirdness_strat == WS_SPARSE) {
+                (void) sparse_extract(sparse_eovs_p, sparse_eovs);
+                n_eovs = sparse_eovs.size();
+            } else if ((weirdness_strat == WS_PBWT_WAH) or (weirdness_strat == WS_WAH)) {
+                (void) wah2_extract_count_ones(eovs_p, y_eovs, CURRENT_N_HAPS, n_eovs);
+            } else {
+                throw "Unsupported weirdness strategy";
+            }
+        }
+    }
+
     inline void weirdness_advance(const size_t STEPS, const size_t CURRENT_N_HAPS) {
         // Update pointers and PBWT weirdness
         for (size_t i = 0; i < STEPS; ++i) {
@@ -579,6 +756,8 @@ protected:
             //std::cerr << "[DEBUG] y : ";
             //for (auto e : y) std::cerr << e << " ";
             //std::cerr << std::endl;
+            StageTimer timer(Stats::STAGE_PBWT_UPDATE);
+            sort_count++;
             if (haploid_binary_gt_line[internal_binary_gt_line_position]) {
                 //std::cerr << "Sort with VLENRATIO2 for line " << internal_binary_gt_line_position << std::endl;
                 private_pbwt_sort<2>();
@@ -617,18 +796,10 @@ protected:
     }
 
     A_T* sparse_extract(A_T* s_p, std::vector<size_t>& sparse) {
-        constexpr A_T MSB_BIT = (A_T)1 << (sizeof(A_T)*8-1);
-        A_T num = *s_p;
-        s_p++;
-
-        sparse_negated = (num & MSB_BIT);
-        num &= ~MSB_BIT; // Remove the bit !
-
-        sparse.clear();
-        for (A_T i = 0; i < num; i++) {
-            sparse.push_back(*s_p);
-            s_p++;
-        }
+        StageTimer timer(Stats::STAGE_SPARSE_DECODE);
+        Stats::count(Stats::COUNTER_SPARSE_LINES_DECODED);
+        s_p = sparse_decode(s_p, sparse, sparse_negated);
+        const size_t num = sparse.size();
 
         const size_t CURRENT_N_HAPS = ((haploid_binary_gt_line[internal_binary_gt_line_position]) ? N_SAMPLES : N_HAPS);
         ones = (sparse_negated ? CURRENT_N_HAPS-num : num);
@@ -693,6 +864,11 @@ protected:
     WAH_T* non_uniform_phasing_origin_p;
     WAH_T* non_uniform_phasing_p;
 
+    // Counts
+    A_T* allele_counts_origin_p;
+    A_T* missing_counts_origin_p;
+    uint16_t* bcf_line_alt_alleles_p;
+
     size_t internal_binary_weirdness_position;
     size_t internal_binary_phase_position;
     std::vector<bool> binary_gt_line_is_wah;
@@ -714,52 +890,233 @@ protected:
     std::vector<bool> y_eovs;
     std::vector<bool> y_phase;
     std::vector<A_T> a_weird, b_weird;
+    std::vector<A_T> a_haploid; // Only used by the internal accesses
+    size_t sort_count = 0; // PBWT sorts of a since the start of the block
+    // Sizes reported with --mem-stats
+    const size_t arrangement_bytes;
+    const size_t decode_buffer_bytes;
 };
 
 template <typename A_T = uint32_t, typename WAH_T = uint16_t>
 class AccessorInternalsNewTemplate : public AccessorInternals {
 private:
-    inline void seek(const size_t& new_position) {
+    /**
+     * @brief Sets the decompression pointer on the block of the binary matrix position
+     *
+     * @return the offset (in binary gt lines) inside the block
+     * */
+    inline uint32_t set_block_from_bm(const size_t& new_position) {
         const size_t OFFSET_MASK = ~((((size_t)-1) >> BM_BLOCK_BITS) << BM_BLOCK_BITS);
         size_t block_id = ((new_position & 0xFFFFFFFF) >> BM_BLOCK_BITS);
         // The offset is relative to the start of the block and is binary gt lines
         uint32_t offset = new_position & OFFSET_MASK;
 
+        if (block_id >= header.number_of_ssas) {
+            std::cerr << "BM index " << new_position << " points to block " << block_id << " but file has " << header.number_of_ssas << " blocks" << std::endl;
+            throw "Bad BM index";
+        }
+
         // If block ID is not current block
         if (!dp or current_block != block_id) {
             set_gt_block_ptr(block_id);
 
             // Make DecompressPointer
-            dp = make_unique<DecompressPointerGTBlock<A_T, WAH_T> >(header, gt_block_p);
+            dp = make_unique<DecompressPointerGTBlock<A_T, WAH_T> >(header, gt_block_p, tile_samples(0));
+            // The other tiles are decompressed on demand
+            for (auto& tdp : tile_dps) {
+                tdp.reset();
+            }
             //std::cerr << "Block ID : " << block_id << " offset : " << offset << std::endl;
         }
 
-        dp->seek(offset);
+        return offset;
+    }
+
+    inline void seek(const size_t& new_position) {
+        dp->seek(set_block_from_bm(new_position));
+    }
+
+    inline size_t tile_samples(const size_t tile) const {
+        if (!header.sample_tile_size) {
+            return 0; // All samples
+        }
+        const size_t first_sample = tile * header.sample_tile_size;
+        return std::min((size_t)header.sample_tile_size, (size_t)header.num_samples - first_sample);
+    }
+
+    /**
+     * @brief Gets the decompression pointer of a sample tile of the current block
+     *
+     * Tile 0 is dp, the others are created on demand
+     * */
+    inline DecompressPointerGTBlock<A_T, WAH_T>& get_tile_dp(const size_t tile) {
+        if (tile == 0) {
+            return *dp;
+        }
+        auto& tdp = tile_dps[tile];
+        if (!tdp) {
+            auto it = block_dictionary.find(IBinaryBlock<uint32_t, uint32_t>::KEY_GT_TILE_ENTRY + tile);
+            if (it == block_dictionary.end()) {
+                std::cerr << "Binary block does not have GT tile " << tile << std::endl;
+                throw "block error";
+            }
+            tdp = make_unique<DecompressPointerGTBlock<A_T, WAH_T> >(header, (char*)block_p + it->second, tile_samples(tile));
+        }
+        return *tdp;
+    }
+
+    inline void add_tile_allele_counts(const std::vector<size_t>& counts) {
+        if (tiled_allele_counts.size() < counts.size()) {
+            tiled_allele_counts.resize(counts.size(), 0);
+        }
+        for (size_t i = 0; i < counts.size(); ++i) {
+            tiled_allele_counts[i] += counts[i];
+        }
     }
 
 public:
     size_t fill_genotype_array(int32_t* gt_arr, size_t gt_arr_size, size_t n_alleles, size_t new_position) override {
-        seek(new_position);
+        StageTimer timer(Stats::STAGE_GENOTYPE_FILL);
+        if (tile_dps.empty()) {
+            seek(new_position);
 
-        return dp->fill_genotype_array_advance(gt_arr, gt_arr_size, n_alleles);
+            return dp->fill_genotype_array_advance(gt_arr, gt_arr_size, n_alleles);
+        }
+
+        // Only the tiles of the sample subset are decoded, each one in its part of the array
+        const uint32_t offset = set_block_from_bm(new_position);
+        tiled_allele_counts.assign(n_alleles, 0);
+        size_t ploidy = 2;
+        for (size_t tile = 0; tile < tile_dps.size(); ++tile) {
+            if (!tile_active[tile]) continue;
+            auto& tdp = get_tile_dp(tile);
+            tdp.seek(offset);
+            ploidy = tdp.current_line_ploidy();
+            const size_t first = tile * header.sample_tile_size * ploidy;
+            tdp.fill_genotype_array_advance(gt_arr + first, gt_arr_size - first, n_alleles);
+            add_tile_allele_counts(tdp.get_allele_count_ref());
+        }
+
+        return header.num_samples * ploidy;
     }
 
     void fill_allele_counts(size_t n_alleles, size_t new_position) override {
-        seek(new_position);
+        const uint32_t offset = set_block_from_bm(new_position);
+
+        if (tile_dps.empty()) {
+            if (dp->has_allele_counts()) {
+                // The counts are stored in the block, no need to decode
+                dp->fill_allele_counts_at(offset, n_alleles);
+            } else {
+                dp->seek(offset);
+                dp->fill_allele_counts_advance(n_alleles);
+            }
+            return;
+        }
 
-        dp->fill_allele_counts_advance(n_alleles);
+        // The counts of all the samples are the sum of the counts of the tiles
+        tiled_allele_counts.assign(n_alleles, 0);
+        for (size_t tile = 0; tile < tile_dps.size(); ++tile) {
+            auto& tdp = get_tile_dp(tile);
+            if (tdp.has_allele_counts()) {
+                tdp.fill_allele_counts_at(offset, n_alleles);
+            } else {
+                tdp.seek(offset);
+                tdp.fill_allele_counts_advance(n_alleles);
+            }
+            add_tile_allele_counts(tdp.get_allele_count_ref());
+        }
+    }
+
+    void set_sample_subset(const std::vector<size_t>& samples) override {
+        if (tile_dps.empty()) {
+            return; // Not tiled, all samples are decoded together
+        }
+        std::fill(tile_active.begin(), tile_active.end(), samples.empty());
+        for (const auto& sample : samples) {
+            if (sample >= header.num_samples) {
+                std::cerr << "Sample index " << sample << " out of range" << std::endl;
+                throw "Bad sample index";
+            }
+            tile_active[sample / header.sample_tile_size] = true;
+        }
+    }
+
+    bool has_allele_counts(size_t position) override {
+        set_block_from_bm(position);
+        if (tile_dps.empty()) {
+            return dp->has_allele_counts();
+        }
+        // The counts are the sums over the tiles, they are stored only if every tile stores them
+        for (size_t tile = 0; tile < tile_dps.size(); ++tile) {
+            if (!get_tile_dp(tile).has_allele_counts()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool get_block_allele_count_range(size_t position, size_t& min_ac, size_t& max_ac) override {
+        set_block_from_bm(position);
+        if (tile_dps.empty()) {
+            return dp->get_block_allele_count_range(min_ac, max_ac);
+        }
+
+        // The sums of the tile ranges bound the range of the block
+        min_ac = 0;
+        max_ac = 0;
+        for (size_t tile = 0; tile < tile_dps.size(); ++tile) {
+            size_t tile_min_ac = 0;
+            size_t tile_max_ac = 0;
+            if (!get_tile_dp(tile).get_block_allele_count_range(tile_min_ac, tile_max_ac)) {
+                return false;
+            }
+            min_ac += tile_min_ac;
+            max_ac += tile_max_ac;
+        }
+        return true;
+    }
+
+    bool fill_block_n_alleles(size_t block_id, std::vector<size_t>& n_alleles) override {
+        set_block_from_bm(block_id << BM_BLOCK_BITS);
+        return dp->fill_bcf_lines_n_alleles(n_alleles);
+    }
+
+    bool fill_block_sites(size_t block_id, DecodedSites& sites) override {
+        set_block_from_bm(block_id << BM_BLOCK_BITS);
+        auto it = block_dictionary.find(IBinaryBlock<uint32_t, uint32_t>::KEY_SITE_ENTRY);
+        if (it == block_dictionary.end()) {
+            return false;
+        }
+        sites.decode((char*)block_p + it->second);
+        return true;
     }
 
     // Directly pass the DecompressPointer Allele counts
     virtual inline const std::vector<size_t>& get_allele_counts() const override {
-        return dp->get_allele_count_ref();
+        return tile_dps.empty() ? dp->get_allele_count_ref() : tiled_allele_counts;
     }
 
     inline InternalGtAccess get_internal_access(size_t n_alleles, size_t position) override {
+        if (!tile_dps.empty()) {
+            std::cerr << "Internal access is not supported for files with sample tiles (--sample-tile-size), check has_sample_tiles() and decode the genotypes instead" << std::endl;
+            throw "Internal access error";
+        }
         seek(position);
         return dp->get_internal_access(n_alleles);
     }
 
+    inline InternalGtAccess get_internal_binary_access(size_t position, size_t alt_allele) override {
+        if (!tile_dps.empty()) {
+            std::cerr << "Internal access is not supported for files with sample tiles (--sample-tile-size), check has_sample_tiles() and decode the genotypes instead" << std::endl;
+            throw "Internal access error";
+        }
+        const size_t line_position = set_block_from_bm(position);
+        InternalGtAccess ia = dp->get_internal_binary_access(line_position, alt_allele);
+        ia.block_id = current_block;
+        return ia;
+    }
+
     AccessorInternalsNewTemplate(std::string filename) {
         std::fstream s(filename, s.binary | s.in);
         if (!s.is_open()) {
@@ -779,11 +1136,17 @@ public:
         }
 
         // Check version
-        if (header.version != 4) {
+        if (header.version != 4 and header.version != 5) {
             std::cerr << "Bad version" << std::endl;
             throw "Bad version";
         }
 
+        // Version 5 and above have 64-bit block indices
+        if (header.ind_bytes != sizeof(uint32_t) and header.ind_bytes != sizeof(uint64_t)) {
+            std::cerr << "Unsupported indices size : " << (size_t)header.ind_bytes << std::endl;
+            throw "Bad indices size";
+        }
+
         file_size = fs::file_size(filename);
         fd = open(filename.c_str(), O_RDONLY, 0);
         if (fd < 0) {
@@ -815,12 +1178,21 @@ public:
             std::cerr << "Ploidy in header is set to 0 !" << std::endl;
             throw "PLOIDY ERROR";
         }
+
+        BM_BLOCK_BITS = get_bm_offset_bits(header);
+
+        if (header.version >= 5 and header.sample_tile_size and header.num_samples) {
+            const size_t num_tiles = (header.num_samples + header.sample_tile_size - 1) / header.sample_tile_size;
+            tile_dps.resize(num_tiles);
+            tile_active.resize(num_tiles, true);
+        }
     }
 
     virtual ~AccessorInternalsNewTemplate() {
         if (header.zstd and block_p) {
             free(block_p);
             block_p = nullptr;
+            MemStats::sub(MemStats::MEM_ZSTD_BUFFERS, block_p_size);
         }
         munmap(file_mmap_p, file_size);
         close(fd);
@@ -833,7 +1205,10 @@ protected:
         char* p = (char*)block_p;
 
         try {
-            p += block_dictionary.at(IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY);
+            // With sample tiles the first tile is the entry point of the block
+            p += block_dictionary.at(tile_dps.empty() ?
+                                     (uint32_t)IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY :
+                                     (uint32_t)IBinaryBlock<uint32_t, uint32_t>::KEY_GT_TILE_ENTRY);
         } catch (...) {
             std::cerr << "Binary block does not have GT block" << std::endl;
             throw "block error";
@@ -843,9 +1218,13 @@ protected:
     }
 
     inline void set_block_ptr(const size_t block_id) {
-        uint32_t* indices_p = (uint32_t*)((uint8_t*)file_mmap_p + header.indices_offset);
+        Stats::count(Stats::COUNTER_BLOCKS_LOADED);
+        MemStats::block_boundary();
+        void* indices_p = (uint8_t*)file_mmap_p + get_indices_offset(header);
         // Find out the block offset
-        size_t offset = indices_p[block_id];
+        size_t offset = (header.ind_bytes == sizeof(uint64_t)) ?
+                        ((uint64_t*)indices_p)[block_id] :
+                        ((uint32_t*)indices_p)[block_id];
 
         if (header.zstd) {
             size_t compressed_block_size = *(uint32_t*)(((uint8_t*)file_mmap_p) + offset);
@@ -855,6 +1234,7 @@ protected:
             if (block_p) {
                 free(block_p);
                 block_p = nullptr;
+                MemStats::sub(MemStats::MEM_ZSTD_BUFFERS, block_p_size);
             }
 
             block_p = malloc(uncompressed_block_size);
@@ -862,7 +1242,13 @@ protected:
                 std::cerr << "Failed to allocate memory to decompress block" << std::endl;
                 throw "Failed to allocate memory";
             }
+            block_p_size = uncompressed_block_size;
+            MemStats::add(MemStats::MEM_ZSTD_BUFFERS, block_p_size);
+            StageTimer zstd_timer(Stats::STAGE_BLOCK_DECOMPRESS);
             auto result = ZSTD_decompress(block_p, uncompressed_block_size, block_ptr, compressed_block_size);
+            zstd_timer.stop();
+            Stats::count(Stats::COUNTER_BLOCKS_DECOMPRESSED);
+            Stats::count(Stats::COUNTER_BYTES_DECOMPRESSED, uncompressed_block_size);
             if (ZSTD_isError(result)) {
                 std::cerr << "Failed to decompress block" << std::endl;
                 std::cerr << "Error : " << ZSTD_getErrorName(result) << std::endl;
@@ -873,6 +1259,7 @@ protected:
             block_p = ((uint8_t*)file_mmap_p) + offset;
         }
 
+        StageTimer timer(Stats::STAGE_DICTIONARY_PARSE);
         read_dictionary(block_dictionary, (uint32_t*)block_p);
     }
 
@@ -883,8 +1270,13 @@ protected:
     void* file_mmap_p = nullptr;
 
     void* block_p = nullptr;
+    size_t block_p_size = 0; // Decompressed (zstd) block size
     void* gt_block_p = nullptr;
     std::unique_ptr<DecompressPointerGTBlock<A_T, WAH_T> > dp = nullptr;
+    // Sample tiles (empty if the GT blocks are not tiled), tile 0 is dp
+    std::vector<std::unique_ptr<DecompressPointerGTBlock<A_T, WAH_T> > > tile_dps;
+    std::vector<bool> tile_active;
+    std::vector<size_t> tiled_allele_counts;
     size_t current_block = -1;
     std::map<uint32_t, uint32_t> block_dictionary;
 };
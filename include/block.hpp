@@ -98,6 +98,32 @@ public:
     }
 };
 
+/**
+ * @brief Reads a sparse line as written by SparseGtLine::write_to_stream()
+ *
+ * @param s_p pointer to the sparse line
+ * @param sparse filled with the positions
+ * @param negated set if the positions are the ones NOT having the allele (MSB set)
+ * @return pointer past the sparse line
+ * */
+template <typename T = uint32_t>
+inline T* sparse_decode(T* s_p, std::vector<size_t>& sparse, bool& negated) {
+    constexpr T MSB_BIT = (T)1 << (sizeof(T)*8-1);
+    T num = *s_p;
+    s_p++;
+
+    negated = (num & MSB_BIT);
+    num &= ~MSB_BIT; // Remove the bit !
+
+    sparse.clear();
+    for (T i = 0; i < num; i++) {
+        sparse.push_back(*s_p);
+        s_p++;
+    }
+
+    return s_p;
+}
+
 class Block {
 public:
 
@@ -0,0 +1,276 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __BLOCK_PARALLEL_HPP__
+#define __BLOCK_PARALLEL_HPP__
+
+#include "accessor.hpp"
+#include "make_unique.hpp"
+#include "xcf.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Block parallel traversal of an XSI file
+ *
+ * The calling thread reads the records of the variant BCF in file order and
+ * groups them per XSI block, the blocks are processed by a pool of workers that
+ * each have their own Accessor (decompression state). Per thread (or per block)
+ * accumulators are reduced by the caller at the end. The records can then be
+ * handed back in file order, e.g., to be written, in the calling thread.
+ * Requires XSI version 4 or later (records of a block are contiguous).
+ * */
+class BlockParallelTraversal {
+public:
+    /**
+     * @brief Called by the workers for each record with the thread ID (0 to n_threads-1),
+     *        block ID, the accessor of the thread, the variant header, the record and its BM index
+     * */
+    typedef std::function<void(size_t, size_t, Accessor&, const bcf_hdr_t*, bcf1_t*, size_t)> RecordFn;
+    // Called in file order in the calling thread once the record has been processed
+    typedef std::function<void(bcf1_t*)> OrderedFn;
+
+    BlockParallelTraversal(const std::string& filename, size_t n_threads) :
+        filename(filename), n_threads(std::max((size_t)1, n_threads)), accessor(this->filename) {
+        header = accessor.get_header_ref();
+        if (header.version < 4) {
+            std::cerr << "Block parallel traversal requires XSI version 4 or later" << std::endl;
+            throw "Unsupported version";
+        }
+        initialize_bcf_file_reader(bcf_fri, accessor.get_variant_filename());
+    }
+
+    ~BlockParallelTraversal() {
+        destroy_bcf_file_reader(bcf_fri);
+    }
+
+    BlockParallelTraversal(const BlockParallelTraversal&) = delete;
+    BlockParallelTraversal& operator=(const BlockParallelTraversal&) = delete;
+
+    inline const bcf_hdr_t* get_variant_header() const {return bcf_fri.sr->readers[0].header;}
+    inline size_t get_number_of_threads() const {return n_threads;}
+    inline size_t get_number_of_blocks() const {return accessor.get_number_of_blocks();}
+
+    /**
+     * @brief Processes all the records of the file
+     *
+     * @param process called by the workers for each record
+     * @param ordered called in file order by the calling thread after processing (optional)
+     * */
+    void traverse(const RecordFn& process, const OrderedFn& ordered = OrderedFn()) {
+        const bcf_hdr_t *hdr = get_variant_header();
+        // Blocks read ahead of the ordered output, bounds the memory used by the records
+        const size_t MAX_BLOCKS_IN_FLIGHT = n_threads * 2;
+
+        std::deque<std::unique_ptr<Batch> > batches;
+        size_t batches_read = 0;
+        size_t next_to_process = 0;
+        bool reading_done = false;
+        std::atomic<bool> fail(false);
+        // First exception other than const char*, rethrown once the workers are joined
+        std::exception_ptr exception;
+        std::mutex mutex;
+        std::condition_variable cv;
+        // Sets fail, under the lock so that no wait misses the notification
+        auto set_fail = [&](std::exception_ptr e) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fail = true;
+                if (e and !exception) {
+                    exception = e;
+                }
+            }
+            cv.notify_all();
+        };
+
+        auto worker_fn = [&](const size_t thread_id) {
+            try {
+                // The first worker uses the accessor of the traversal
+                std::unique_ptr<Accessor> thread_accessor;
+                if (thread_id) {
+                    thread_accessor = make_unique<Accessor>(filename);
+                }
+                Accessor& acc = thread_id ? *thread_accessor : accessor;
+                while (true) {
+                    Batch* batch = nullptr;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&]{return fail or reading_done or next_to_process < batches_read;});
+                        if (fail or next_to_process == batches_read) break; // Reading done
+                        batch = batches[next_to_process++].get();
+                    }
+                    for (size_t i = 0; i < batch->records.size(); ++i) {
+                        process(thread_id, batch->block_id, acc, hdr, batch->records[i], batch->bm_indices[i]);
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        batch->done = true;
+                    }
+                    cv.notify_all();
+                }
+            } catch (const char* e) {
+                std::cerr << e << std::endl;
+                set_fail(nullptr);
+            } catch (...) {
+                // Any exception escaping the thread would terminate the process
+                set_fail(std::current_exception());
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < n_threads; ++i) {
+            workers.emplace_back(worker_fn, i);
+        }
+
+        // Hands the processed blocks back in file order, waits for at least one if wait is set
+        size_t next_to_emit = 0;
+        auto emit = [&](const bool wait) {
+            while (true) {
+                Batch* batch = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (wait) {
+                        cv.wait(lock, [&]{return fail or batches[next_to_emit]->done;});
+                    }
+                    if (fail or next_to_emit == batches_read or !batches[next_to_emit]->done) return;
+                    batch = batches[next_to_emit].get();
+                }
+                for (auto rec : batch->records) {
+                    if (ordered and !fail) {
+                        try {
+                            ordered(rec);
+                        } catch (const char* e) {
+                            std::cerr << e << std::endl;
+                            set_fail(nullptr);
+                        } catch (...) {
+                            set_fail(std::current_exception());
+                        }
+                    }
+                    bcf_destroy(rec);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                batches[next_to_emit++].reset(); // Frees the batch
+                if (wait) return;
+            }
+        };
+        auto push = [&](std::unique_ptr<Batch>& batch) {
+            while (!fail and batches_read - next_to_emit >= MAX_BLOCKS_IN_FLIGHT) {
+                emit(true);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batches.push_back(std::move(batch));
+                batches_read++;
+            }
+            cv.notify_all();
+            emit(false);
+        };
+
+        // The records of a block are contiguous, ss_rate records per block
+        std::unique_ptr<Batch> batch = make_unique<Batch>();
+        try {
+            size_t block_id = 0;
+            size_t offset = 0;
+            size_t current_block_lines = 0;
+            while (!fail and bcf_next_line(bcf_fri)) {
+                if (current_block_lines == header.ss_rate) {
+                    push(batch);
+                    batch = make_unique<Batch>();
+                    current_block_lines = 0;
+                    offset = 0;
+                    block_id++;
+                }
+                batch->block_id = block_id;
+                batch->records.push_back(bcf_dup(bcf_fri.line));
+                batch->bm_indices.push_back(accessor.bm_index(block_id, offset));
+                offset += bcf_fri.line->n_allele-1;
+                current_block_lines++;
+            }
+            if (!batch->records.empty()) {
+                push(batch);
+            }
+        } catch (const char* e) {
+            std::cerr << e << std::endl;
+            set_fail(nullptr);
+        } catch (...) {
+            set_fail(std::current_exception());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reading_done = true;
+        }
+        cv.notify_all();
+
+        while (!fail and next_to_emit < batches_read) {
+            emit(true);
+        }
+
+        // Always joined, even on failure, destroying joinable threads terminates the process
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (batch) {
+            batches.push_back(std::move(batch)); // Not pushed because of a failure
+        }
+        for (auto& b : batches) {
+            if (b) {
+                for (auto rec : b->records) {
+                    bcf_destroy(rec);
+                }
+            }
+        }
+
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        if (fail) {
+            throw "Failed to traverse blocks";
+        }
+    }
+
+protected:
+    class Batch {
+    public:
+        size_t block_id = 0;
+        std::vector<bcf1_t*> records;
+        std::vector<size_t> bm_indices;
+        bool done = false;
+    };
+
+    std::string filename;
+    const size_t n_threads;
+    Accessor accessor;
+    header_t header;
+    bcf_file_reader_info_t bcf_fri;
+};
+
+#endif /* __BLOCK_PARALLEL_HPP__ */
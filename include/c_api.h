@@ -36,6 +36,8 @@
 #include "synced_bcf_reader.h"
 
 typedef void* c_xcf;
+typedef void* c_xsi_id_index;
+typedef void* c_xsi_rare_stream;
 
 #ifdef __cplusplus
 extern "C" {
@@ -77,6 +79,13 @@ const char* c_xcf_sample_name(c_xcf *x, int reader_id, const bcf_hdr_t *hdr, int
  */
 int c_xcf_nsamples(const char* fname);
 
+/**
+ * @brief Adds a reader as bcf_sr_add_reader, also opens the variant BCF
+ *        embedded in single-file XSI containers (xsqueezeit --single-file)
+ *
+ */
+int c_xcf_bcf_sr_add_reader(bcf_srs_t* readers, const char* fname);
+
 /**
  * @brief equivalent with bcf_get_genotypes but also compatible with xSqueezeIt format
  *        This function will check if the given reader (id) is VCF/BCF or xSqueezeIt in
@@ -92,6 +101,48 @@ int __c__xcf__get__genotypes__void(c_xcf *x, int reader_id, const bcf_hdr_t *hdr
  */
 void c_xcf_delete(c_xcf *x);
 
+/**
+ * @brief Opens (memory maps) the variant ID index of an XSI file (xsqueezeit --id-index)
+ *
+ * @return NULL if the file cannot be opened or has no variant ID index
+ */
+c_xsi_id_index *c_xsi_id_index_open(const char* fname);
+
+/**
+ * @brief Looks up a variant ID (rsID or CHROM:POS:REF:ALT) in the variant ID index
+ *
+ * @param bm receives up to max_bm BM indices of the matching BCF lines, in file order
+ * @return the number of matching BCF lines (may be more than max_bm)
+ */
+int c_xsi_id_index_lookup(c_xsi_id_index *idx, const char* id, uint32_t* bm, int max_bm);
+
+/**
+ * @brief Closes the given variant ID index
+ *
+ */
+void c_xsi_id_index_close(c_xsi_id_index *idx);
+
+/**
+ * @brief Opens the rare variant stream of an XSI file (compressed with --rare-stream)
+ *
+ * @return NULL if the file has no rare variant stream
+ */
+c_xsi_rare_stream *c_xsi_rare_stream_open(const char* fname);
+
+/**
+ * @brief Gets the carriers of a rare binary line without decompressing the GT block
+ *
+ * @param haps receives up to max_haps haplotype indices (sample * 2 + allele index in the sample, sample index on haploid lines)
+ * @return the number of carriers (may be more than max_haps), -1 if the line is not rare
+ */
+int c_xsi_rare_stream_carriers(c_xsi_rare_stream *rs, uint32_t bm, uint32_t* haps, int max_haps);
+
+/**
+ * @brief Closes the given rare variant stream
+ *
+ */
+void c_xsi_rare_stream_close(c_xsi_rare_stream *rs);
+
 #ifdef __cplusplus
 }
 #endif
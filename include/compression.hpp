@@ -27,8 +27,12 @@
 
 #include <cstdint>
 #include <vector>
+#include <string>
 #include <fstream>
 #include <iostream>
+#include <cstddef>
+
+#include "xsi_layout.hpp"
 
 typedef std::vector<size_t> ppa_t;
 
@@ -36,6 +40,7 @@ const uint32_t ENDIANNESS = 0xaabbccdd;
 const uint32_t MAGIC = 0xfeed1767;
 const uint32_t VERSION = 1;
 const uint8_t  PLOIDY_DEFAULT = 2;
+const uint8_t  BM_OFFSET_BITS_DEFAULT = 15;
 
 struct header_s {
     // "rsvd" fields are "reserved", unused for the moment and kept for future additions
@@ -63,11 +68,14 @@ struct header_s {
             bool iota_ppa : 1;        // Reset sort instead of saving permutation arrays
             bool no_sort : 1;         // Data is not permutated
             bool zstd : 1;
-            uint8_t rsvd__2 : 5;
+            bool has_sites : 1;       // Blocks have a columnar site store (CHROM, POS, ID, REF, ALT, INFO)
+            uint8_t rsvd__2 : 4;
         };
     };
-    uint8_t  rsvd_bs[2] = {0,};
-    uint32_t rsvd_1[3] = {0,};
+    uint8_t  bm_offset_bits = 0;      // Number of offset bits in the BM index (0 is 15, the default up to version 4)
+    uint8_t  rsvd_bs[1] = {0,};
+    uint32_t sample_tile_size = 0;    // Number of samples per GT tile of the blocks (0 if the GT blocks are not tiled)
+    uint32_t rsvd_1[2] = {0,};
 
     // 64 bytes
     uint64_t hap_samples = 0;         // Number of haplotypes
@@ -91,7 +99,22 @@ struct header_s {
     uint64_t xcf_entries = 0;         // Num entries in the BCF file (may be less than num_variants if multi-allelic)
     uint32_t phase_info_offset = 0;
     uint64_t num_samples = 0;
-    uint8_t rsvd_3[104] = {0,};
+    // Version 5 and above use 64-bit offsets (the 32-bit offsets are unused)
+    uint64_t indices_offset_64 = 0;   // Position in the binary file of block indices
+    uint64_t wahs_offset_64 = 0;      // Position in the binary file of the blocks
+    uint64_t samples_offset_64 = 0;   // Position in the binary file of samples
+    uint64_t position_index_offset_64 = 0; // Position in the binary file of the position index (0 if none)
+    uint32_t position_index_entries = 0; // Number of entries in the position index
+    uint32_t number_of_contigs = 0;   // Number of contig names following the position index entries
+    // Single-file container, the variant BCF and its CSI index are sections of the XSI file
+    uint64_t variant_bcf_offset_64 = 0; // Position in the binary file of the variant BCF (0 if none)
+    uint64_t variant_bcf_size_64 = 0;   // Size of the variant BCF
+    uint64_t variant_csi_offset_64 = 0; // Position in the binary file of the CSI index of the variant BCF (0 if none)
+    uint64_t variant_csi_size_64 = 0;   // Size of the CSI index
+    uint64_t id_index_offset_64 = 0;    // Position in the binary file of the variant ID index (0 if none)
+    uint64_t id_index_entries = 0;      // Number of entries in the variant ID index
+    uint64_t rare_index_offset_64 = 0;  // Position in the binary file of the rare variant stream block indices (0 if none)
+    uint64_t zone_map_offset_64 = 0;    // Position in the binary file of the block zone maps (0 if none)
 
     // 32 bytes
     uint32_t rsvd_4[3] = {0,};
@@ -105,6 +128,131 @@ struct header_s {
 typedef struct header_s header_t;
 
 static_assert(sizeof(header_t) == 256, "Header is not 256 bytes");
+// The container helpers (xsi_layout.hpp) read the raw header
+static_assert(sizeof(header_t) == XSI_HEADER_SIZE and MAGIC == XSI_HEADER_MAGIC, "Container header layout mismatch");
+static_assert(offsetof(header_t, first_magic) == XSI_HEADER_FIRST_MAGIC_POS and
+              offsetof(header_t, version) == XSI_HEADER_VERSION_POS and
+              offsetof(header_t, last_magic) == XSI_HEADER_LAST_MAGIC_POS, "Container header layout mismatch");
+static_assert(offsetof(header_t, variant_bcf_offset_64) == XSI_HEADER_VARIANT_BCF_OFFSET_POS and
+              offsetof(header_t, variant_bcf_size_64) == XSI_HEADER_VARIANT_BCF_SIZE_POS and
+              offsetof(header_t, variant_csi_offset_64) == XSI_HEADER_VARIANT_CSI_OFFSET_POS and
+              offsetof(header_t, variant_csi_size_64) == XSI_HEADER_VARIANT_CSI_SIZE_POS, "Container header layout mismatch");
+
+/**
+ * @brief Entry of the position index, one per contiguous run of BCF lines of
+ *        the same contig inside a block (usually one per block)
+ *
+ * Positions are 0-based as in htslib, max_end is exclusive and takes the
+ * length of the reference allele into account so that overlapping indels are
+ * found. The BM range of the run is [block_id:first_offset, block_id:end_offset).
+ * */
+struct position_index_entry_s {
+    uint32_t block_id = 0;            // Block holding the run of BCF lines
+    uint32_t contig_id = 0;           // Index in the contig names of the position index
+    uint32_t first_offset = 0;        // Offset (in binary lines) of the first line in the block
+    uint32_t end_offset = 0;          // Offset (in binary lines) after the last line in the block
+    uint32_t n_records = 0;           // Number of BCF lines in the run
+    uint32_t rsvd = 0;
+    int64_t  min_pos = 0;             // Smallest POS of the run
+    int64_t  max_end = 0;             // Largest POS + REF length of the run
+    uint64_t first_record = 0;        // Ordinal of the first BCF line of the run in the file
+} __attribute__((__packed__));
+
+typedef struct position_index_entry_s position_index_entry_t;
+
+static_assert(sizeof(position_index_entry_t) == 48, "Position index entry is not 48 bytes");
+
+enum Zone_Map_Flags : uint32_t {
+    ZONE_MAP_MULTIPLE_CONTIGS = 1,        // The block has lines of more than one contig
+    ZONE_MAP_HAS_MISSING = 2,             // The block has missing genotypes
+    ZONE_MAP_HAS_END_OF_VECTORS = 4,      // The block has end of vectors (mixed ploidy)
+    ZONE_MAP_HAS_NON_UNIFORM_PHASING = 8, // The block has genotypes with non default phasing
+};
+
+/**
+ * @brief Zone map entry, summary of a block (one per block) loaded when the
+ *        file is opened so that filters can skip blocks without decompressing them
+ *
+ * Positions are 0-based and max_end is exclusive as in the position index.
+ * With sample tiles the line counts are summed over the tiles and the AC range
+ * is a bound of the AC range of the block.
+ * */
+struct zone_map_entry_s {
+    uint32_t contig_id = 0;           // Contig of the first line (index in the contig names of the position index)
+    uint32_t flags = 0;               // Zone_Map_Flags
+    int64_t  min_pos = 0;             // Smallest POS of the block
+    int64_t  max_end = 0;             // Largest POS + REF length of the block
+    uint32_t n_records = 0;           // Number of BCF lines
+    uint32_t n_binary_lines = 0;      // Number of binary lines (one per ALT allele)
+    uint32_t n_sparse_lines = 0;      // Number of binary lines encoded as sparse
+    uint32_t n_wah_lines = 0;         // Number of binary lines encoded as WAH
+    uint32_t min_ac = 0;              // Smallest non reference allele count of a BCF line
+    uint32_t max_ac = 0;              // Largest non reference allele count of a BCF line
+} __attribute__((__packed__));
+
+typedef struct zone_map_entry_s zone_map_entry_t;
+
+static_assert(sizeof(zone_map_entry_t) == 48, "Zone map entry is not 48 bytes");
+
+/**
+ * @brief Entry of the variant ID index, one per key of a BCF line (each of its
+ *        IDs and CHROM:POS:REF:ALT for each ALT), entries are sorted by hash
+ *
+ * The position allows to find the BCF line in the variant BCF file (or through
+ * the position index), the BM index points to the GT data directly.
+ * */
+struct id_index_entry_s {
+    uint64_t hash = 0;                // Hash of the key (see variant_id_hash())
+    uint32_t bm = 0;                  // BM index of the BCF line
+    uint32_t contig_id = 0;           // Index in the contig names of the position index
+    int64_t  pos = 0;                 // POS of the BCF line (0-based)
+} __attribute__((__packed__));
+
+typedef struct id_index_entry_s id_index_entry_t;
+
+static_assert(sizeof(id_index_entry_t) == 24, "ID index entry is not 24 bytes");
+
+// 64-bit FNV-1a hash of the variant ID keys
+inline uint64_t variant_id_hash(const std::string& key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char c : key) {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Accessors for the section offsets, version 5 and above have 64-bit offsets
+inline uint64_t get_indices_offset(const header_t& header) {
+    return (header.version >= 5) ? header.indices_offset_64 : header.indices_offset;
+}
+
+inline uint64_t get_wahs_offset(const header_t& header) {
+    return (header.version >= 5) ? header.wahs_offset_64 : header.wahs_offset;
+}
+
+inline uint64_t get_samples_offset(const header_t& header) {
+    return (header.version >= 5) ? header.samples_offset_64 : header.samples_offset;
+}
+
+// Single-file container, the variant BCF is embedded in the XSI file
+inline bool has_embedded_variant_file(const header_t& header) {
+    return (header.version >= 5) and header.variant_bcf_offset_64 and header.variant_bcf_size_64;
+}
+
+// Number of bits used for the offset inside the block in the BM index, the upper bits are the block
+inline size_t get_bm_offset_bits(const header_t& header) {
+    return header.bm_offset_bits ? header.bm_offset_bits : BM_OFFSET_BITS_DEFAULT;
+}
+
+// Offset bits for a given block length, allows an average of 4 binary lines per BCF line (15 for 8192)
+inline size_t default_bm_offset_bits(const size_t block_length) {
+    size_t bits = 0;
+    while (((size_t)1 << bits) < block_length) {
+        bits++;
+    }
+    return bits + 2;
+}
 
 template<typename _ = uint32_t> /// @todo remove template, this is lazyness...
 void print_header_info(const header_t& header) {
@@ -119,14 +267,35 @@ void print_header_info(const header_t& header) {
     //std::cerr << "Uses PPA's : " << (header.iota_ppa ? "no" : "yes" ) << std::endl;
     //std::cerr << "Is not sorted : " << (header.no_sort ? "yes" : "no" ) << std::endl;
     std::cerr << "Has a zstd compression layer : " << (header.zstd ? "yes" : "no") << std::endl;
+    std::cerr << "Has a site store : " << (header.has_sites ? "yes" : "no") << std::endl;
     std::cerr << "--" << std::endl;
     std::cerr << "Haplotype samples  : " << header.hap_samples << std::endl;
     std::cerr << "Number of samples  : " << header.num_samples << std::endl;
     std::cerr << "Number of variants : " << header.num_variants << std::endl;
     std::cerr << "--" << std::endl;
     std::cerr << "VCF records : " << header.xcf_entries << std::endl;
+    std::cerr << "Block length : " << header.ss_rate << " VCF records" << std::endl;
+    std::cerr << "BM index : " << BM_TOTAL_BITS - get_bm_offset_bits(header) << " block bits, " << get_bm_offset_bits(header) << " offset bits" << std::endl;
+    if (has_embedded_variant_file(header)) {
+        std::cerr << "Embedded variant BCF : " << header.variant_bcf_size_64 << " bytes, index : " << header.variant_csi_size_64 << " bytes" << std::endl;
+    }
+    if (header.version >= 5 and header.position_index_offset_64) {
+        std::cerr << "Position index : " << header.position_index_entries << " entries, " << header.number_of_contigs << " contigs" << std::endl;
+    }
+    if (header.version >= 5 and header.sample_tile_size) {
+        std::cerr << "GT sample tiles : " << header.sample_tile_size << " samples per tile" << std::endl;
+    }
+    if (header.version >= 5 and header.zone_map_offset_64) {
+        std::cerr << "Block zone maps : yes" << std::endl;
+    }
+    if (header.version >= 5 and header.rare_index_offset_64) {
+        std::cerr << "Rare variant stream : lines with at most " << header.rare_threshold << " ALT alleles" << std::endl;
+    }
+    if (header.version >= 5 and header.id_index_offset_64) {
+        std::cerr << "Variant ID index : " << header.id_index_entries << " entries" << std::endl;
+    }
     //std::cerr << "Permutation arrays  : " << header.wahs_offset - header.ssas_offset << " bytes" << std::endl;
-    std::cerr << "GT Data WAH encoded : " << header.samples_offset - header.wahs_offset << " bytes" << std::endl;
+    std::cerr << "GT Data WAH encoded : " << get_samples_offset(header) - get_wahs_offset(header) << " bytes" << std::endl;
 }
 
 template<typename _ = uint32_t> /// @todo remove template, this is lazyness...
@@ -25,7 +25,9 @@
 #ifndef __GT_BLOCK_HPP__
 #define __GT_BLOCK_HPP__
 
+#include "compression.hpp"
 #include "interfaces.hpp"
+#include "stats.hpp"
 #include "internal_gt_record.hpp"
 
 class GTBlockDict {
@@ -38,6 +40,8 @@ public:
         KEY_MAX_LINE_PLOIDY = 2,
         KEY_DEFAULT_PHASING = 3,
         KEY_WEIRDNESS_STRATEGY = 4,
+        KEY_MIN_AC = 5,
+        KEY_MAX_AC = 6,
         // Line (Vector) keys
         KEY_LINE_SORT = 0x10,
         KEY_LINE_SELECT = 0x11,
@@ -46,6 +50,9 @@ public:
         KEY_LINE_MISSING = 0x16,
         KEY_LINE_NON_UNIFORM_PHASING = 0x17,
         KEY_LINE_END_OF_VECTORS = 0x18,
+        KEY_LINE_ALLELE_COUNTS = 0x19,
+        KEY_LINE_MISSING_COUNTS = 0x1A,
+        KEY_BCF_LINE_ALT_ALLELES = 0x1B, // Indexed by BCF line, not binary line
         // Matrix keys
         KEY_MATRIX_WAH = 0x20,
         KEY_MATRIX_SPARSE = 0x21,
@@ -148,8 +155,38 @@ public:
     }
 };
 
+/**
+ * @brief GT blocks add their summary to the zone map of the block they are in
+ * */
+class IZoneMapSummary {
+public:
+    virtual void add_to_zone_map(zone_map_entry_t& zone) const = 0;
+
+    virtual ~IZoneMapSummary() {}
+};
+
+/**
+ * @brief GT blocks tell which binary lines of the last BCF line they encoded as non negated sparse lines
+ *
+ * This is how the rare variant stream picks its lines, it stores exactly the lines the GT blocks chose
+ * */
+class IRareLineSource {
+public:
+    /**
+     * @brief Appends the positions of the ALT allele of the last encoded BCF line
+     *
+     * @param carriers gets the positions in the GT array of the line (sample * ploidy of the line + allele index)
+     * @return false if the binary line is not a non negated sparse line (nothing is appended)
+     * */
+    virtual bool last_line_sparse_carriers(const size_t alt_allele, std::vector<uint32_t>& carriers) const = 0;
+    // Ploidy of the last encoded BCF line
+    virtual size_t last_line_ploidy() const = 0;
+
+    virtual ~IRareLineSource() {}
+};
+
 template<typename A_T = uint32_t, typename WAH_T = uint16_t>
-class GtBlock : public IWritableBCFLineEncoder, public BCFBlock, public GTBlockDict, protected PBWTSorter {
+class GtBlock : public IWritableBCFLineEncoder, public IZoneMapSummary, public IRareLineSource, public BCFBlock, public GTBlockDict, protected PBWTSorter {
 public:
     const size_t PLOIDY_2 = 2;
 
@@ -172,10 +209,39 @@ public:
         // Reset a
         std::iota(a.begin(), a.end(), 0);
         std::iota(a_weirdness.begin(), a_weirdness.end(), 0);
+        MemStats::add(MemStats::MEM_ARRANGEMENTS, arrangement_bytes());
     }
 
     inline uint32_t get_id() const override { return IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY; }
 
+    void add_to_zone_map(zone_map_entry_t& zone) const override {
+        const size_t wah_lines = std::count(binary_gt_line_is_wah.begin(), binary_gt_line_is_wah.end(), true);
+        zone.n_wah_lines += wah_lines;
+        zone.n_sparse_lines += binary_gt_line_is_wah.size() - wah_lines;
+        if (effective_bcf_lines_in_block) {
+            // Sums over the tiles (a single GT block gives its own range)
+            zone.min_ac += (uint32_t)block_min_ac;
+            zone.max_ac += (uint32_t)block_max_ac;
+        }
+        if (missing_found) zone.flags |= ZONE_MAP_HAS_MISSING;
+        if (end_of_vector_found) zone.flags |= ZONE_MAP_HAS_END_OF_VECTORS;
+        if (non_uniform_phasing) zone.flags |= ZONE_MAP_HAS_NON_UNIFORM_PHASING;
+    }
+
+    bool last_line_sparse_carriers(const size_t alt_allele, std::vector<uint32_t>& carriers) const override {
+        if ((alt_allele >= last_line_sparse_lines.size()) or (last_line_sparse_lines[alt_allele] == NOT_SPARSE)) {
+            return false;
+        }
+        // Positions are relative to the samples of the block
+        const size_t first_position = sample_offset() * last_line_max_ploidy;
+        for (const auto& position : sparse_encoded_binary_gt_lines[last_line_sparse_lines[alt_allele]].sparse_encoding) {
+            carriers.push_back(first_position + position);
+        }
+        return true;
+    }
+
+    size_t last_line_ploidy() const override { return last_line_max_ploidy; }
+
     void write_to_stream(std::fstream& ofs) override {
         //if (effective_bcf_lines_in_block != BLOCK_BCF_LINES) {
         //    std::cerr << "Block with fewer BCF lines written to stream" << std::endl;
@@ -271,10 +337,14 @@ public:
 
 public:
     inline void encode_line(const bcf_file_reader_info_t& bcf_fri) override {
+        StageTimer scan_timer(Stats::STAGE_SCAN);
         scan_genotypes(bcf_fri);
+        scan_timer.stop();
 
         auto& allele_counts = line_allele_counts[effective_bcf_lines_in_block];
         const auto LINE_MAX_PLOIDY = bcf_fri.ngt / bcf_fri.n_samples;
+        last_line_max_ploidy = LINE_MAX_PLOIDY;
+        last_line_sparse_lines.assign(bcf_fri.line->n_allele, (size_t)NOT_SPARSE);
         //std::cerr << "[DEBUG] : Line " << effective_bcf_lines_in_block
         //          << " ngt : " << bcf_fri.ngt << std::endl;
         //for (size_t i = 0; i < bcf_fri.ngt; ++i) {
@@ -282,6 +352,11 @@ public:
         //}
         //std::cerr << std::endl;
 
+        // Non reference allele count summary of the block
+        const size_t non_ref_allele_count = std::accumulate(allele_counts.begin()+1, allele_counts.end(), (size_t)0);
+        block_min_ac = std::min(block_min_ac, non_ref_allele_count);
+        block_max_ac = std::max(block_max_ac, non_ref_allele_count);
+
         // For all alt alleles (1 if bi-allelic variant site)
         for (size_t alt_allele = 1; alt_allele < bcf_fri.line->n_allele; ++alt_allele) {
 
@@ -300,9 +375,11 @@ public:
                     auto a1 = haploid_rearrangement_from_diploid(a);
                     wah_encoded_binary_gt_lines.push_back(wah::wah_encode2_with_size<WAH_T>(bcf_fri.gt_arr, alt_allele, a1, bcf_fri.ngt, _, __));
                     // Here pbwt_sort1 does the logic for the sorting no need to use a1
+                    StageTimer sort_timer(Stats::STAGE_SORT);
                     pbwt_sort1(a, b, bcf_fri.gt_arr, bcf_fri.ngt, alt_allele);
                 } else if (LINE_MAX_PLOIDY == 2) {
                     wah_encoded_binary_gt_lines.push_back(wah::wah_encode2_with_size<WAH_T>(bcf_fri.gt_arr, alt_allele, a, bcf_fri.ngt, _, __));
+                    StageTimer sort_timer(Stats::STAGE_SORT);
                     pbwt_sort(a, b, bcf_fri.gt_arr, bcf_fri.ngt, alt_allele);
                 } else {
                     std::cerr << "Cannot handle ploidy of " << LINE_MAX_PLOIDY << " with default ploidy " << default_ploidy << std::endl;
@@ -317,7 +394,13 @@ public:
                 // We directly encode the correct number of alleles
                 sparse_encoded_binary_gt_lines.emplace_back(SparseGtLine<A_T>(effective_binary_gt_lines_in_block, bcf_fri.gt_arr, bcf_fri.ngt, sparse_allele));
                 binary_gt_line_is_wah.push_back(false);
+                if (sparse_allele) {
+                    last_line_sparse_lines[alt_allele] = sparse_encoded_binary_gt_lines.size()-1;
+                }
             }
+            // Counts are kept so that allele counts can be retrieved without decoding
+            binary_gt_line_allele_counts.push_back(allele_counts[alt_allele]);
+            binary_gt_line_missing_counts.push_back((alt_allele == 1) ? num_missing_in_current_line + num_eovs_in_current_line : 0);
             effective_binary_gt_lines_in_block++;
         }
 
@@ -399,7 +482,9 @@ public:
         effective_bcf_lines_in_block++;
     }
 
-    virtual ~GtBlock() {}
+    virtual ~GtBlock() {
+        MemStats::sub(MemStats::MEM_ARRANGEMENTS, arrangement_bytes());
+    }
 
 protected:
     const size_t MAC_THRESHOLD;
@@ -435,6 +520,20 @@ protected:
 
     // Set when the binary gt line is WAH encoded (else sparse)
     std::vector<bool> binary_gt_line_is_wah;
+    // Number of haplotypes carrying the alt allele of the binary gt line
+    std::vector<A_T> binary_gt_line_allele_counts;
+    // Number of missing or end of vector entries of the BCF line (set on its first binary gt line)
+    std::vector<A_T> binary_gt_line_missing_counts;
+    // Min and max non reference allele counts of the BCF lines in the block
+    size_t block_min_ac = (size_t)-1;
+    size_t block_max_ac = 0;
+    // Index in the sparse lines of the non negated sparse lines of the last BCF line (by ALT allele)
+    static constexpr size_t NOT_SPARSE = (size_t)-1;
+    std::vector<size_t> last_line_sparse_lines;
+    size_t last_line_max_ploidy = PLOIDY_2;
+
+    // First sample of the block (tiles hold a range of the samples)
+    virtual size_t sample_offset() const { return 0; }
     // Set when the binary gt line PBWT sorts the samples
     //std::vector<bool> binary_gt_line_sorts;
 
@@ -461,12 +560,22 @@ private:
         dictionary[KEY_MAX_LINE_PLOIDY] = max_vector_length;
         dictionary[KEY_DEFAULT_PHASING] = default_phasing;
         dictionary[KEY_WEIRDNESS_STRATEGY] = weirdness_strat;
+        if (effective_bcf_lines_in_block) {
+            dictionary[KEY_MIN_AC] = (uint32_t)block_min_ac;
+            dictionary[KEY_MAX_AC] = (uint32_t)block_max_ac;
+        }
 
         // Those are offsets
         dictionary[KEY_LINE_SORT] = VAL_UNDEFINED;
         dictionary[KEY_LINE_SELECT] = VAL_UNDEFINED;
         dictionary[KEY_MATRIX_WAH] = VAL_UNDEFINED;
         dictionary[KEY_MATRIX_SPARSE] = VAL_UNDEFINED;
+        dictionary[KEY_LINE_ALLELE_COUNTS] = VAL_UNDEFINED;
+        dictionary[KEY_BCF_LINE_ALT_ALLELES] = VAL_UNDEFINED;
+
+        if (missing_found or end_of_vector_found) {
+            dictionary[KEY_LINE_MISSING_COUNTS] = VAL_UNDEFINED;
+        }
 
         if (missing_found) {
             //std::cerr << "[DEBUG] Missing found" << std::endl;
@@ -556,6 +665,23 @@ private:
         total_bytes += written_bytes;
         //std::cout << "sparse " << written_bytes << " bytes, " << total_bytes << " total bytes written" << std::endl;
 
+        // Write allele counts
+        dictionary.at(KEY_LINE_ALLELE_COUNTS) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        write_vector(s, binary_gt_line_allele_counts);
+        if (missing_found or end_of_vector_found) {
+            dictionary.at(KEY_LINE_MISSING_COUNTS) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+            write_vector(s, binary_gt_line_missing_counts);
+        }
+
+        // Write number of alt alleles of the BCF lines (allows traversal without the variant file)
+        dictionary.at(KEY_BCF_LINE_ALT_ALLELES) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        std::vector<uint16_t> alt_alleles(line_alt_alleles_number.begin(), line_alt_alleles_number.begin()+effective_bcf_lines_in_block);
+        write_vector(s, alt_alleles);
+
+        written_bytes = size_t(s.tellp()) - total_bytes;
+        total_bytes += written_bytes;
+        //std::cout << "counts " << written_bytes << " bytes, " << total_bytes << " total bytes written" << std::endl;
+
         // Optional write missing
         if (missing_found) {
             //for (auto v : line_has_missing) { std::cerr << (v ? "1" : "0"); }
@@ -678,6 +804,47 @@ private:
 
     std::vector<A_T> a_weirdness;
     std::vector<A_T> b_weirdness;
+
+    // Size of the ordering vectors (constant for the block), reported with --mem-stats
+    inline size_t arrangement_bytes() const {
+        return (a.size() + b.size() + a_weirdness.size() + b_weirdness.size()) * sizeof(A_T);
+    }
+};
+
+/**
+ * @brief GT block of a tile of contiguous samples [FIRST_SAMPLE, FIRST_SAMPLE+NUM_SAMPLES)
+ *
+ * Each tile is a full GT block of its own (PBWT arrangement, WAH/sparse matrices
+ * and dictionary) so that a subset of samples only requires the tiles it touches
+ * to be decoded.
+ * */
+template<typename A_T = uint32_t, typename WAH_T = uint16_t>
+class GtTileBlock : public GtBlock<A_T, WAH_T> {
+public:
+    GtTileBlock(const size_t TILE, const size_t FIRST_SAMPLE, const size_t NUM_SAMPLES, const size_t BLOCK_BCF_LINES, const size_t MAC_THRESHOLD, const int32_t default_phasing = 0) :
+        GtBlock<A_T, WAH_T>(NUM_SAMPLES, BLOCK_BCF_LINES, MAC_THRESHOLD, default_phasing),
+        TILE(TILE), FIRST_SAMPLE(FIRST_SAMPLE), NUM_SAMPLES(NUM_SAMPLES) {}
+
+    inline uint32_t get_id() const override { return IBinaryBlock<uint32_t, uint32_t>::KEY_GT_TILE_ENTRY + TILE; }
+
+    inline void encode_line(const bcf_file_reader_info_t& bcf_fri) override {
+        // View of the genotypes of the samples of the tile
+        const size_t LINE_MAX_PLOIDY = bcf_fri.ngt / bcf_fri.n_samples;
+        bcf_file_reader_info_t tile_fri = bcf_fri;
+        tile_fri.n_samples = NUM_SAMPLES;
+        tile_fri.ngt = NUM_SAMPLES * LINE_MAX_PLOIDY;
+        tile_fri.gt_arr = bcf_fri.gt_arr + FIRST_SAMPLE * LINE_MAX_PLOIDY;
+        GtBlock<A_T, WAH_T>::encode_line(tile_fri);
+    }
+
+    virtual ~GtTileBlock() {}
+
+protected:
+    size_t sample_offset() const override { return FIRST_SAMPLE; }
+
+    const size_t TILE;
+    const size_t FIRST_SAMPLE;
+    const size_t NUM_SAMPLES;
 };
 
 #endif /* __GT_BLOCK_HPP__ */
\ No newline at end of file
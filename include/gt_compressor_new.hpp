@@ -57,11 +57,22 @@ public:
 
     void set_maf(double new_MAF) {MAF = new_MAF;}
     void set_reset_sort_block_length(size_t new_block_length) {RESET_SORT_BLOCK_LENGTH = new_block_length;}
+    void set_bm_offset_bits(size_t new_bm_offset_bits) {BM_OFFSET_BITS = new_bm_offset_bits;}
+    void set_sites(bool sites, const std::vector<std::string>& info_fields) {SITES = sites; SITE_INFO_FIELDS = info_fields;}
+    void set_id_index(bool id_index) {ID_INDEX = id_index;}
+    void set_sample_tile_size(size_t sample_tile_size) {SAMPLE_TILE_SIZE = sample_tile_size;}
+    void set_rare_stream(bool rare_stream) {RARE_STREAM = rare_stream;}
 
     virtual ~GtCompressor() {}
 
     double MAF = 0.01;
     size_t RESET_SORT_BLOCK_LENGTH = 8192;
+    size_t BM_OFFSET_BITS = 0; // 0 is default given block length
+    bool SITES = false; // Columnar site store in the blocks
+    std::vector<std::string> SITE_INFO_FIELDS;
+    bool ID_INDEX = false; // Variant ID (rsID, CHROM:POS:REF:ALT) to BM index
+    size_t SAMPLE_TILE_SIZE = 0; // Samples per GT tile (0 is no tiles)
+    bool RARE_STREAM = false; // Separate per block section of the rare lines
 };
 
 #include "xsi_factory.hpp" // Depends on InternalGtRecord
@@ -105,7 +116,7 @@ protected:
         this->default_phased = seek_default_phased(this->ifname);
 
         // Requires the bcf gile reader to have been handled to extract the relevant information, this also means we are in the "traverse phase"
-        this->factory = make_unique<XSIF>(ofname, this->RESET_SORT_BLOCK_LENGTH, this->MINOR_ALLELE_COUNT_THRESHOLD, this->default_phased, this->sample_list, zstd_compression_on, zstd_compression_level);
+        this->factory = make_unique<XSIF>(ofname, this->RESET_SORT_BLOCK_LENGTH, this->MINOR_ALLELE_COUNT_THRESHOLD, this->default_phased, this->sample_list, zstd_compression_on, zstd_compression_level, this->BM_OFFSET_BITS, this->SITES, this->SITE_INFO_FIELDS, this->ID_INDEX, this->SAMPLE_TILE_SIZE, this->RARE_STREAM);
     }
 
     void handle_bcf_line() override {
@@ -168,6 +179,11 @@ public:
 
     void set_maf(double new_MAF) {MAF = new_MAF;}
     void set_reset_sort_block_length(size_t reset_sort_block_length) {RESET_SORT_BLOCK_LENGTH = reset_sort_block_length;}
+    void set_bm_offset_bits(size_t bm_offset_bits) {BM_OFFSET_BITS = bm_offset_bits;}
+    void set_sites(bool sites, const std::vector<std::string>& info_fields) {SITES = sites; SITE_INFO_FIELDS = info_fields;}
+    void set_id_index(bool id_index) {ID_INDEX = id_index;}
+    void set_sample_tile_size(size_t sample_tile_size) {SAMPLE_TILE_SIZE = sample_tile_size;}
+    void set_rare_stream(bool rare_stream) {RARE_STREAM = rare_stream;}
     void set_zstd_compression_on(bool on) {zstd_compression_on = on;}
     void set_zstd_compression_level(int level) {zstd_compression_level = level;}
 
@@ -187,6 +203,11 @@ public:
         }
         _compressor->set_maf(MAF);
         _compressor->set_reset_sort_block_length(RESET_SORT_BLOCK_LENGTH);
+        _compressor->set_bm_offset_bits(BM_OFFSET_BITS);
+        _compressor->set_sites(SITES, SITE_INFO_FIELDS);
+        _compressor->set_id_index(ID_INDEX);
+        _compressor->set_sample_tile_size(SAMPLE_TILE_SIZE);
+        _compressor->set_rare_stream(RARE_STREAM);
         _compressor->init_compression(filename);
     }
     void compress_to_file(std::string filename) {
@@ -202,6 +223,12 @@ protected:
     std::unique_ptr<GtCompressor> _compressor = nullptr;
     double MAF = 0.01;
     size_t RESET_SORT_BLOCK_LENGTH = 8192;
+    size_t BM_OFFSET_BITS = 0;
+    bool SITES = false;
+    std::vector<std::string> SITE_INFO_FIELDS;
+    bool ID_INDEX = false;
+    size_t SAMPLE_TILE_SIZE = 0;
+    bool RARE_STREAM = false;
     bool zstd_compression_on = false;
     int zstd_compression_level = 7;
 };
@@ -33,10 +33,18 @@ extern GlobalAppOptions global_app_options;
 #include "make_unique.hpp"
 
 #include "accessor.hpp"
+#include "region_batch.hpp"
+#include "id_index.hpp"
 
 #include "vcf.h"
 #include "hts.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -76,6 +84,7 @@ public:
         } else {
             genotypes = new int32_t[header.hap_samples];
             selected_genotypes = new int32_t[header.hap_samples];
+            MemStats::add(MemStats::MEM_GENOTYPES, 2 * header.hap_samples * sizeof(int32_t));
         }
     }
 
@@ -99,6 +108,9 @@ public:
         if (selected_genotypes) {
             delete[] selected_genotypes;
         }
+        if (genotypes or selected_genotypes) {
+            MemStats::sub(MemStats::MEM_GENOTYPES, 2 * header.hap_samples * sizeof(int32_t));
+        }
     }
 
     void print_info() {
@@ -110,12 +122,26 @@ private:
         htsFile* fp = NULL;
         bcf_hdr_t* hdr = NULL;
 
-        if ((global_app_options.regions != "") or (global_app_options.regions_file != "")) {
-            if (global_app_options.regions != "") {
-                //std::cerr << "regions is set to : " << global_app_options.regions << std::endl;
-                initialize_bcf_file_reader_with_region(bcf_fri, bcf_nosamples, global_app_options.regions);
+        bool skip_all_lines = false;
+        std::vector<std::string> coarse_regions;
+        if (!requested_ids.empty()) {
+            // The ID index gives the positions of the lines, these are queried as regions
+            region_batch = make_unique<RegionBatch>();
+            add_id_regions(*region_batch);
+        } else if ((global_app_options.regions != "") or (global_app_options.regions_file != "")) {
+            const bool is_file = (global_app_options.regions == "");
+            const std::string& regions = is_file ? global_app_options.regions_file : global_app_options.regions;
+            if (!is_file or RegionBatch::is_supported_regions_file(regions)) {
+                // Regions are sorted, merged and coalesced by block, the variant
+                // BCF is seeked once per run of blocks and the lines are matched exactly
+                region_batch = make_unique<RegionBatch>();
+                if (is_file) {
+                    region_batch->add_regions_file(regions);
+                } else {
+                    region_batch->add_regions(regions);
+                }
             } else {
-                initialize_bcf_file_reader_with_region(bcf_fri, bcf_nosamples, global_app_options.regions_file, true /*is file*/);
+                initialize_bcf_file_reader_with_region(bcf_fri, bcf_nosamples, regions, is_file);
             }
         } else if (global_app_options.targets != "") {
             initialize_bcf_file_reader_with_target(bcf_fri, bcf_nosamples, global_app_options.targets);
@@ -123,11 +149,27 @@ private:
             initialize_bcf_file_reader(bcf_fri, bcf_nosamples);
         }
 
+        if (region_batch) {
+            region_batch->sort_and_merge();
+            coarse_regions = region_batch->coalesced_regions(accessor);
+            if (coarse_regions.empty()) {
+                // No region hits the file, only the header is written
+                initialize_bcf_file_reader(bcf_fri, bcf_nosamples);
+                skip_all_lines = true;
+            } else {
+                initialize_bcf_file_reader_with_region(bcf_fri, bcf_nosamples, RegionBatch::join(coarse_regions.begin(), coarse_regions.end()));
+            }
+        }
+
         create_output_file(ofname, fp, hdr);
 
         // Decompress and add the genotype data to the new file
         // This is the main loop, where most of the time is spent
-        if (output_file_is_xsi) {
+        if (skip_all_lines) {
+            // Nothing to decompress
+        } else if (region_batch and (global_app_options.threads > 1) and (coarse_regions.size() > 1) and !output_file_is_xsi) {
+            decompress_regions_parallel(coarse_regions, hdr, fp);
+        } else if (output_file_is_xsi) {
             decompress_inner_loop<true /* XSI */>(bcf_fri, hdr, fp);
         } else {
             decompress_inner_loop<false /* XSI */>(bcf_fri, hdr, fp);
@@ -153,6 +195,124 @@ private:
         destroy_bcf_file_reader(bcf_fri);
     }
 
+    /**
+     * @brief Extracts the coarse regions with worker threads, each with its own reader and accessor
+     *
+     * The regions are split in contiguous chunks that are decompressed in parallel,
+     * the records are written chunk after chunk so that the output is in genomic order.
+     * */
+    void decompress_regions_parallel(const std::vector<std::string>& coarse_regions, bcf_hdr_t *hdr, htsFile *fp) {
+        const size_t n_threads = std::min(global_app_options.threads, coarse_regions.size());
+        // More chunks than threads for load balancing, each chunk reader loads the index
+        const size_t n_chunks = std::min(coarse_regions.size(), n_threads * 4);
+        // Workers don't run further ahead of the writer than this, bounds the memory
+        const size_t window = n_threads * 2;
+
+        std::vector<std::vector<bcf1_t*> > chunk_records(n_chunks);
+        std::vector<bool> chunk_done(n_chunks, false);
+        size_t next_chunk = 0;
+        size_t chunks_written = 0;
+        bool fail = false;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        auto worker_fn = [&]() {
+            try {
+                NewDecompressor worker(filename, bcf_nosamples);
+                worker.decompress_checks();
+                worker.region_batch = make_unique<RegionBatch>(*region_batch);
+                while (true) {
+                    size_t chunk = 0;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&]{return fail or (next_chunk >= n_chunks) or (next_chunk < chunks_written + window);});
+                        if (fail or (next_chunk >= n_chunks)) break;
+                        chunk = next_chunk++;
+                    }
+                    const size_t beg = chunk * coarse_regions.size() / n_chunks;
+                    const size_t end = (chunk+1) * coarse_regions.size() / n_chunks;
+                    std::vector<bcf1_t*> records;
+                    worker.decompress_regions_to_records(RegionBatch::join(coarse_regions.begin()+beg, coarse_regions.begin()+end), hdr, records);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        chunk_records[chunk].swap(records);
+                        chunk_done[chunk] = true;
+                    }
+                    cv.notify_all();
+                }
+            } catch (const char* e) {
+                std::cerr << e << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                fail = true;
+            } catch (...) {
+                // Any exception escaping the thread would terminate the process
+                std::cerr << "Region extraction worker failed" << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                fail = true;
+            }
+            cv.notify_all();
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < n_threads; ++i) {
+            workers.emplace_back(worker_fn);
+        }
+
+        bool write_failed = false;
+        for (size_t chunk = 0; chunk < n_chunks; ++chunk) {
+            std::vector<bcf1_t*> records;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]{return fail or chunk_done[chunk];});
+                if (fail) break;
+                records.swap(chunk_records[chunk]);
+            }
+            for (auto rec : records) {
+                StageTimer timer(Stats::STAGE_BCF_WRITE);
+                if (!write_failed and bcf_write1(fp, hdr, rec)) {
+                    write_failed = true;
+                }
+                Stats::count(Stats::COUNTER_RECORDS_WRITTEN);
+                bcf_destroy(rec);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                chunks_written++;
+                fail = fail or write_failed;
+            }
+            cv.notify_all();
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (auto& records : chunk_records) {
+            for (auto rec : records) {
+                bcf_destroy(rec);
+            }
+        }
+
+        if (write_failed) {
+            std::cerr << "Failed to write record" << std::endl;
+            throw "Failed to write record";
+        }
+        if (fail) {
+            throw "Failed to extract regions";
+        }
+    }
+
+    /**
+     * @brief Decompresses the lines of the regions and keeps the records instead of writing them
+     * */
+    void decompress_regions_to_records(const std::string& regions, bcf_hdr_t *hdr, std::vector<bcf1_t*>& records) {
+        initialize_bcf_file_reader_with_region(bcf_fri, bcf_nosamples, regions);
+        region_batch->reset_cursor();
+        record_sink = &records;
+        decompress_inner_loop<false /* XSI */>(bcf_fri, hdr, NULL);
+        record_sink = nullptr;
+        destroy_bcf_file_reader(bcf_fri);
+    }
+
     // Is templated for performance reasons
     template<const bool XSI = false>
     inline void decompress_inner_loop(bcf_file_reader_info_t& bcf_fri, bcf_hdr_t *hdr, htsFile *fp) {
@@ -169,19 +329,41 @@ private:
         while(bcf_next_line(bcf_fri)) {
             bcf1_t *rec = bcf_fri.line;
 
+            // The coarse regions also hold lines outside of the requested regions
+            if (region_batch and !region_batch->overlaps(bcf_seqname(bcf_fri.sr->readers[0].header, rec), rec->pos+1, rec->pos+rec->rlen)) {
+                continue;
+            }
+            // Lines at the positions of the IDs may have other IDs
+            if (!requested_ids.empty() and !line_matches_requested_ids(bcf_fri.sr->readers[0].header, rec)) {
+                continue;
+            }
+
+            bm_index = accessor.position_from_bm_entry(bcf_fri.sr->readers[0].header, rec);
+
+            bool counts_checked = false;
+            if (filter_allele_counts and !pre_decoding_filter(bm_index, bcf_fri.line->n_allele, counts_checked)) {
+                // The line is never decoded, the next seek will only advance the pointers
+                continue;
+            }
+
+            // Fill the genotype array (as bcf_get_genotypes() would do)
+            current_line_num_genotypes = accessor.fill_genotype_array(genotypes, header.hap_samples, bcf_fri.line->n_allele, bm_index);
+
+            if (filter_allele_counts and !counts_checked and !post_decoding_filter()) {
+                continue;
+            }
+
             // This is used in liear mode and in output nonlinear
             if (current_block_lines == header.ss_rate) {
                 current_block_lines = 0;
                 offset = 0;
                 block_id++;
             }
-            /// @todo replace this constant by the BM bits
-            v4_bm_index = block_id << 15 | offset;
+            // The output XSI uses the same BM bits as the input
+            v4_bm_index = accessor.bm_index(block_id, offset);
             offset += bcf_fri.line->n_allele-1;
             current_block_lines++;
 
-            bm_index = accessor.position_from_bm_entry(bcf_fri.sr->readers[0].header, rec);
-
             if CONSTEXPR_IF (XSI) {
                 // The BM index needs to be updated to reflect the new XSI file
                 int32_t values[1];
@@ -190,13 +372,8 @@ private:
 
                 // This is the "non optimal way"
                 /// @todo replace this by implementing the comments below
-                current_line_num_genotypes = accessor.fill_genotype_array(genotypes, header.hap_samples, bcf_fri.line->n_allele, bm_index);
-
                 update_and_write_xsi(bcf_fri, hdr, fp, rec, ac_s);
             } else {
-                // Fill the genotype array (as bcf_get_genotypes() would do)
-                current_line_num_genotypes = accessor.fill_genotype_array(genotypes, header.hap_samples, bcf_fri.line->n_allele, bm_index);
-
                 update_and_write_bcf_record(bcf_fri, hdr, fp, rec, ac_s);
             }
 
@@ -205,6 +382,122 @@ private:
         }
     }
 
+private:
+    /**
+     * @brief Adds the positions of the requested variant IDs as regions, found with the ID index
+     * */
+    void add_id_regions(RegionBatch& batch) {
+        VariantIdIndex id_index(filename);
+        if (id_index.empty()) {
+            std::cerr << "File " << filename << " has no variant ID index, compress it with --id-index" << std::endl;
+            throw "No variant ID index";
+        }
+        const auto& contigs = accessor.get_contigs();
+        size_t not_found = 0;
+        for (const auto& id : requested_ids) {
+            auto entries = id_index.lookup(id);
+            not_found += entries.empty();
+            for (const auto& entry : entries) {
+                if (entry.contig_id >= contigs.size()) {
+                    throw "Bad contig in variant ID index";
+                }
+                batch.add_region(contigs[entry.contig_id], entry.pos+1, entry.pos+1);
+            }
+        }
+        if (not_found) {
+            std::cerr << not_found << " of " << requested_ids.size() << " variant IDs not found" << std::endl;
+        }
+    }
+
+    inline bool line_matches_requested_ids(const bcf_hdr_t* hdr, bcf1_t* rec) const {
+        for (const auto& key : VariantIdIndex::line_keys(hdr, rec)) {
+            if (requested_ids.find(key) != requested_ids.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool allele_counts_pass_filters(const std::vector<size_t>& allele_counts) const {
+        // Allele counts don't include missing and end of vectors
+        const size_t an = std::accumulate(allele_counts.begin(), allele_counts.end(), (size_t)0);
+        const size_t ac = an - allele_counts[0]; // Non reference
+        if ((ac < global_app_options.min_ac) or (ac > global_app_options.max_ac)) {
+            return false;
+        }
+        if (filter_maf) {
+            // Frequency of all but the most frequent allele (bcftools "nonmajor"),
+            // REF is not always the major allele on multi-allelic sites
+            const size_t major = *std::max_element(allele_counts.begin(), allele_counts.end());
+            const double maf = an ? (double)(an - major) / an : 0.0;
+            if ((maf < global_app_options.min_maf) or (maf > global_app_options.max_maf)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Filters the line before the genotypes are decoded, if possible
+     *
+     * @param counts_checked is set if the filter was applied, else it has to be applied after decoding
+     * */
+    inline bool pre_decoding_filter(const size_t bm_index, const size_t n_alleles, bool& counts_checked) {
+        // When samples are selected the counts have to be recomputed on the selected samples
+        if (select_samples) {
+            return true;
+        }
+
+        // Whole blocks can be skipped based on their allele count summary
+        size_t block_min_ac = 0;
+        size_t block_max_ac = 0;
+        if (accessor.get_block_allele_count_range(bm_index, block_min_ac, block_max_ac)) {
+            if ((block_max_ac < global_app_options.min_ac) or (block_min_ac > global_app_options.max_ac)) {
+                counts_checked = true;
+                return false;
+            }
+            if (!filter_maf and (block_min_ac >= global_app_options.min_ac) and (block_max_ac <= global_app_options.max_ac)) {
+                counts_checked = true;
+                return true;
+            }
+            // Without missing genotypes nor end of vectors AN is at least the number of
+            // samples and the nonmajor count is at most the non reference count, so the
+            // MAF of the lines of the block is at most max AC / samples
+            if (filter_maf and accessor.block_is_fully_called(bm_index) and
+                ((double)block_max_ac < global_app_options.min_maf * header.num_samples)) {
+                counts_checked = true;
+                return false;
+            }
+        }
+
+        if (accessor.has_allele_counts(bm_index)) {
+            accessor.fill_allele_counts(n_alleles, bm_index);
+            counts_checked = true;
+            return allele_counts_pass_filters(accessor.get_allele_counts());
+        }
+
+        return true;
+    }
+
+    inline bool post_decoding_filter() {
+        if (select_samples) {
+            const size_t CURRENT_LINE_PLOIDY = current_line_num_genotypes / header.num_samples;
+            std::vector<size_t> allele_counts(bcf_fri.line->n_allele, 0);
+            for (const auto& sample_index : samples_to_use) {
+                for (size_t i = 0; i < CURRENT_LINE_PLOIDY; ++i) {
+                    const int32_t gt = genotypes[sample_index*CURRENT_LINE_PLOIDY+i];
+                    if (!bcf_gt_is_missing(gt) and (gt != bcf_int32_missing) and (gt != bcf_int32_vector_end)) {
+                        allele_counts[bcf_gt_allele(gt)]++;
+                    }
+                }
+            }
+            return allele_counts_pass_filters(allele_counts);
+        } else {
+            // Decoding the genotypes also fills the allele counts
+            return allele_counts_pass_filters(accessor.get_allele_counts());
+        }
+    }
+
 private:
     inline int32_t fill_selected_genotypes(std::vector<int32_t>& ac_s) {
         const size_t CURRENT_LINE_PLOIDY = (header.version < 4) ? header.ploidy :
@@ -260,7 +553,10 @@ private:
 
         // Write the record to the variant file
         int ret = 0;
+        StageTimer write_timer(Stats::STAGE_BCF_WRITE);
         ret = bcf_write1(fp, hdr, rec);
+        write_timer.stop();
+        Stats::count(Stats::COUNTER_RECORDS_WRITTEN);
         if (ret) {
             std::cerr << "Failed to write record" << std::endl;
             throw "Failed to write record";
@@ -274,6 +570,7 @@ private:
 
     inline void update_and_write_bcf_record(bcf_file_reader_info_t& bcf_fri, bcf_hdr_t *hdr, htsFile *fp, bcf1_t *rec, std::vector<int32_t>& ac_s) {
         int ret = 0;
+        StageTimer update_timer(Stats::STAGE_BCF_UPDATE);
 
         // Remove the "BM" format
         /// @todo remove all possible junk (there should be none but there could be)
@@ -311,8 +608,18 @@ private:
             std::cerr << "Failed to update genotypes" << std::endl;
             throw "Failed to update genotypes";
         }
+        update_timer.stop();
 
+        if (record_sink) {
+            // The record is written later (e.g., in order by the parallel region extraction)
+            record_sink->push_back(bcf_dup(rec));
+            return;
+        }
+
+        StageTimer write_timer(Stats::STAGE_BCF_WRITE);
         ret = bcf_write1(fp, hdr, rec); // More than 60% of decompress time is spent in this call
+        write_timer.stop();
+        Stats::count(Stats::COUNTER_RECORDS_WRITTEN);
         if (ret) {
             std::cerr << "Failed to write record" << std::endl;
             throw "Failed to write record";
@@ -362,10 +669,15 @@ public:
         }
 
         select_samples = true;
+        // With sample tiles only the tiles of the selected samples are decoded
+        accessor.set_sample_subset(samples_to_use);
     }
 
     // Throws
     void decompress_checks() {
+        filter_maf = (global_app_options.min_maf > 0.0) or (global_app_options.max_maf < 1.0);
+        filter_allele_counts = filter_maf or (global_app_options.min_ac > 0) or (global_app_options.max_ac != (size_t)-1);
+
         if (header.aet_bytes != 2 && header.aet_bytes != 4) {
             /// @todo
             throw "Unsupported AET size";
@@ -420,6 +732,29 @@ public:
             enable_select_samples(samples.str());
         }
 
+        if (global_app_options.ids != "" or global_app_options.ids_file != "") {
+            if ((global_app_options.regions != "") or (global_app_options.regions_file != "") or (global_app_options.targets != "")) {
+                throw "Variant IDs cannot be combined with regions or targets";
+            }
+            requested_ids.clear();
+            std::stringstream ss(global_app_options.ids);
+            std::string id;
+            while (std::getline(ss, id, ',')) {
+                if (id.size()) requested_ids.insert(id);
+            }
+            if (global_app_options.ids_file != "") {
+                std::fstream fs(global_app_options.ids_file);
+                if (!fs.is_open()) {
+                    std::cerr << "Could not open file " << global_app_options.ids_file << std::endl;
+                    throw "IDs file error";
+                }
+                for (std::string line; std::getline(fs, line); ) {
+                    std::getline(std::stringstream(line), id, '\t');
+                    if (id.size()) requested_ids.insert(id);
+                }
+            }
+        }
+
         if (samples_to_use.size() == 0) {
             std::cerr << "No samples to extract" << std::endl;
             std::cerr << "Available samples are : ";
@@ -497,10 +832,10 @@ public:
             /// @todo integrate v4 instead of v3 !!
             if (N_HAPS <= std::numeric_limits<uint16_t>::max()) {
                 xsi_factory = make_unique<XsiFactoryExt<uint16_t, uint16_t> >(ofname, BLOCK_SIZE, MINOR_ALLELE_COUNT_THRESHOLD, default_phased,
-                    samples, global_app_options.zstd | header.zstd, global_app_options.zstd_compression_level);
+                    samples, global_app_options.zstd | header.zstd, global_app_options.zstd_compression_level, get_bm_offset_bits(header));
             } else {
                 xsi_factory = make_unique<XsiFactoryExt<uint32_t, uint16_t> >(ofname, BLOCK_SIZE, MINOR_ALLELE_COUNT_THRESHOLD, default_phased,
-                    samples, global_app_options.zstd | header.zstd, global_app_options.zstd_compression_level);
+                    samples, global_app_options.zstd | header.zstd, global_app_options.zstd_compression_level, get_bm_offset_bits(header));
             }
         } else {
             // Remove BM Format
@@ -555,6 +890,17 @@ protected:
     std::vector<size_t> samples_to_use;
     bool select_samples = false;
 
+    // Allele count / frequency filters
+    bool filter_allele_counts = false;
+    bool filter_maf = false;
+
+    // Batched region queries
+    std::unique_ptr<RegionBatch> region_batch = nullptr;
+    std::vector<bcf1_t*>* record_sink = nullptr;
+
+    // Variant IDs (rsID or CHROM:POS:REF:ALT) to extract
+    std::unordered_set<std::string> requested_ids;
+
     bool output_file_is_xsi = false;
     std::unique_ptr<XsiFactoryInterface> xsi_factory = nullptr;
 
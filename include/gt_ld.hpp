@@ -0,0 +1,398 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __GT_LD_HPP__
+#define __GT_LD_HPP__
+
+#include "accessor.hpp"
+#include "gt_visitor.hpp"
+#include "xcf.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Linkage disequilibrium between the ALT alleles of variant pairs
+ *
+ * LD is computed on haplotypes (phased genotypes), a haplotype carries an allele or
+ * not, missing entries count as not carrying. The number of haplotypes carrying both
+ * alleles is computed on the compressed binary lines of XSI files :
+ *
+ * - sparse vs sparse : merge of the sorted index lists
+ * - sparse vs WAH : lookup of the indices in the carrier bitset of the WAH line
+ *   (built once per line by scattering its runs through the arrangement)
+ * - WAH vs the WAH line that sorted its arrangement : the carriers of the sorting line
+ *   are the last haplotypes of the next arrangement, this is a popcount of the end of
+ *   the next line
+ * - other WAH pairs : AND and popcount of the carrier bitsets
+ * */
+
+/**
+ * @brief LD between two alleles
+ *
+ * r2 and D' are 0 if one of the alleles is monomorphic, D' has the sign of D
+ * */
+class LdStats {
+public:
+    size_t n_haps = 0;
+    size_t n11 = 0; // Haplotypes carrying both alleles
+    double d = 0;
+    double r2 = 0;
+    double d_prime = 0;
+};
+
+/**
+ * @brief Binary line of an allele kept for LD computations
+ *
+ * Rare lines keep the sorted list of their carrier haplotypes, the other lines a
+ * bitset of their carriers in haplotype order. Lines read from WAH also keep a copy
+ * of their words (PBWT order) and the identity of their arrangement. Everything is
+ * copied so that the lines stay valid when the accessor moves to other blocks.
+ * */
+class LdLine {
+public:
+    LdLine() {}
+
+    /**
+     * @brief Line from an internal binary access (see Accessor::get_internal_binary_access())
+     *
+     * Negated sparse lines cannot be used (their complement also holds the missing
+     * entries and the other ALT alleles), decode them instead (see LdLineReader)
+     * */
+    explicit LdLine(const InternalGtAccess& ia) : n_haps(ia.n_haps) {
+        if (ia.pointers.size() != 1 || (ia.sparse[0] && ia.default_allele)) {
+            std::cerr << "LD line requires a single binary line that is not a negated sparse line" << std::endl;
+            throw "LD line error";
+        }
+        sparse = ia.sparse[0];
+        if (!sparse) {
+            bits.resize((n_haps + 63) / 64, 0);
+            block_id = ia.block_id;
+            sort_count = ia.sort_count;
+            sorting = ia.sorting;
+            if (ia.wah_bytes == 2) {
+                copy_wah((const uint16_t*)ia.pointers[0]);
+            } else if (ia.wah_bytes == 4) {
+                copy_wah((const uint32_t*)ia.pointers[0]);
+            } else {
+                throw "WAH bytes not supported";
+            }
+        }
+        visit_binary_line(ia, *this);
+    }
+
+    /**
+     * @brief Line of an allele from a genotype array (as from bcf_get_genotypes())
+     * */
+    LdLine(const int32_t* gt_array, size_t ngt, size_t allele) : n_haps(ngt) {
+        for (size_t i = 0; i < ngt; ++i) {
+            if (!bcf_gt_is_missing(gt_array[i]) && gt_array[i] != bcf_int32_vector_end &&
+                (size_t)bcf_gt_allele(gt_array[i]) == allele) {
+                carriers.push_back(i);
+            }
+        }
+        count = carriers.size();
+        // Keep the smaller representation
+        sparse = count * 32 < n_haps;
+        if (!sparse) {
+            bits.resize((n_haps + 63) / 64, 0);
+            for (const auto c : carriers) {
+                set(c);
+            }
+            carriers.clear();
+            carriers.shrink_to_fit();
+        }
+    }
+
+    inline bool is_wah() const {return wah_bits != 0;}
+
+    /**
+     * @brief This line sorted the arrangement the other line was encoded with
+     *
+     * The PBWT sort is a stable partition, so the carriers of this line are the last
+     * count haplotypes of the other line's arrangement
+     * */
+    inline bool sorted_arrangement_of(const LdLine& other) const {
+        return is_wah() && other.is_wah() && sorting && n_haps == other.n_haps && wah_bits == other.wah_bits &&
+               block_id == other.block_id && sort_count + 1 == other.sort_count;
+    }
+
+    // Visitor callbacks (see gt_visitor.hpp)
+    template <typename A_T>
+    inline void on_run(size_t begin, size_t length, const A_T* a) {
+        for (size_t j = 0; j < length; ++j) {
+            set(a[begin+j]);
+        }
+        count += length;
+    }
+
+    template <typename A_T, typename WAH_T>
+    inline void on_literal(size_t begin, WAH_T word, size_t n_bits, const A_T* a) {
+        for (size_t j = 0; j < n_bits; ++j) {
+            if ((word >> j) & 1) {
+                set(a[begin+j]);
+                count++;
+            }
+        }
+    }
+
+    template <typename A_T>
+    inline void on_sparse(const A_T* indices, size_t n, bool negated) {
+        carriers.assign(indices, indices + n);
+        count = n;
+    }
+
+    size_t n_haps = 0;
+    size_t count = 0; // Carrier haplotypes
+    bool sparse = true;
+    std::vector<uint32_t> carriers; // Sparse lines, sorted haplotype indices
+    std::vector<uint64_t> bits; // Other lines, carrier bitset in haplotype order
+
+    // WAH lines only
+    std::vector<uint32_t> wah; // Words in PBWT order (widened)
+    size_t wah_bits = 0; // Payload bits per word, 0 if the line is not from WAH
+    size_t block_id = 0;
+    size_t sort_count = 0;
+    bool sorting = false;
+
+protected:
+    inline void set(size_t haplotype) {
+        bits[haplotype / 64] |= (uint64_t)1 << (haplotype % 64);
+    }
+
+    template <typename WAH_T>
+    inline void copy_wah(const WAH_T* wah_p) {
+        constexpr size_t WAH_BITS = sizeof(WAH_T)*8-1;
+        constexpr WAH_T WAH_HIGH_BIT = (WAH_T)1 << WAH_BITS;
+        constexpr WAH_T WAH_MAX_COUNTER = (WAH_HIGH_BIT>>1)-1;
+        wah_bits = WAH_BITS;
+        size_t counter = 0;
+        while (counter < n_haps) {
+            const WAH_T word = *wah_p++;
+            wah.push_back(word);
+            counter += (word & WAH_HIGH_BIT) ? (size_t)(word & WAH_MAX_COUNTER)*WAH_BITS : WAH_BITS;
+        }
+    }
+};
+
+/**
+ * @brief Carriers of a sparse line that are also carriers of the other line (merge or lookup)
+ * */
+inline size_t ld_sparse_intersection(const LdLine& x, const LdLine& y) {
+    size_t n11 = 0;
+    if (y.sparse) {
+        auto i = x.carriers.begin();
+        auto j = y.carriers.begin();
+        while (i != x.carriers.end() && j != y.carriers.end()) {
+            if (*i < *j) {
+                ++i;
+            } else if (*j < *i) {
+                ++j;
+            } else {
+                n11++; ++i; ++j;
+            }
+        }
+    } else {
+        const uint64_t* b = y.bits.data();
+        for (const auto c : x.carriers) {
+            n11 += (b[c / 64] >> (c % 64)) & 1;
+        }
+    }
+    return n11;
+}
+
+/**
+ * @brief Set bits of a WAH line from position begin (PBWT order) to the end
+ * */
+inline size_t ld_wah_count_from(const LdLine& x, const size_t begin) {
+    const uint32_t WAH_HIGH_BIT = (uint32_t)1 << x.wah_bits;
+    const uint32_t WAH_COUNT_1_BIT = WAH_HIGH_BIT >> 1;
+    const uint32_t WAH_MAX_COUNTER = (WAH_HIGH_BIT>>1)-1;
+    const uint32_t* p = x.wah.data();
+
+    size_t ones = 0;
+    size_t counter = 0;
+    while (counter < x.n_haps) {
+        const uint32_t word = *p++;
+        const size_t length = std::min((word & WAH_HIGH_BIT) ? (size_t)(word & WAH_MAX_COUNTER)*x.wah_bits : x.wah_bits, x.n_haps - counter);
+        const size_t end = counter + length;
+        if (end > begin) {
+            const size_t skip = (begin > counter) ? begin - counter : 0;
+            if (word & WAH_HIGH_BIT) {
+                ones += (word & WAH_COUNT_1_BIT) ? length - skip : 0;
+            } else {
+                ones += __builtin_popcount(word >> skip);
+            }
+        }
+        counter = end;
+    }
+    return ones;
+}
+
+/**
+ * @brief Haplotypes carrying the alleles of both lines
+ * */
+inline size_t ld_intersection(const LdLine& x, const LdLine& y) {
+    if (x.sparse) {
+        return ld_sparse_intersection(x, y);
+    } else if (y.sparse) {
+        return ld_sparse_intersection(y, x);
+    } else if (x.sorted_arrangement_of(y)) {
+        return ld_wah_count_from(y, y.n_haps - x.count);
+    } else if (y.sorted_arrangement_of(x)) {
+        return ld_wah_count_from(x, x.n_haps - y.count);
+    }
+
+    size_t n11 = 0;
+    for (size_t i = 0; i < x.bits.size(); ++i) {
+        n11 += __builtin_popcountll(x.bits[i] & y.bits[i]);
+    }
+    return n11;
+}
+
+/**
+ * @brief r2 and D' between the alleles of two lines
+ * */
+inline LdStats ld_stats(const LdLine& x, const LdLine& y) {
+    if (x.n_haps != y.n_haps) {
+        std::cerr << "LD between lines of " << x.n_haps << " and " << y.n_haps << " haplotypes" << std::endl;
+        throw "LD error";
+    }
+
+    LdStats stats;
+    stats.n_haps = x.n_haps;
+    if (!stats.n_haps) return stats;
+    stats.n11 = ld_intersection(x, y);
+
+    const double n = stats.n_haps;
+    const double p_a = x.count / n;
+    const double p_b = y.count / n;
+    stats.d = stats.n11 / n - p_a * p_b;
+    const double denominator = p_a * (1 - p_a) * p_b * (1 - p_b);
+    if (denominator > 0) {
+        stats.r2 = stats.d * stats.d / denominator;
+        const double d_max = (stats.d < 0) ?
+            std::min(p_a * p_b, (1 - p_a) * (1 - p_b)) :
+            std::min(p_a * (1 - p_b), (1 - p_a) * p_b);
+        stats.d_prime = (d_max > 0) ? stats.d / d_max : 0;
+    }
+    return stats;
+}
+
+/**
+ * @brief Reads the LD lines of an XSI file
+ *
+ * The genotypes are only decoded when the compressed line cannot be used directly
+ * (sparse lines of REF as minor allele, files with sample tiles)
+ * */
+class LdLineReader {
+public:
+    LdLineReader(Accessor& accessor) : accessor(accessor) {}
+    LdLineReader(const LdLineReader&) = delete;
+    LdLineReader& operator=(const LdLineReader&) = delete;
+
+    ~LdLineReader() {
+        if (gt_arr) { free(gt_arr); }
+    }
+
+    /**
+     * @param alt_allele the ALT allele, 1 is the first ALT
+     * */
+    LdLine read(const bcf_hdr_t *hdr, bcf1_t *line, size_t alt_allele) {
+        if (!accessor.has_sample_tiles()) {
+            InternalGtAccess ia = accessor.get_internal_binary_access(hdr, line, alt_allele);
+            if (!(ia.sparse[0] && ia.default_allele)) {
+                return LdLine(ia);
+            }
+        }
+
+        int ngt = accessor.get_genotypes(hdr, line, (void**)&gt_arr, &gt_arr_size);
+        return LdLine(gt_arr, ngt, alt_allele);
+    }
+
+protected:
+    Accessor& accessor;
+    int32_t *gt_arr = nullptr;
+    int gt_arr_size = 0;
+};
+
+/**
+ * @brief Sliding window of LD lines along the genome
+ *
+ * Each added line is paired with all the lines of the window before being added
+ * itself, the window holds the lines of the same contig within window_bp base pairs
+ * and at most max_lines lines (0 is no limit). Lines of a different number of
+ * haplotypes (e.g., haploid and diploid) are not paired.
+ * */
+class LdWindow {
+public:
+    class Entry {
+    public:
+        int32_t rid;
+        int64_t pos;
+        std::string label; // Given by the caller, e.g., for the output
+        LdLine line;
+    };
+
+    LdWindow(size_t window_bp, size_t max_lines = 0) : window_bp(window_bp), max_lines(max_lines) {}
+
+    /**
+     * @brief Pairs the line with the lines of the window then adds it
+     *
+     * @param report called as report(const Entry& first, const Entry& second, const LdStats& stats)
+     * */
+    template <class F>
+    void add(int32_t rid, int64_t pos, const std::string& label, LdLine&& line, F report) {
+        while (!window.empty() && (window.front().rid != rid || pos - window.front().pos > (int64_t)window_bp ||
+               (max_lines && window.size() >= max_lines))) {
+            window.pop_front();
+        }
+
+        Entry entry;
+        entry.rid = rid;
+        entry.pos = pos;
+        entry.label = label;
+        entry.line = std::move(line);
+        for (const auto& other : window) {
+            if (other.line.n_haps == entry.line.n_haps) {
+                report(other, entry, ld_stats(other.line, entry.line));
+            }
+        }
+        window.push_back(std::move(entry));
+    }
+
+    inline void clear() {window.clear();}
+    inline size_t size() const {return window.size();}
+
+protected:
+    const size_t window_bp;
+    const size_t max_lines;
+    std::deque<Entry> window;
+};
+
+#endif /* __GT_LD_HPP__ */
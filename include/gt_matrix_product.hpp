@@ -0,0 +1,409 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __GT_MATRIX_PRODUCT_HPP__
+#define __GT_MATRIX_PRODUCT_HPP__
+
+#include "accessor.hpp"
+#include "gt_visitor.hpp"
+#include "xcf.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+/**
+ * @brief Genotype by matrix product X^T Y, one ALT allele at a time
+ *
+ * Y is a samples x K matrix (row major, e.g., K phenotypes or covariates), the
+ * product of an ALT allele is the sum of the rows of the samples for each
+ * haplotype carrying the allele (0, 1 or 2 times a row for diploid samples).
+ * All K columns are computed in the same pass over the genotypes, on the
+ * compressed binary lines of XSI files (sparse lists for rare variants, WAH runs
+ * for common ones). Missing genotypes count as 0.
+ * */
+class GenotypeMatrixProduct {
+public:
+    /**
+     * @param Y samples x K matrix, row major
+     * @param n_samples number of samples (rows)
+     * @param K number of columns
+     * */
+    GenotypeMatrixProduct(const std::vector<double>& Y, size_t n_samples, size_t K) :
+        Y(Y), N_SAMPLES(n_samples), K(K), result(K, 0), column_sums(K, 0) {
+        if (Y.size() != n_samples * K) {
+            std::cerr << "Matrix has " << Y.size() << " entries, expected " << n_samples << " x " << K << std::endl;
+            throw "Matrix size error";
+        }
+        for (size_t s = 0; s < N_SAMPLES; ++s) {
+            add_row(column_sums.data(), s);
+        }
+    }
+
+    GenotypeMatrixProduct(const GenotypeMatrixProduct&) = delete;
+    GenotypeMatrixProduct& operator=(const GenotypeMatrixProduct&) = delete;
+
+    ~GenotypeMatrixProduct() {
+        if (gt_arr) { free(gt_arr); }
+    }
+
+    /**
+     * @brief Product of an ALT allele of a record of an XSI variant file
+     *
+     * The genotypes are only decoded when the compressed line cannot be used
+     * directly (sparse lines of REF as minor allele, files with sample tiles)
+     *
+     * @param alt_allele the ALT allele, 1 is the first ALT
+     * @return the K values of the product
+     * */
+    const std::vector<double>& product(Accessor& accessor, const bcf_hdr_t *hdr, bcf1_t *line, size_t alt_allele) {
+        if (!accessor.has_sample_tiles()) {
+            InternalGtAccess ia = accessor.get_internal_binary_access(hdr, line, alt_allele);
+            // Negated sparse lines hold the REF haplotypes, their complement also has the missing entries and other ALT alleles
+            if (!(ia.sparse[0] && ia.default_allele)) {
+                std::fill(result.begin(), result.end(), 0);
+                ploidy = ia.n_haps / N_SAMPLES;
+                visit_binary_line(ia, *this);
+                return result;
+            }
+        }
+
+        int ngt = accessor.get_genotypes(hdr, line, (void**)&gt_arr, &gt_arr_size);
+        return product(gt_arr, ngt, alt_allele);
+    }
+
+    /**
+     * @brief Product of an ALT allele from a genotype array (as from bcf_get_genotypes())
+     *
+     * @return the K values of the product
+     * */
+    const std::vector<double>& product(const int32_t *gt_array, size_t ngt, size_t alt_allele) {
+        std::fill(result.begin(), result.end(), 0);
+        ploidy = ngt / N_SAMPLES;
+        for (size_t i = 0; i < ngt; ++i) {
+            if (!bcf_gt_is_missing(gt_array[i]) && gt_array[i] != bcf_int32_vector_end &&
+                (size_t)bcf_gt_allele(gt_array[i]) == alt_allele) {
+                add_row(result.data(), i / ploidy);
+            }
+        }
+        return result;
+    }
+
+    inline size_t columns() const {return K;}
+
+    // Visitor callbacks (see gt_visitor.hpp)
+    template <typename A_T>
+    inline void on_run(size_t begin, size_t length, const A_T* a) {
+        double* r = result.data();
+        for (size_t j = 0; j < length; ++j) {
+            add_row(r, a[begin+j] / ploidy);
+        }
+    }
+
+    template <typename A_T, typename WAH_T>
+    inline void on_literal(size_t begin, WAH_T bits, size_t n_bits, const A_T* a) {
+        double* r = result.data();
+        for (size_t j = 0; j < n_bits; ++j) {
+            if ((bits >> j) & 1) {
+                add_row(r, a[begin+j] / ploidy);
+            }
+        }
+    }
+
+    template <typename A_T>
+    inline void on_sparse(const A_T* indices, size_t n, bool negated) {
+        double* r = result.data();
+        if (negated) {
+            // All haplotypes but the listed ones (only the REF allele is listed)
+            for (size_t k = 0; k < K; ++k) {
+                r[k] = column_sums[k] * ploidy;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                sub_row(r, indices[i] / ploidy);
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                add_row(r, indices[i] / ploidy);
+            }
+        }
+    }
+
+protected:
+    // Contiguous loops over the K columns so that they are vectorized
+    inline void add_row(double* __restrict__ r, const size_t sample) const {
+        const double* __restrict__ row = Y.data() + sample * K;
+        for (size_t k = 0; k < K; ++k) {
+            r[k] += row[k];
+        }
+    }
+
+    inline void sub_row(double* __restrict__ r, const size_t sample) const {
+        const double* __restrict__ row = Y.data() + sample * K;
+        for (size_t k = 0; k < K; ++k) {
+            r[k] -= row[k];
+        }
+    }
+
+    const std::vector<double>& Y;
+    const size_t N_SAMPLES;
+    const size_t K;
+    size_t ploidy = 2;
+    std::vector<double> result;
+    std::vector<double> column_sums;
+    int32_t *gt_arr = NULL;
+    int gt_arr_size = 0;
+};
+
+/**
+ * @brief Transposed product X V, accumulates per variant weights into sample space
+ *
+ * Each allele is added with its K weights (a row of V, e.g., K polygenic scores)
+ * to the entries of the samples (or haplotypes) carrying it. The entries are
+ * updated directly from the compressed binary lines of XSI files through the
+ * arrangement, the genotypes are not decoded. Missing and end of vector entries
+ * carry no allele, they get no weight, neither for ALT nor for REF alleles (no
+ * imputation).
+ * */
+class GenotypeTransposedProduct {
+public:
+    /**
+     * @param n_samples number of samples
+     * @param per_haplotype one entry per haplotype (2 per sample, haploid genotypes
+     *        are added to the first haplotype of the sample) instead of one per sample
+     * @param K number of weights per allele (columns of the result)
+     * */
+    GenotypeTransposedProduct(size_t n_samples, bool per_haplotype = false, size_t K = 1) :
+        N_SAMPLES(n_samples), PER_HAPLOTYPE(per_haplotype), K(K),
+        result((per_haplotype ? n_samples * 2 : n_samples) * K, 0),
+        negated_w(K), ref_w(K), diploid_offset(K, 0), haploid_offset(K, 0) {}
+
+    GenotypeTransposedProduct(const GenotypeTransposedProduct&) = delete;
+    GenotypeTransposedProduct& operator=(const GenotypeTransposedProduct&) = delete;
+
+    ~GenotypeTransposedProduct() {
+        if (gt_arr) { free(gt_arr); }
+    }
+
+    /**
+     * @brief Adds an allele of a record of an XSI variant file with the given weight (K = 1)
+     *
+     * @param allele the allele, 1 is the first ALT, 0 is REF
+     * */
+    void add(Accessor& accessor, const bcf_hdr_t *hdr, bcf1_t *line, size_t allele, double weight) {
+        add(accessor, accessor.position_from_bm_entry(hdr, line), line->n_allele, allele, &weight);
+    }
+
+    /**
+     * @brief Adds an allele of the record at a BM index of an XSI file with its K weights
+     *
+     * The genotypes are only decoded when the compressed line cannot be used
+     * directly (sparse lines of REF as minor allele, files with sample tiles, REF of
+     * multi-allelic lines, REF of lines with missing or end of vector entries). The
+     * REF dosage of bi-allelic lines is the ploidy minus the ALT dosage, it is added
+     * as a constant and the ALT line with the opposite weights.
+     *
+     * @param position BM index of the record
+     * @param n_alleles number of alleles of the record
+     * @param allele the allele, 1 is the first ALT, 0 is REF
+     * @param weights the K weights
+     * */
+    void add(Accessor& accessor, size_t position, size_t n_alleles, size_t allele, const double* weights) {
+        const bool ref = (allele == 0);
+        if (!accessor.has_sample_tiles() && !(ref && n_alleles != 2)) {
+            InternalGtAccess ia = accessor.get_internal_binary_access(position, ref ? 1 : allele, n_alleles);
+            // Negated sparse lines hold the REF haplotypes, their complement also has the missing entries and other ALT alleles
+            // The REF constant would also go to the missing and end of vector entries
+            if (!(ia.sparse[0] && ia.default_allele) && !(ref && !line_is_fully_called(accessor, position, n_alleles, ia.n_haps))) {
+                ploidy = ia.n_haps / N_SAMPLES;
+                set_weights(weights, ref);
+                visit_binary_line(ia, *this);
+                return;
+            }
+        }
+
+        const size_t ngt = accessor.get_header_ref().hap_samples;
+        if (!gt_arr) { gt_arr = (int32_t*)malloc(sizeof(int32_t)*ngt); }
+        const size_t filled = accessor.fill_genotype_array(gt_arr, ngt, n_alleles, position);
+        add(gt_arr, filled, allele, weights);
+    }
+
+    /**
+     * @brief Adds an allele from a genotype array (as from bcf_get_genotypes()) with its K weights
+     *
+     * @param allele the allele, 1 is the first ALT, 0 is REF
+     * */
+    void add(const int32_t *gt_array, size_t ngt, size_t allele, const double* weights) {
+        ploidy = ngt / N_SAMPLES;
+        w = weights;
+        for (size_t i = 0; i < ngt; ++i) {
+            if (!bcf_gt_is_missing(gt_array[i]) && gt_array[i] != bcf_int32_vector_end &&
+                (size_t)bcf_gt_allele(gt_array[i]) == allele) {
+                add_weights(entry(i));
+            }
+        }
+    }
+
+    void add(const int32_t *gt_array, size_t ngt, size_t allele, double weight) {
+        add(gt_array, ngt, allele, &weight);
+    }
+
+    // Sets all entries back to 0
+    void reset() {
+        std::fill(result.begin(), result.end(), 0);
+        std::fill(diploid_offset.begin(), diploid_offset.end(), 0);
+        std::fill(haploid_offset.begin(), haploid_offset.end(), 0);
+    }
+
+    /**
+     * @brief Result, one row of K values per sample (or haplotype)
+     * */
+    inline const std::vector<double>& get_result() {
+        apply_offsets();
+        return result;
+    }
+
+    inline size_t columns() const {return K;}
+
+    // Visitor callbacks (see gt_visitor.hpp)
+    template <typename A_T>
+    inline void on_run(size_t begin, size_t length, const A_T* a) {
+        for (size_t j = 0; j < length; ++j) {
+            add_weights(entry(a[begin+j]));
+        }
+    }
+
+    template <typename A_T, typename WAH_T>
+    inline void on_literal(size_t begin, WAH_T bits, size_t n_bits, const A_T* a) {
+        for (size_t j = 0; j < n_bits; ++j) {
+            if ((bits >> j) & 1) {
+                add_weights(entry(a[begin+j]));
+            }
+        }
+    }
+
+    template <typename A_T>
+    inline void on_sparse(const A_T* indices, size_t n, bool negated) {
+        if (negated) {
+            // All haplotypes but the listed ones (only the REF allele is listed)
+            add_constant(w);
+            for (size_t k = 0; k < K; ++k) {
+                negated_w[k] = -w[k];
+            }
+            const double* saved_w = w;
+            w = negated_w.data();
+            for (size_t i = 0; i < n; ++i) {
+                add_weights(entry(indices[i]));
+            }
+            w = saved_w;
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                add_weights(entry(indices[i]));
+            }
+        }
+    }
+
+protected:
+    // Tells if all the haplotypes of the line are called, from the zone map or the allele counts stored in the block
+    static bool line_is_fully_called(Accessor& accessor, size_t position, size_t n_alleles, size_t n_haps) {
+        if (accessor.block_is_fully_called(position)) {
+            return true;
+        }
+        if (!accessor.has_allele_counts(position)) {
+            return false;
+        }
+        // The REF count is the haplotypes minus the ALT, missing, and end of vector entries
+        accessor.fill_allele_counts(n_alleles, position);
+        const auto& counts = accessor.get_allele_counts();
+        return std::accumulate(counts.begin(), counts.begin() + n_alleles, (size_t)0) == n_haps;
+    }
+
+    // First result entry of a haplotype index of the current line
+    inline size_t entry(const size_t haplotype) const {
+        if (PER_HAPLOTYPE) {
+            return ((ploidy == 2) ? haplotype : haplotype * 2) * K;
+        }
+        return (haplotype / ploidy) * K;
+    }
+
+    // Contiguous loop over the K columns so that it is vectorized
+    inline void add_weights(const size_t e) {
+        double* __restrict__ r = result.data() + e;
+        const double* __restrict__ v = w;
+        for (size_t k = 0; k < K; ++k) {
+            r[k] += v[k];
+        }
+    }
+
+    // The REF weights are the ploidy times the weights minus the weights of the ALT carriers
+    inline void set_weights(const double* weights, const bool ref) {
+        if (ref) {
+            add_constant(weights);
+            for (size_t k = 0; k < K; ++k) {
+                ref_w[k] = -weights[k];
+            }
+            w = ref_w.data();
+        } else {
+            w = weights;
+        }
+    }
+
+    // Adds the weights to all the haplotypes of the current line, applied once in get_result()
+    inline void add_constant(const double* weights) {
+        std::vector<double>& offset = (ploidy == 2) ? diploid_offset : haploid_offset;
+        for (size_t k = 0; k < K; ++k) {
+            offset[k] += weights[k];
+        }
+    }
+
+    void apply_offsets() {
+        for (size_t s = 0; s < N_SAMPLES; ++s) {
+            for (size_t k = 0; k < K; ++k) {
+                if (PER_HAPLOTYPE) {
+                    result[(s*2)*K+k] += diploid_offset[k] + haploid_offset[k];
+                    result[(s*2+1)*K+k] += diploid_offset[k];
+                } else {
+                    result[s*K+k] += diploid_offset[k] * 2 + haploid_offset[k];
+                }
+            }
+        }
+        std::fill(diploid_offset.begin(), diploid_offset.end(), 0);
+        std::fill(haploid_offset.begin(), haploid_offset.end(), 0);
+    }
+
+    const size_t N_SAMPLES;
+    const bool PER_HAPLOTYPE;
+    const size_t K;
+    size_t ploidy = 2;
+    const double* w = NULL;
+    std::vector<double> result;
+    std::vector<double> negated_w;
+    std::vector<double> ref_w;
+    std::vector<double> diploid_offset;
+    std::vector<double> haploid_offset;
+    int32_t *gt_arr = NULL;
+};
+
+#endif /* __GT_MATRIX_PRODUCT_HPP__ */
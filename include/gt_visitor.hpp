@@ -0,0 +1,211 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __GT_VISITOR_HPP__
+#define __GT_VISITOR_HPP__
+
+#include "accessor_internals.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+/**
+ * Compressive computation on binary genotype lines
+ *
+ * The functions below walk the compressed representation of a binary genotype
+ * line (one ALT allele) and report the set haplotypes to a visitor, without
+ * decoding the line. A visitor is any class with the callbacks below, they are
+ * templates because the arrangement and sparse index types are only known at run
+ * time (uint16_t or uint32_t) :
+ *
+ *   template <typename A_T> void on_run(size_t begin, size_t length, const A_T* a);
+ *     The haplotypes a[begin] ... a[begin+length-1] are set (run of ones in PBWT order)
+ *
+ *   template <typename A_T, typename WAH_T> void on_literal(size_t begin, WAH_T bits, size_t n_bits, const A_T* a);
+ *     For j < n_bits, haplotype a[begin+j] is set if bit j of bits is set (bits is never 0)
+ *
+ *   template <typename A_T> void on_sparse(const A_T* indices, size_t n, bool negated);
+ *     The haplotypes indices[0] ... indices[n-1] are set. If negated the indices are the
+ *     REF haplotypes (REF is the minor allele) and all the other haplotypes are set, this
+ *     complement also holds the missing entries and the other ALT alleles if any
+ *
+ * Haplotype indices are indices in the genotype array of the line, i.e., sample
+ * indices for fully haploid lines. Missing and end of vector entries are not
+ * reported (they are stored separately), all other haplotypes are unset (REF or
+ * another ALT allele).
+ * */
+
+/**
+ * @brief Visits a WAH encoded binary line
+ *
+ * @param wah_p pointer to the first WAH word of the line
+ * @param a arrangement the line was encoded with
+ * @param n_haps number of haplotypes in the line
+ * @param v visitor
+ * @return pointer to the word after the line
+ * */
+template <typename A_T, typename WAH_T, class Visitor>
+inline const WAH_T* visit_wah_line(const WAH_T* wah_p, const A_T* a, const size_t n_haps, Visitor& v) {
+    constexpr size_t WAH_BITS = sizeof(WAH_T)*8-1;
+    constexpr WAH_T WAH_HIGH_BIT = (WAH_T)1 << WAH_BITS;
+    constexpr WAH_T WAH_COUNT_1_BIT = WAH_HIGH_BIT >> 1;
+    constexpr WAH_T WAH_MAX_COUNTER = (WAH_HIGH_BIT>>1)-1;
+
+    size_t counter = 0;
+    while (counter < n_haps) {
+        const WAH_T word = *wah_p++;
+        if (word & WAH_HIGH_BIT) {
+            // The last run may go past the end of the line
+            const size_t length = std::min((size_t)(word & WAH_MAX_COUNTER)*WAH_BITS, n_haps - counter);
+            if (word & WAH_COUNT_1_BIT) {
+                v.on_run(counter, length, a);
+            }
+            counter += length;
+        } else {
+            const size_t n_bits = std::min(WAH_BITS, n_haps - counter);
+            // Padding bits are not set by the encoder
+            if (word) {
+                v.on_literal(counter, word, n_bits, a);
+            }
+            counter += n_bits;
+        }
+    }
+
+    return wah_p;
+}
+
+/**
+ * @brief Visits a sparse encoded binary line
+ *
+ * @param s_p pointer to the sparse line (number of indices with the negated bit, then indices)
+ * @param v visitor
+ * @return pointer to the entry after the line
+ * */
+template <typename A_T, class Visitor>
+inline const A_T* visit_sparse_line(const A_T* s_p, Visitor& v) {
+    constexpr A_T MSB_BIT = (A_T)1 << (sizeof(A_T)*8-1);
+    const bool negated = *s_p & MSB_BIT;
+    const size_t num = *s_p & ~MSB_BIT;
+    s_p++;
+    v.on_sparse(s_p, num, negated);
+
+    return s_p + num;
+}
+
+/**
+ * @brief Visits the binary line of an internal access
+ *
+ * The access must hold a single binary line, i.e., come from get_internal_access()
+ * of a bi-allelic line or from get_internal_binary_access()
+ * */
+template <class Visitor>
+inline void visit_binary_line(const InternalGtAccess& ia, Visitor& v) {
+    if (ia.pointers.size() != 1) {
+        std::cerr << "Visited internal access has " << ia.pointers.size() << " binary lines, use get_internal_binary_access() for multi-allelic lines" << std::endl;
+        throw "Visitor error";
+    }
+
+    if (ia.sparse[0]) {
+        if (ia.sparse_bytes == 2) {
+            visit_sparse_line((const uint16_t*)ia.pointers[0], v);
+        } else if (ia.sparse_bytes == 4) {
+            visit_sparse_line((const uint32_t*)ia.pointers[0], v);
+        } else {
+            throw "Sparse bytes not supported";
+        }
+    } else {
+        if (ia.wah_bytes != 2 && ia.wah_bytes != 4) {
+            throw "WAH bytes not supported";
+        }
+        if (ia.a_bytes == 2) {
+            if (ia.wah_bytes == 2) {
+                visit_wah_line((const uint16_t*)ia.pointers[0], (const uint16_t*)ia.a, ia.n_haps, v);
+            } else {
+                visit_wah_line((const uint32_t*)ia.pointers[0], (const uint16_t*)ia.a, ia.n_haps, v);
+            }
+        } else if (ia.a_bytes == 4) {
+            if (ia.wah_bytes == 2) {
+                visit_wah_line((const uint16_t*)ia.pointers[0], (const uint32_t*)ia.a, ia.n_haps, v);
+            } else {
+                visit_wah_line((const uint32_t*)ia.pointers[0], (const uint32_t*)ia.a, ia.n_haps, v);
+            }
+        } else {
+            throw "Arrangement bytes not supported";
+        }
+    }
+}
+
+/**
+ * @brief Adapter that turns the runs, literals, and sparse lists into one call per set haplotype
+ *
+ * Handy for kernels that do not benefit from the runs, e.g.,
+ * HaplotypeVisitor<F> v(f, n_haps); with f(size_t haplotype)
+ * */
+template <class F>
+class HaplotypeVisitor {
+public:
+    HaplotypeVisitor(F& f, size_t n_haps) : f(f), n_haps(n_haps) {}
+
+    template <typename A_T>
+    inline void on_run(size_t begin, size_t length, const A_T* a) {
+        for (size_t j = 0; j < length; ++j) {
+            f(a[begin+j]);
+        }
+    }
+
+    template <typename A_T, typename WAH_T>
+    inline void on_literal(size_t begin, WAH_T bits, size_t n_bits, const A_T* a) {
+        for (size_t j = 0; j < n_bits; ++j) {
+            if ((bits >> j) & 1) {
+                f(a[begin+j]);
+            }
+        }
+    }
+
+    template <typename A_T>
+    inline void on_sparse(const A_T* indices, size_t n, bool negated) {
+        if (!negated) {
+            for (size_t i = 0; i < n; ++i) {
+                f(indices[i]);
+            }
+        } else {
+            // Indices are sorted
+            size_t i = 0;
+            for (size_t h = 0; h < n_haps; ++h) {
+                if (i < n && indices[i] == h) {
+                    i++;
+                } else {
+                    f(h);
+                }
+            }
+        }
+    }
+
+protected:
+    F& f;
+    const size_t n_haps;
+};
+
+#endif /* __GT_VISITOR_HPP__ */
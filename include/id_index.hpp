@@ -0,0 +1,150 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __ID_INDEX_HPP__
+#define __ID_INDEX_HPP__
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vcf.h"
+#include "compression.hpp"
+#include "fs.hpp"
+
+/**
+ * @brief Variant ID index of an XSI file, maps rsIDs and CHROM:POS:REF:ALT to BM indices
+ *
+ * The index is built at compression time (--id-index), it is a section of the
+ * XSI file with entries sorted by the hash of the keys. It is memory mapped,
+ * a lookup is a binary search, no scan of the variant BCF file is needed.
+ * Different keys with the same 64-bit hash are not distinguished by the index,
+ * results should be checked against the BCF line when exactness is required.
+ * */
+class VariantIdIndex {
+public:
+    VariantIdIndex(const std::string& filename) {
+        if (fill_header_from_file(filename, header)) {
+            std::cerr << "File " << filename << " is not an XSI file" << std::endl;
+            throw "Bad magic";
+        }
+        if (header.version < 5 or !header.id_index_offset_64) {
+            // No index, lookups return nothing
+            return;
+        }
+
+        file_size = fs::file_size(filename);
+        // The entries have to fit in the file (truncated or corrupt files)
+        if ((header.id_index_offset_64 > file_size) or
+            (header.id_index_entries > (file_size - header.id_index_offset_64) / sizeof(id_index_entry_t))) {
+            std::cerr << "File " << filename << " has a variant ID index outside of the file" << std::endl;
+            throw "Bad variant ID index";
+        }
+        fd = open(filename.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            std::cerr << "Failed to open file " << filename << std::endl;
+            throw "Failed to open file";
+        }
+        file_mmap_p = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (file_mmap_p == MAP_FAILED) {
+            std::cerr << "Failed to memory map file " << filename << std::endl;
+            close(fd);
+            throw "Failed to mmap file";
+        }
+        entries = (const id_index_entry_t*)((const char*)file_mmap_p + header.id_index_offset_64);
+        n_entries = header.id_index_entries;
+    }
+
+    ~VariantIdIndex() {
+        if (file_mmap_p) {
+            munmap(file_mmap_p, file_size);
+            close(fd);
+        }
+    }
+
+    VariantIdIndex(const VariantIdIndex&) = delete;
+    VariantIdIndex& operator=(const VariantIdIndex&) = delete;
+
+    bool empty() const {return n_entries == 0;}
+    size_t size() const {return n_entries;}
+
+    /**
+     * @brief Finds the BCF lines of a variant ID
+     *
+     * @param id rsID (as in the ID column) or CHROM:POS:REF:ALT (POS 1-based)
+     * @return the entries of the ID in file order (e.g., a rsID on multiple lines)
+     * */
+    std::vector<id_index_entry_t> lookup(const std::string& id) const {
+        const uint64_t hash = variant_id_hash(id);
+        auto range = std::equal_range(entries, entries + n_entries, hash, HashCompare());
+        return std::vector<id_index_entry_t>(range.first, range.second);
+    }
+
+    /**
+     * @brief Generates the keys of a BCF line, its IDs and CHROM:POS:REF:ALT for each ALT
+     * */
+    static std::vector<std::string> line_keys(const bcf_hdr_t* hdr, bcf1_t* line) {
+        std::vector<std::string> keys;
+        bcf_unpack(line, BCF_UN_STR);
+
+        // The ID column can hold multiple IDs separated by ';'
+        if (line->d.id and strcmp(line->d.id, ".")) {
+            std::stringstream ss(line->d.id);
+            std::string id;
+            while (std::getline(ss, id, ';')) {
+                if (!id.empty()) keys.push_back(id);
+            }
+        }
+
+        const std::string prefix = std::string(bcf_hdr_id2name(hdr, line->rid)) + ":" + std::to_string(line->pos+1) + ":" + line->d.allele[0] + ":";
+        for (int alt_allele = 1; alt_allele < line->n_allele; ++alt_allele) {
+            keys.push_back(prefix + line->d.allele[alt_allele]);
+        }
+
+        return keys;
+    }
+
+private:
+    // Compares the entries by hash (equal_range requires both argument orders)
+    struct HashCompare {
+        bool operator()(const id_index_entry_t& e, uint64_t hash) const {return e.hash < hash;}
+        bool operator()(uint64_t hash, const id_index_entry_t& e) const {return hash < e.hash;}
+    };
+
+    header_t header;
+    size_t file_size = 0;
+    int fd = -1;
+    void* file_mmap_p = nullptr;
+    const id_index_entry_t* entries = nullptr;
+    size_t n_entries = 0;
+};
+
+#endif /* __ID_INDEX_HPP__ */
@@ -30,6 +30,7 @@
 #include <sys/mman.h>
 
 #include "xcf.hpp"
+#include "stats.hpp"
 
 // This could be changed and is not necessarily useful, it helps recognizing and checking the metadata
 const uint32_t DICTIONARY_SIZE_SYMBOL = -1;
@@ -165,6 +166,8 @@ public:
         KEY_DICTIONNARY_SIZE = (T_KEY)-1,
         KEY_BCF_LINES = 0,
         KEY_GT_ENTRY = 256,
+        KEY_SITE_ENTRY = 257,
+        KEY_GT_TILE_ENTRY = 0x10000, // + tile number, for blocks with sample tiles
     };
 
     enum Dictionary_Vals : T_VAL {
@@ -221,6 +224,7 @@ public:
         }
 
         block_end_pos = s.tellp();
+        MemStats::add(MemStats::MEM_ENCODED_BLOCK, block_end_pos - block_start_pos);
 
         // Update the entries in dictionary on file
 #if 0
@@ -265,6 +269,7 @@ public:
             close(fd);
         }
         remove(ts.filename.c_str()); // Delete temp file
+        MemStats::sub(MemStats::MEM_ENCODED_BLOCK, block_end_pos - block_start_pos);
     }
 
     //size_t block_size;
@@ -296,8 +301,11 @@ class BlockWithZstdCompressor : public IBinaryBlock<T_KEY, T_VAL> {
             std::cerr << "Failed to allocate memory for output" << std::endl;
             throw "Failed to compress block";
         }
+        MemStats::add(MemStats::MEM_ZSTD_BUFFERS, output_buffer_size);
 
+        StageTimer zstd_timer(Stats::STAGE_ZSTD);
         auto result = ZSTD_compress(output_buffer, output_buffer_size, data, data_size, compression_level);
+        zstd_timer.stop();
         if (ZSTD_isError(result)) {
             std::cerr << "Failed to compress file" << std::endl;
             std::cerr << "Error : " << ZSTD_getErrorName(result) << std::endl;
@@ -323,6 +331,7 @@ class BlockWithZstdCompressor : public IBinaryBlock<T_KEY, T_VAL> {
         ofs.write(reinterpret_cast<const char*>(output_buffer), compressed_size);
 
         free(output_buffer);
+        MemStats::sub(MemStats::MEM_ZSTD_BUFFERS, output_buffer_size);
     }
 };
 
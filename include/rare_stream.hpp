@@ -0,0 +1,304 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __RARE_STREAM_HPP__
+#define __RARE_STREAM_HPP__
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vcf.h"
+#include "compression.hpp"
+#include "xcf.hpp"
+#include "block.hpp"
+#include "gt_block.hpp"
+#include "fs.hpp"
+
+// Set on the offset of a rare line when the line is haploid
+constexpr uint32_t RARE_STREAM_HAPLOID_BIT = (uint32_t)1 << 31;
+
+/**
+ * @brief Encodes the rare lines of a block into the rare variant stream
+ *
+ * The rare lines are the binary lines (BCF line, ALT allele) that the GT block encodes as non negated
+ * sparse lines, the GT block makes the choice and hands the positions over. For tiled blocks a line is
+ * rare only if it is a non negated sparse line in every tile. The section of a block is written right
+ * after the block and has its own index so that it can be read without the block.
+ *
+ * Section layout (uint32_t) : number of lines N, offsets[N] (binary line offset in the block, MSB set
+ * if the line is haploid), starts[N+1] (ranges in the carriers), carriers (positions in the GT array of
+ * the line, sample * ploidy of the line + allele index in the sample).
+ * */
+class RareStreamBlock {
+public:
+    RareStreamBlock() {
+        starts.push_back(0);
+    }
+
+    /**
+     * @brief Adds the rare ALT alleles of the BCF line the GT block(s) just encoded
+     *
+     * @param gt_blocks the GT block(s) of the block in sample order (tiles)
+     * @param offset binary line offset of the first ALT allele of the line in the block
+     * */
+    inline void encode_line(const std::vector<std::shared_ptr<IRareLineSource> >& gt_blocks, const size_t n_alleles, const uint32_t offset) {
+        for (size_t alt_allele = 1; alt_allele < n_alleles; ++alt_allele) {
+            const size_t line_start = carriers.size();
+            bool rare = !gt_blocks.empty();
+            for (const auto& gt_block : gt_blocks) {
+                if (!gt_block->last_line_sparse_carriers(alt_allele, carriers)) {
+                    rare = false;
+                    break;
+                }
+            }
+            if (!rare) {
+                carriers.resize(line_start);
+                continue;
+            }
+            const bool haploid = (gt_blocks.front()->last_line_ploidy() == 1);
+            offsets.push_back((offset + alt_allele - 1) | (haploid ? RARE_STREAM_HAPLOID_BIT : 0));
+            starts.push_back(carriers.size());
+        }
+    }
+
+    void write_to_stream(std::fstream& s) const {
+        const uint32_t n_lines = offsets.size();
+        s.write(reinterpret_cast<const char*>(&n_lines), sizeof(uint32_t));
+        write_vector(s, offsets);
+        write_vector(s, starts);
+        write_vector(s, carriers);
+    }
+
+    void clear() {
+        offsets.clear();
+        starts.assign(1, 0);
+        carriers.clear();
+    }
+
+    size_t size() const {return offsets.size();}
+
+protected:
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> carriers;
+};
+
+/**
+ * @brief Rare variant stream of an XSI file (compressed with --rare-stream)
+ *
+ * Gives the carriers of the rare lines without decompressing (or paging in)
+ * the GT blocks. Binary lines that are not in the stream are encoded by the
+ * GT blocks as WAH or negated sparse lines, they have more than
+ * rare_threshold() minor alleles (per tile for tiled files) or the ALT allele
+ * is the major allele.
+ * */
+class RareVariantStream {
+public:
+    /**
+     * @brief Rare lines of a block, points into the memory mapped file
+     * */
+    class BlockView {
+    public:
+        BlockView() {}
+        BlockView(const uint32_t* p) : n_lines(p[0]), offsets_p(p + 1), starts_p(p + 1 + p[0]), carriers_p(p + 1 + p[0] + p[0] + 1) {}
+
+        size_t size() const {return n_lines;}
+        // Binary line offset in the block of the i-th rare line
+        uint32_t offset(const size_t i) const {return offsets_p[i] & ~RARE_STREAM_HAPLOID_BIT;}
+        // Ploidy of the BCF line of the i-th rare line
+        size_t ploidy(const size_t i) const {return (offsets_p[i] & RARE_STREAM_HAPLOID_BIT) ? 1 : 2;}
+        size_t num_carriers(const size_t i) const {return starts_p[i+1] - starts_p[i];}
+        // Positions in the GT array of the line (sample * ploidy(i) + allele index in the sample) carrying the ALT allele
+        const uint32_t* carriers_begin(const size_t i) const {return carriers_p + starts_p[i];}
+        const uint32_t* carriers_end(const size_t i) const {return carriers_p + starts_p[i+1];}
+
+        // Index of the rare line at the given binary line offset, size() if the line is not rare
+        size_t find(const uint32_t offset) const {
+            auto it = std::lower_bound(offsets_p, offsets_p + n_lines, offset, [](const uint32_t entry, const uint32_t o) {
+                return (entry & ~RARE_STREAM_HAPLOID_BIT) < o;
+            });
+            return ((it != offsets_p + n_lines) and ((*it & ~RARE_STREAM_HAPLOID_BIT) == offset)) ? (size_t)(it - offsets_p) : n_lines;
+        }
+
+    protected:
+        size_t n_lines = 0;
+        const uint32_t* offsets_p = nullptr;
+        const uint32_t* starts_p = nullptr;
+        const uint32_t* carriers_p = nullptr;
+    };
+
+    RareVariantStream(const std::string& filename) {
+        if (fill_header_from_file(filename, header)) {
+            std::cerr << "File " << filename << " is not an XSI file" << std::endl;
+            throw "Bad magic";
+        }
+        if (header.version < 5 or !header.rare_index_offset_64) {
+            // No rare stream
+            return;
+        }
+
+        file_size = fs::file_size(filename);
+        if ((header.rare_index_offset_64 > file_size) or
+            (header.number_of_ssas > (file_size - header.rare_index_offset_64) / sizeof(uint64_t))) {
+            std::cerr << "The rare stream index of " << filename << " does not fit in the file" << std::endl;
+            throw "Bad rare stream";
+        }
+        fd = open(filename.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            std::cerr << "Failed to open file " << filename << std::endl;
+            throw "Failed to open file";
+        }
+        file_mmap_p = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (file_mmap_p == MAP_FAILED) {
+            std::cerr << "Failed to memory map file " << filename << std::endl;
+            file_mmap_p = nullptr;
+            close(fd);
+            throw "Failed to mmap file";
+        }
+        block_indices = (const uint64_t*)((const char*)file_mmap_p + header.rare_index_offset_64);
+        n_blocks = header.number_of_ssas;
+        bm_offset_bits = get_bm_offset_bits(header);
+
+        // The views do not check anything, so all the sections are checked once here
+        for (size_t block_id = 0; block_id < n_blocks; ++block_id) {
+            if (!block_section_is_valid(block_id)) {
+                std::cerr << "The rare stream section of block " << block_id << " of " << filename << " is corrupted" << std::endl;
+                munmap(file_mmap_p, file_size);
+                file_mmap_p = nullptr;
+                close(fd);
+                throw "Bad rare stream";
+            }
+        }
+    }
+
+    ~RareVariantStream() {
+        if (file_mmap_p) {
+            munmap(file_mmap_p, file_size);
+            close(fd);
+        }
+    }
+
+    RareVariantStream(const RareVariantStream&) = delete;
+    RareVariantStream& operator=(const RareVariantStream&) = delete;
+
+    bool empty() const {return n_blocks == 0;}
+    size_t number_of_blocks() const {return n_blocks;}
+    size_t rare_threshold() const {return header.rare_threshold;}
+    size_t num_samples() const {return header.num_samples;}
+
+    BlockView block(const size_t block_id) const {
+        if (block_id >= n_blocks) {
+            std::cerr << "Block " << block_id << " out of range, the rare stream has " << n_blocks << " blocks" << std::endl;
+            throw "Bad block";
+        }
+        return BlockView((const uint32_t*)((const char*)file_mmap_p + block_indices[block_id]));
+    }
+
+    /**
+     * @brief Gets the carriers of the binary line at a BM index
+     *
+     * @param haps gets the positions in the GT array of the line (sample * ploidy + allele index in the sample)
+     * @return false if the line is not rare (not in the stream)
+     * */
+    bool carriers(const uint32_t bm, std::vector<uint32_t>& haps) const {
+        const size_t OFFSET_MASK = ((size_t)1 << bm_offset_bits) - 1;
+        const auto view = block(bm >> bm_offset_bits);
+        const size_t i = view.find(bm & OFFSET_MASK);
+        if (i == view.size()) {
+            return false;
+        }
+        haps.assign(view.carriers_begin(i), view.carriers_end(i));
+        return true;
+    }
+
+    /**
+     * @brief Adds the number of rare ALT alleles carried by each sample in a block (burden)
+     *
+     * @param sample_counts is resized to the number of samples if needed
+     * */
+    void add_carrier_counts(const size_t block_id, std::vector<uint32_t>& sample_counts) const {
+        if (sample_counts.size() < header.num_samples) {
+            sample_counts.resize(header.num_samples, 0);
+        }
+        const auto view = block(block_id);
+        for (size_t i = 0; i < view.size(); ++i) {
+            const size_t ploidy = view.ploidy(i);
+            for (const uint32_t* it = view.carriers_begin(i); it != view.carriers_end(i); ++it) {
+                sample_counts[*it / ploidy]++;
+            }
+        }
+    }
+
+private:
+    // Checks that the section of the block and all its entries are inside the file
+    bool block_section_is_valid(const size_t block_id) const {
+        const uint64_t section_offset = block_indices[block_id];
+        if ((section_offset % sizeof(uint32_t)) or (section_offset > file_size - sizeof(uint32_t))) {
+            return false;
+        }
+        const uint32_t* p = (const uint32_t*)((const char*)file_mmap_p + section_offset);
+        const size_t words = (file_size - section_offset) / sizeof(uint32_t);
+        const size_t n_lines = p[0];
+        // N, offsets[N], starts[N+1]
+        if ((words < 2) or (n_lines > (words - 2) / 2)) {
+            return false;
+        }
+        const BlockView view(p);
+        const size_t carrier_words = words - 2 - 2 * n_lines;
+        const uint32_t* starts_p = p + 1 + n_lines;
+        if (starts_p[0] != 0) {
+            return false;
+        }
+        for (size_t i = 0; i < n_lines; ++i) {
+            if ((starts_p[i+1] < starts_p[i]) or (starts_p[i+1] > carrier_words)) {
+                return false;
+            }
+            const size_t max_position = header.num_samples * view.ploidy(i);
+            for (const uint32_t* it = view.carriers_begin(i); it != view.carriers_end(i); ++it) {
+                if (*it >= max_position) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    header_t header;
+    size_t file_size = 0;
+    int fd = -1;
+    void* file_mmap_p = nullptr;
+    const uint64_t* block_indices = nullptr;
+    size_t n_blocks = 0;
+    size_t bm_offset_bits = BM_OFFSET_BITS_DEFAULT;
+};
+
+#endif /* __RARE_STREAM_HPP__ */
@@ -0,0 +1,297 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __REGION_BATCH_HPP__
+#define __REGION_BATCH_HPP__
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hts.h"
+#include "accessor.hpp"
+
+/**
+ * @brief Batch of regions queried in a single forward pass over the file
+ *
+ * The regions are sorted and merged per contig (contig order of first
+ * appearance is kept, as bcftools does). The BCF lines are matched with a
+ * forward only cursor, so that testing a line is amortized constant time even
+ * with hundreds of thousands of regions. With the XSI position index the
+ * regions falling in the same or in consecutive blocks are coalesced into a
+ * single coarse region, the variant BCF file is then seeked once per run of
+ * blocks instead of once per region and every block is decoded at most once.
+ * */
+class RegionBatch {
+public:
+    // 1-based, inclusive, as in bcftools regions
+    struct Region {
+        int64_t beg;
+        int64_t end;
+    };
+
+    /**
+     * @brief Adds comma-separated chr|chr:pos|chr:beg-end|chr:beg- regions
+     * */
+    void add_regions(const std::string& regions) {
+        std::stringstream ss(regions);
+        std::string region;
+        while (std::getline(ss, region, ',')) {
+            if (region.empty()) continue;
+            std::string contig;
+            int64_t beg, end;
+            Accessor::parse_region(region, contig, beg, end);
+            add_region(contig, beg, end);
+        }
+    }
+
+    /**
+     * @brief Adds the regions of a tab-delimited (CHROM, POS[, END] 1-based) or BED (0-based, half-open) file
+     *
+     * The file can be bgzip compressed, see is_supported_regions_file()
+     * */
+    void add_regions_file(const std::string& filename) {
+        htsFile* fp = hts_open(filename.c_str(), "r");
+        if (!fp) {
+            std::cerr << "Failed to open regions file " << filename << std::endl;
+            throw "Failed to open file";
+        }
+        const bool bed = is_bed(filename);
+        kstring_t str = {0, 0, NULL};
+        while (hts_getline(fp, KS_SEP_LINE, &str) >= 0) {
+            if (!str.l or str.s[0] == '#') continue;
+            std::stringstream ss(std::string(str.s, str.l));
+            std::string contig, beg_s, end_s;
+            std::getline(ss, contig, '\t');
+            std::getline(ss, beg_s, '\t');
+            std::getline(ss, end_s, '\t');
+            if (bed and (contig == "track" or contig == "browser")) continue;
+            try {
+                int64_t beg = std::stoll(beg_s);
+                int64_t end = end_s.empty() ? beg : std::stoll(end_s);
+                if (bed) beg++; // 0-based, half-open to 1-based, inclusive
+                add_region(contig, beg, end);
+            } catch (...) {
+                std::cerr << "Could not parse region line " << std::string(str.s, str.l) << " in " << filename << std::endl;
+                free(str.s);
+                hts_close(fp);
+                throw "Bad region";
+            }
+        }
+        free(str.s);
+        hts_close(fp);
+    }
+
+    /**
+     * @brief Tells if the regions file can be batched, VCF/BCF regions files are left to htslib
+     * */
+    static bool is_supported_regions_file(const std::string& filename) {
+        for (const auto& ext : {".vcf", ".vcf.gz", ".bcf"}) {
+            if (ends_with(filename, ext)) return false;
+        }
+        return true;
+    }
+
+    void add_region(const std::string& contig, int64_t beg, int64_t end) {
+        auto it = contig_ids.find(contig);
+        if (it == contig_ids.end()) {
+            it = contig_ids.insert({contig, contig_names.size()}).first;
+            contig_names.push_back(contig);
+            contig_regions.push_back({});
+        }
+        if (end < beg) std::swap(beg, end);
+        contig_regions[it->second].push_back({beg, end});
+        cursor_contig = -1;
+    }
+
+    /**
+     * @brief Sorts and merges the overlapping and adjacent regions of each contig
+     * */
+    void sort_and_merge() {
+        for (auto& regions : contig_regions) {
+            std::sort(regions.begin(), regions.end(), [](const Region& a, const Region& b) {return a.beg < b.beg;});
+            std::vector<Region> merged;
+            for (const auto& r : regions) {
+                if (!merged.empty() and (r.beg <= merged.back().end or merged.back().end == std::numeric_limits<int64_t>::max() or r.beg == merged.back().end + 1)) {
+                    merged.back().end = std::max(merged.back().end, r.end);
+                } else {
+                    merged.push_back(r);
+                }
+            }
+            regions.swap(merged);
+        }
+        cursor_contig = -1;
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const auto& regions : contig_regions) n += regions.size();
+        return n;
+    }
+
+    /**
+     * @brief Tells if a line overlaps a region, lines must come sorted by position within a contig
+     *
+     * @param contig name of the contig of the line
+     * @param beg 1-based position of the line (POS)
+     * @param end 1-based, inclusive, end of the line (POS + REF length - 1)
+     * */
+    inline bool overlaps(const char* contig, int64_t beg, int64_t end) {
+        if (cursor_contig < 0 or strcmp(contig, contig_names[cursor_contig].c_str())) {
+            auto it = contig_ids.find(contig);
+            if (it == contig_ids.end()) {
+                cursor_contig = -1;
+                return false;
+            }
+            cursor_contig = it->second;
+            cursor = 0;
+        }
+        const auto& regions = contig_regions[cursor_contig];
+        // Regions that end before the line cannot overlap the following lines
+        while (cursor < regions.size() and regions[cursor].end < beg) {
+            cursor++;
+        }
+        // Regions are disjoint and sorted, only the first remaining one can overlap
+        return (cursor < regions.size()) and (regions[cursor].beg <= end);
+    }
+
+    /**
+     * @brief Generates the coarse regions to seek in the variant BCF file
+     *
+     * Uses the position index to drop the regions that hit no block and to
+     * coalesce the regions that hit the same or consecutive blocks. Without
+     * position index the (merged) regions are returned as is.
+     *
+     * @return the regions for bcf_sr_set_regions() in genomic order, empty if no region hits the file
+     * */
+    std::vector<std::string> coalesced_regions(const Accessor& accessor) const {
+        std::vector<std::string> result;
+        auto append = [&](const std::string& contig, const Region& r) {
+            std::stringstream ss;
+            ss << contig << ":" << r.beg << "-";
+            if (r.end != std::numeric_limits<int64_t>::max()) {
+                ss << r.end;
+            }
+            result.push_back(ss.str());
+        };
+
+        const auto& contigs = accessor.get_contigs();
+        const auto& position_index = accessor.get_position_index();
+        for (size_t c = 0; c < contig_names.size(); ++c) {
+            const auto& contig = contig_names[c];
+            const auto& regions = contig_regions[c];
+            if (!accessor.has_position_index()) {
+                for (const auto& r : regions) append(contig, r);
+                continue;
+            }
+
+            auto contig_it = std::find(contigs.begin(), contigs.end(), contig);
+            if (contig_it == contigs.end()) continue; // Contig not in file
+            const uint32_t contig_id = contig_it - contigs.begin();
+
+            // Entries of the contig are in file order, POS is sorted so min_pos is
+            // sorted, the running maximum of max_end allows to binary search the
+            // first entry that may overlap a region (entries are 0-based [min_pos, max_end))
+            std::vector<const position_index_entry_t*> entries;
+            std::vector<int64_t> running_max_end;
+            for (const auto& entry : position_index) {
+                if (entry.contig_id == contig_id) {
+                    entries.push_back(&entry);
+                    running_max_end.push_back(running_max_end.empty() ? entry.max_end : std::max(running_max_end.back(), (int64_t)entry.max_end));
+                }
+            }
+
+            bool have_run = false;
+            Region run = {0, 0};
+            uint32_t run_last_block = 0;
+            for (const auto& r : regions) {
+                const int64_t beg0 = r.beg - 1;
+                const size_t lo = std::upper_bound(running_max_end.begin(), running_max_end.end(), beg0) - running_max_end.begin();
+                const size_t hi = std::lower_bound(entries.begin(), entries.end(), r.end, [](const position_index_entry_t* e, int64_t end) {return e->min_pos < end;}) - entries.begin();
+                if (lo >= hi) continue; // No block holds lines of this region
+
+                const uint32_t first_block = entries[lo]->block_id;
+                const uint32_t last_block = entries[hi-1]->block_id;
+                if (have_run and first_block <= run_last_block + 1) {
+                    run.end = std::max(run.end, r.end);
+                    run_last_block = std::max(run_last_block, last_block);
+                } else {
+                    if (have_run) append(contig, run);
+                    run = r;
+                    run_last_block = last_block;
+                    have_run = true;
+                }
+            }
+            if (have_run) append(contig, run);
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief Joins regions (e.g., a slice of coalesced_regions()) for bcf_sr_set_regions()
+     * */
+    static std::string join(std::vector<std::string>::const_iterator begin, std::vector<std::string>::const_iterator end) {
+        std::string joined;
+        for (auto it = begin; it != end; ++it) {
+            if (it != begin) joined += ",";
+            joined += *it;
+        }
+        return joined;
+    }
+
+    /**
+     * @brief Restarts the line matching, e.g., before a new pass over a subset of the regions
+     * */
+    void reset_cursor() {
+        cursor_contig = -1;
+        cursor = 0;
+    }
+
+private:
+    static bool ends_with(const std::string& s, const std::string& suffix) {
+        if (s.length() < suffix.length()) return false;
+        std::string tail = s.substr(s.length() - suffix.length());
+        std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+        return tail == suffix;
+    }
+
+    static bool is_bed(const std::string& filename) {
+        return ends_with(filename, ".bed") or ends_with(filename, ".bed.gz");
+    }
+
+    std::map<std::string, size_t> contig_ids;
+    std::vector<std::string> contig_names;
+    std::vector<std::vector<Region> > contig_regions;
+
+    int cursor_contig = -1;
+    size_t cursor = 0;
+};
+
+#endif /* __REGION_BATCH_HPP__ */
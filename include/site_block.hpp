@@ -0,0 +1,379 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef __SITE_BLOCK_HPP__
+#define __SITE_BLOCK_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "interfaces.hpp"
+#include "block.hpp"
+
+class SiteBlockDict {
+public:
+    enum Dictionary_Keys : uint32_t {
+        // Element (Scalar) keys
+        KEY_DICTIONNARY_SIZE = (uint32_t)-1,
+        KEY_BCF_LINES = 0,
+        KEY_BINARY_LINES = 1,
+        KEY_NUMBER_OF_CONTIGS = 2,
+        KEY_NUMBER_OF_INFO_FIELDS = 3,
+        // Line (Vector) keys, indexed by BCF line
+        KEY_LINE_CONTIG = 0x10,
+        KEY_LINE_POS_DELTA = 0x11,
+        KEY_LINE_ID_OFFSETS = 0x12,
+        KEY_LINE_ALLELE_OFFSETS = 0x13,
+        // String keys
+        KEY_CONTIG_NAMES = 0x20,
+        KEY_INFO_NAMES = 0x21,
+        KEY_IDS = 0x22,
+        KEY_ALLELES = 0x23,
+        KEY_INFO_TYPES = 0x24, // Type of each INFO field column (8-bit), float if absent
+        // INFO field columns, indexed by binary line, key is base + field number
+        KEY_INFO_FIELD = 0x100,
+    };
+
+    enum Dictionary_Vals : uint32_t {
+        VAL_UNDEFINED = (uint32_t)-1,
+    };
+
+    enum Info_Types : uint8_t {
+        INFO_TYPE_FLOAT = 0,
+        INFO_TYPE_INT32 = 1,
+    };
+};
+
+/**
+ * @brief Columnar store of the site information of the BCF lines of a block
+ *
+ * Holds CHROM, POS (delta coded), ID, REF/ALT and selected numeric INFO fields
+ * so that consumers that only need these can skip the variant BCF file. Each
+ * column is stored contiguously, this is friendly to the zstd block layer.
+ * INFO values are stored for each ALT allele (i.e., binary line), as int32 for
+ * integer fields (exact counts, missing is bcf_int32_missing) and as float for
+ * the others (missing is NaN). Fields with a single value are repeated, fields
+ * with a value per allele (Number=R) skip the REF value.
+ * */
+class SiteBlock : public IWritableBCFLineEncoder, public BCFBlock, public SiteBlockDict {
+public:
+    SiteBlock(const size_t BLOCK_BCF_LINES, const std::vector<std::string>& info_fields) :
+        BCFBlock(BLOCK_BCF_LINES), info_fields(info_fields), info_types(info_fields.size(), INFO_TYPE_FLOAT),
+        info_columns(info_fields.size()), info_int_columns(info_fields.size()) {
+        id_offsets.push_back(0);
+        allele_offsets.push_back(0);
+    }
+
+    inline uint32_t get_id() const override { return IBinaryBlock<uint32_t, uint32_t>::KEY_SITE_ENTRY; }
+
+    inline void encode_line(const bcf_file_reader_info_t& bcf_fri) override {
+        bcf1_t* line = bcf_fri.line;
+        const bcf_hdr_t* hdr = bcf_fri.sr->readers[0].header;
+        bcf_unpack(line, BCF_UN_STR | BCF_UN_INFO);
+
+        // CHROM
+        const std::string contig(bcf_hdr_id2name(hdr, line->rid));
+        auto contig_it = std::find(contig_names.begin(), contig_names.end(), contig);
+        line_contig.push_back(contig_it - contig_names.begin());
+        if (contig_it == contig_names.end()) {
+            contig_names.push_back(contig);
+        }
+
+        // POS
+        line_pos_delta.push_back((int32_t)(line->pos - previous_pos));
+        previous_pos = line->pos;
+
+        // ID
+        ids.append(line->d.id);
+        id_offsets.push_back(ids.size());
+
+        // REF,ALT
+        for (int i = 0; i < line->n_allele; ++i) {
+            if (i) alleles.push_back(',');
+            alleles.append(line->d.allele[i]);
+        }
+        allele_offsets.push_back(alleles.size());
+
+        // INFO
+        const size_t n_alt = line->n_allele-1;
+        for (size_t f = 0; f < info_fields.size(); ++f) {
+            fill_info_values(hdr, line, f, n_alt);
+        }
+
+        effective_binary_lines_in_block += n_alt;
+        effective_bcf_lines_in_block++;
+    }
+
+    void write_to_stream(std::fstream& ofs) override {
+        size_t block_start_pos = ofs.tellp();
+        size_t dictionary_pos(0);
+
+        fill_dictionary();
+
+        dictionary_pos = write_dictionary(ofs, dictionary);
+
+        write_writables(ofs, block_start_pos); // Updates dictionary
+
+        update_dictionary(ofs, dictionary_pos, dictionary);
+    }
+
+    virtual ~SiteBlock() {
+        if (int_values) free(int_values);
+        if (float_values) free(float_values);
+    }
+
+protected:
+    inline void fill_info_values(const bcf_hdr_t* hdr, bcf1_t* line, const size_t f, const size_t n_alt) {
+        const int id = bcf_hdr_id2int(hdr, BCF_DT_ID, info_fields[f].c_str());
+        const bool exists = bcf_hdr_idinfo_exists(hdr, BCF_HL_INFO, id);
+        // Integer fields (e.g., AC, AN, DP) are kept exact, float only holds 24 bits
+        const bool is_int = exists and (bcf_hdr_id2type(hdr, BCF_HL_INFO, id) == BCF_HT_INT);
+        info_types[f] = is_int ? INFO_TYPE_INT32 : INFO_TYPE_FLOAT;
+        int n = 0;
+        if (exists) {
+            if (is_int) {
+                n = bcf_get_info_int32(hdr, line, info_fields[f].c_str(), &int_values, &n_int_values);
+            } else if (bcf_hdr_id2type(hdr, BCF_HL_INFO, id) == BCF_HT_REAL) {
+                n = bcf_get_info_float(hdr, line, info_fields[f].c_str(), &float_values, &n_float_values);
+            }
+        }
+        // Number=R fields start with the value of REF
+        const size_t first = (exists and (bcf_hdr_id2length(hdr, BCF_HL_INFO, id) == BCF_VL_R)) ? 1 : 0;
+        for (size_t i = 0; i < n_alt; ++i) {
+            // Fields with less values (e.g., Number=1) are repeated
+            const size_t idx = (n > 0) ? std::min(i + first, (size_t)n-1) : 0;
+            if (is_int) {
+                info_int_columns[f].push_back((n > 0) ? int_values[idx] : bcf_int32_missing);
+            } else {
+                float value = NAN;
+                if (n > 0 and !bcf_float_is_missing(float_values[idx])) value = float_values[idx];
+                info_columns[f].push_back(value);
+            }
+        }
+    }
+
+    inline void fill_dictionary() {
+        dictionary[KEY_BCF_LINES] = effective_bcf_lines_in_block;
+        dictionary[KEY_BINARY_LINES] = effective_binary_lines_in_block;
+        dictionary[KEY_NUMBER_OF_CONTIGS] = contig_names.size();
+        dictionary[KEY_NUMBER_OF_INFO_FIELDS] = info_fields.size();
+
+        // Those are offsets
+        dictionary[KEY_LINE_CONTIG] = VAL_UNDEFINED;
+        dictionary[KEY_LINE_POS_DELTA] = VAL_UNDEFINED;
+        dictionary[KEY_LINE_ID_OFFSETS] = VAL_UNDEFINED;
+        dictionary[KEY_LINE_ALLELE_OFFSETS] = VAL_UNDEFINED;
+        dictionary[KEY_CONTIG_NAMES] = VAL_UNDEFINED;
+        dictionary[KEY_IDS] = VAL_UNDEFINED;
+        dictionary[KEY_ALLELES] = VAL_UNDEFINED;
+        if (info_fields.size()) {
+            dictionary[KEY_INFO_NAMES] = VAL_UNDEFINED;
+            dictionary[KEY_INFO_TYPES] = VAL_UNDEFINED;
+        }
+        for (size_t f = 0; f < info_fields.size(); ++f) {
+            dictionary[KEY_INFO_FIELD + f] = VAL_UNDEFINED;
+        }
+    }
+
+    inline void write_writables(std::fstream& s, const size_t& block_start_pos) {
+        // 32-bit columns first, strings last, so that all columns are aligned
+        dictionary.at(KEY_LINE_POS_DELTA) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        write_vector(s, line_pos_delta);
+        dictionary.at(KEY_LINE_ID_OFFSETS) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        write_vector(s, id_offsets);
+        dictionary.at(KEY_LINE_ALLELE_OFFSETS) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        write_vector(s, allele_offsets);
+        for (size_t f = 0; f < info_fields.size(); ++f) {
+            dictionary.at(KEY_INFO_FIELD + f) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+            if (info_types[f] == INFO_TYPE_INT32) {
+                write_vector(s, info_int_columns[f]);
+            } else {
+                write_vector(s, info_columns[f]);
+            }
+        }
+        dictionary.at(KEY_LINE_CONTIG) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        write_vector(s, line_contig);
+        if (info_fields.size()) {
+            dictionary.at(KEY_INFO_TYPES) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+            write_vector(s, info_types);
+        }
+
+        dictionary.at(KEY_CONTIG_NAMES) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        for (const auto& name : contig_names) {
+            s.write(name.c_str(), name.length()+1 /*termination char*/);
+        }
+        if (info_fields.size()) {
+            dictionary.at(KEY_INFO_NAMES) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+            for (const auto& name : info_fields) {
+                s.write(name.c_str(), name.length()+1 /*termination char*/);
+            }
+        }
+        dictionary.at(KEY_IDS) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        s.write(ids.data(), ids.size());
+        dictionary.at(KEY_ALLELES) = (uint32_t)((size_t)s.tellp()-block_start_pos);
+        s.write(alleles.data(), alleles.size());
+    }
+
+    const std::vector<std::string> info_fields;
+    size_t effective_binary_lines_in_block = 0;
+    int64_t previous_pos = 0;
+
+    // Columns
+    std::vector<std::string> contig_names;
+    std::vector<uint16_t> line_contig;
+    std::vector<int32_t> line_pos_delta;
+    std::vector<uint32_t> id_offsets;
+    std::string ids;
+    std::vector<uint32_t> allele_offsets;
+    std::string alleles;
+    std::vector<uint8_t> info_types;
+    std::vector<std::vector<float> > info_columns;
+    std::vector<std::vector<int32_t> > info_int_columns;
+
+    // htslib buffers
+    int32_t* int_values = NULL;
+    int n_int_values = 0;
+    float* float_values = NULL;
+    int n_float_values = 0;
+
+    std::unordered_map<uint32_t, uint32_t> dictionary;
+};
+
+/**
+ * @brief Site information of the BCF lines of a block, decoded from a SiteBlock
+ *
+ * Positions are 0-based as in htslib, alleles are "REF,ALT1,ALT2,...".
+ * */
+class DecodedSites {
+public:
+    size_t size() const {return pos.size();}
+
+    const std::string& get_contig(size_t line) const {return contig_names[contig[line]];}
+    int64_t get_pos(size_t line) const {return pos[line];}
+    std::string get_id(size_t line) const {return ids.substr(id_offsets[line], id_offsets[line+1] - id_offsets[line]);}
+    std::string get_alleles(size_t line) const {return alleles.substr(allele_offsets[line], allele_offsets[line+1] - allele_offsets[line]);}
+
+    const std::vector<std::string>& get_info_names() const {return info_names;}
+    /**
+     * @brief INFO value of a field for a binary line (ALT allele) of the block
+     *
+     * Integer fields are converted (missing is NaN), use get_info_int() for exact values
+     * */
+    float get_info(size_t field, size_t binary_line) const {return info[field][binary_line];}
+    const std::vector<float>& get_info_column(size_t field) const {return info[field];}
+
+    bool info_is_int(size_t field) const {return info_types[field] == SiteBlockDict::INFO_TYPE_INT32;}
+    /**
+     * @brief Exact value of an integer INFO field (e.g., AC, AN, DP), bcf_int32_missing if missing
+     * */
+    int32_t get_info_int(size_t field, size_t binary_line) const {return info_int[field][binary_line];}
+    const std::vector<int32_t>& get_info_int_column(size_t field) const {return info_int[field];}
+
+    /**
+     * @brief Decodes the site block pointed to by p
+     * */
+    void decode(void* p) {
+        std::map<uint32_t, uint32_t> dictionary;
+        read_dictionary(dictionary, (uint32_t*)p);
+        const char* base = (const char*)p;
+
+        const size_t bcf_lines = dictionary.at(SiteBlockDict::KEY_BCF_LINES);
+        const size_t n_contigs = dictionary.at(SiteBlockDict::KEY_NUMBER_OF_CONTIGS);
+        const size_t n_info = dictionary.at(SiteBlockDict::KEY_NUMBER_OF_INFO_FIELDS);
+
+        const int32_t* delta_p = (const int32_t*)(base + dictionary.at(SiteBlockDict::KEY_LINE_POS_DELTA));
+        pos.resize(bcf_lines);
+        int64_t previous_pos = 0;
+        for (size_t i = 0; i < bcf_lines; ++i) {
+            previous_pos += delta_p[i];
+            pos[i] = previous_pos;
+        }
+
+        const uint16_t* contig_p = (const uint16_t*)(base + dictionary.at(SiteBlockDict::KEY_LINE_CONTIG));
+        contig.assign(contig_p, contig_p + bcf_lines);
+        contig_names.clear();
+        const char* names_p = base + dictionary.at(SiteBlockDict::KEY_CONTIG_NAMES);
+        for (size_t i = 0; i < n_contigs; ++i) {
+            contig_names.push_back(names_p);
+            names_p += contig_names.back().length()+1;
+        }
+
+        const uint32_t* id_offsets_p = (const uint32_t*)(base + dictionary.at(SiteBlockDict::KEY_LINE_ID_OFFSETS));
+        id_offsets.assign(id_offsets_p, id_offsets_p + bcf_lines + 1);
+        ids.assign(base + dictionary.at(SiteBlockDict::KEY_IDS), id_offsets.back());
+        const uint32_t* allele_offsets_p = (const uint32_t*)(base + dictionary.at(SiteBlockDict::KEY_LINE_ALLELE_OFFSETS));
+        allele_offsets.assign(allele_offsets_p, allele_offsets_p + bcf_lines + 1);
+        alleles.assign(base + dictionary.at(SiteBlockDict::KEY_ALLELES), allele_offsets.back());
+
+        const size_t binary_lines = dictionary.at(SiteBlockDict::KEY_BINARY_LINES);
+        info_names.clear();
+        info.assign(n_info, std::vector<float>());
+        info_int.assign(n_info, std::vector<int32_t>());
+        // Files without the types only have float columns
+        info_types.assign(n_info, SiteBlockDict::INFO_TYPE_FLOAT);
+        auto types_it = dictionary.find(SiteBlockDict::KEY_INFO_TYPES);
+        if (n_info and types_it != dictionary.end()) {
+            const uint8_t* types_p = (const uint8_t*)(base + types_it->second);
+            info_types.assign(types_p, types_p + n_info);
+        }
+        if (n_info) {
+            names_p = base + dictionary.at(SiteBlockDict::KEY_INFO_NAMES);
+            for (size_t f = 0; f < n_info; ++f) {
+                info_names.push_back(names_p);
+                names_p += info_names.back().length()+1;
+                const char* column_p = base + dictionary.at(SiteBlockDict::KEY_INFO_FIELD + f);
+                if (info_types[f] == SiteBlockDict::INFO_TYPE_INT32) {
+                    const int32_t* info_p = (const int32_t*)column_p;
+                    info_int[f].assign(info_p, info_p + binary_lines);
+                    info[f].resize(binary_lines);
+                    for (size_t i = 0; i < binary_lines; ++i) {
+                        info[f][i] = (info_p[i] == bcf_int32_missing) ? NAN : (float)info_p[i];
+                    }
+                } else {
+                    const float* info_p = (const float*)column_p;
+                    info[f].assign(info_p, info_p + binary_lines);
+                }
+            }
+        }
+    }
+
+protected:
+    std::vector<std::string> contig_names;
+    std::vector<uint16_t> contig;
+    std::vector<int64_t> pos;
+    std::vector<uint32_t> id_offsets;
+    std::string ids;
+    std::vector<uint32_t> allele_offsets;
+    std::string alleles;
+    std::vector<std::string> info_names;
+    std::vector<uint8_t> info_types;
+    std::vector<std::vector<float> > info;
+    std::vector<std::vector<int32_t> > info_int;
+};
+
+#endif /* __SITE_BLOCK_HPP__ */
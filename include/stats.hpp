@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include <sys/resource.h>
+
+/**
+ * @brief Memory use, printed with the stats when --mem-stats is given
+ *
+ * Heap allocations are counted by the counting allocator hook (the replaced
+ * global operator new and delete of the tool, C allocations of htslib and zstd
+ * are not counted). The main memory consumers also report their size as
+ * components, with the current and peak bytes of each.
+ * */
+class MemStats {
+public:
+    enum Component : size_t {
+        MEM_ENCODED_BLOCK = 0, // Encoded lines of the block being compressed
+        MEM_ARRANGEMENTS, // PBWT arrangements of the encoders and decoders
+        MEM_DECODE_BUFFERS, // Expanded WAH lines of the decoders
+        MEM_ZSTD_BUFFERS, // zstd compression output and decompressed blocks
+        MEM_GENOTYPES, // Genotype arrays of the decompressor
+        NUM_COMPONENTS
+    };
+
+#ifdef XSI_NO_STATS
+    static constexpr bool enabled() {return false;}
+#else
+    static inline bool enabled() {return State<>::on;}
+#endif
+
+    static void enable(bool on = true) {
+        State<>::on = on;
+    }
+
+    /// @brief Called by the allocator hook, bytes is the usable size of the allocation
+    static inline void on_alloc(const size_t bytes) {
+        if (enabled()) {
+            State<>::allocations++;
+            State<>::bytes_allocated += bytes;
+            update_peak(State<>::heap_peak, State<>::heap_current += (int64_t)bytes);
+        }
+    }
+
+    static inline void on_free(const size_t bytes) {
+        if (enabled()) {
+            State<>::frees++;
+            State<>::heap_current -= (int64_t)bytes;
+        }
+    }
+
+    static inline void add(const Component component, const size_t bytes) {
+        if (enabled()) {
+            update_peak(State<>::component_peak[component], State<>::component_current[component] += (uint64_t)bytes);
+        }
+    }
+
+    static inline void sub(const Component component, const size_t bytes) {
+        if (enabled()) {
+            State<>::component_current[component] -= bytes;
+        }
+    }
+
+    /**
+     * @brief Marks the start of a block (compressed or loaded), the allocations
+     *        between two marks are those of a block
+     * */
+    static inline void block_boundary() {
+        if (enabled()) {
+            const uint64_t allocations = State<>::allocations.load();
+            const uint64_t block_allocations = allocations - State<>::allocations_at_block.exchange(allocations);
+            // The allocations before the first block are not those of a block
+            if (State<>::blocks++) {
+                State<>::block_allocations += block_allocations;
+                update_peak(State<>::max_block_allocations, block_allocations);
+            }
+        }
+    }
+
+    /// @brief Peak resident set size of the process in bytes
+    static size_t peak_rss() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage)) {
+            return 0;
+        }
+        return (size_t)usage.ru_maxrss * 1024; // Kilobytes on Linux
+    }
+
+    static void print_json(std::ostream& os) {
+        static const char* component_names[NUM_COMPONENTS] = {
+            "encoded_block", "arrangements", "decode_buffers", "zstd_buffers", "genotypes"
+        };
+        const uint64_t blocks = State<>::blocks.load();
+        const uint64_t block_allocations = State<>::block_allocations.load();
+        os << "{\"peak_rss_bytes\":" << peak_rss()
+           << ",\"heap\":{\"allocations\":" << State<>::allocations.load()
+           << ",\"frees\":" << State<>::frees.load()
+           << ",\"bytes_allocated\":" << State<>::bytes_allocated.load()
+           << ",\"peak_bytes\":" << State<>::heap_peak.load() << "}"
+           << ",\"allocations_per_block\":{\"blocks\":" << blocks
+           << ",\"mean\":" << (blocks > 1 ? block_allocations / (blocks-1) : 0)
+           << ",\"max\":" << State<>::max_block_allocations.load() << "}"
+           << ",\"components\":{";
+        for (size_t i = 0; i < NUM_COMPONENTS; ++i) {
+            os << (i ? "," : "") << "\"" << component_names[i] << "\":{\"current\":" << State<>::component_current[i].load()
+               << ",\"peak\":" << State<>::component_peak[i].load() << "}";
+        }
+        os << "}}";
+    }
+
+private:
+    template<typename T>
+    static inline void update_peak(std::atomic<T>& peak, const T value) {
+        T current = peak.load();
+        while (value > current and !peak.compare_exchange_weak(current, value)) {}
+    }
+
+    template<typename T = void>
+    struct State {
+        static bool on;
+        static std::atomic<uint64_t> allocations;
+        static std::atomic<uint64_t> frees;
+        static std::atomic<uint64_t> bytes_allocated;
+        static std::atomic<int64_t> heap_current; // Frees of allocations made before enable() make it relative
+        static std::atomic<int64_t> heap_peak;
+        static std::atomic<uint64_t> blocks;
+        static std::atomic<uint64_t> allocations_at_block;
+        static std::atomic<uint64_t> block_allocations;
+        static std::atomic<uint64_t> max_block_allocations;
+        static std::atomic<uint64_t> component_current[NUM_COMPONENTS];
+        static std::atomic<uint64_t> component_peak[NUM_COMPONENTS];
+    };
+};
+
+template<typename T> bool MemStats::State<T>::on = false;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::allocations;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::frees;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::bytes_allocated;
+template<typename T> std::atomic<int64_t> MemStats::State<T>::heap_current;
+template<typename T> std::atomic<int64_t> MemStats::State<T>::heap_peak;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::blocks;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::allocations_at_block;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::block_allocations;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::max_block_allocations;
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::component_current[MemStats::NUM_COMPONENTS];
+template<typename T> std::atomic<uint64_t> MemStats::State<T>::component_peak[MemStats::NUM_COMPONENTS];
+
+/**
+ * @brief Per-stage timers and counters, printed as JSON with --stats
+ *
+ * Disabled by default, a disabled timer or counter only tests a flag.
+ * Defining XSI_NO_STATS at compile time removes the instrumentation entirely.
+ * Timers are inclusive, nested stages are also counted in their parent stage
+ * (e.g., WAH expand, PBWT update and sparse decode in genotype fill). Counters
+ * and timers are atomic so that they can be updated from multiple threads.
+ * */
+class Stats {
+public:
+    enum Stage : size_t {
+        // Decoding
+        STAGE_BLOCK_DECOMPRESS = 0,
+        STAGE_DICTIONARY_PARSE,
+        STAGE_WAH_EXPAND,
+        STAGE_PBWT_UPDATE,
+        STAGE_SPARSE_DECODE,
+        STAGE_GENOTYPE_FILL,
+        STAGE_BCF_UPDATE,
+        STAGE_BCF_WRITE,
+        // Encoding
+        STAGE_SCAN,
+        STAGE_SORT,
+        STAGE_ENCODE,
+        STAGE_ZSTD,
+        STAGE_WRITE,
+        NUM_STAGES
+    };
+
+    enum Counter : size_t {
+        COUNTER_BLOCKS_LOADED = 0,
+        COUNTER_BLOCKS_DECOMPRESSED,
+        COUNTER_BYTES_DECOMPRESSED,
+        COUNTER_WAH_LINES_EXPANDED,
+        COUNTER_SPARSE_LINES_DECODED,
+        COUNTER_RECORDS_WRITTEN,
+        COUNTER_RECORDS_ENCODED,
+        COUNTER_BLOCKS_WRITTEN,
+        COUNTER_BYTES_WRITTEN,
+        NUM_COUNTERS
+    };
+
+#ifdef XSI_NO_STATS
+    static constexpr bool enabled() {return false;}
+    static constexpr bool timers_enabled() {return false;}
+#else
+    static inline bool enabled() {return State<>::on;}
+    static inline bool timers_enabled() {return State<>::timers;}
+#endif
+
+    /**
+     * @brief Enables the counters, and the stage timers if timers is set
+     *
+     * Counters alone are cheap enough to be used while measuring latency.
+     * */
+    static void enable(bool on = true, bool timers = true) {
+        State<>::on = on;
+        State<>::timers = on and timers;
+        State<>::start = std::chrono::steady_clock::now();
+    }
+
+    static inline void add_time(const Stage stage, const uint64_t ns) {
+        State<>::stage_ns[stage] += ns;
+        State<>::stage_calls[stage]++;
+    }
+
+    static inline void count(const Counter counter, const uint64_t n = 1) {
+        if (enabled()) {
+            State<>::counters[counter] += n;
+        }
+    }
+
+    static inline uint64_t get(const Counter counter) {
+        return State<>::counters[counter].load();
+    }
+
+    static void print_json(std::ostream& os) {
+        static const char* stage_names[NUM_STAGES] = {
+            "block_decompress", "dictionary_parse", "wah_expand", "pbwt_update", "sparse_decode",
+            "genotype_fill", "bcf_update", "bcf_write",
+            "scan", "sort", "encode", "zstd", "write"
+        };
+        static const char* counter_names[NUM_COUNTERS] = {
+            "blocks_loaded", "blocks_decompressed", "bytes_decompressed", "wah_lines_expanded", "sparse_lines_decoded",
+            "records_written", "records_encoded", "blocks_written", "bytes_written"
+        };
+        const auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - State<>::start).count();
+
+        os << "{\"wall_ns\":" << wall << ",\"stages\":{";
+        for (size_t i = 0; i < NUM_STAGES; ++i) {
+            os << (i ? "," : "") << "\"" << stage_names[i] << "\":{\"calls\":" << State<>::stage_calls[i].load()
+               << ",\"ns\":" << State<>::stage_ns[i].load() << "}";
+        }
+        os << "},\"counters\":{";
+        for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+            os << (i ? "," : "") << "\"" << counter_names[i] << "\":" << State<>::counters[i].load();
+        }
+        os << "}";
+        if (MemStats::enabled()) {
+            os << ",\"memory\":";
+            MemStats::print_json(os);
+        }
+        os << "}" << std::endl;
+    }
+
+private:
+    // Template so that the static members can be defined in the header
+    template<typename T = void>
+    struct State {
+        static bool on;
+        static bool timers;
+        static std::chrono::steady_clock::time_point start;
+        static std::atomic<uint64_t> stage_ns[NUM_STAGES];
+        static std::atomic<uint64_t> stage_calls[NUM_STAGES];
+        static std::atomic<uint64_t> counters[NUM_COUNTERS];
+    };
+};
+
+template<typename T> bool Stats::State<T>::on = false;
+template<typename T> bool Stats::State<T>::timers = false;
+template<typename T> std::chrono::steady_clock::time_point Stats::State<T>::start;
+template<typename T> std::atomic<uint64_t> Stats::State<T>::stage_ns[Stats::NUM_STAGES];
+template<typename T> std::atomic<uint64_t> Stats::State<T>::stage_calls[Stats::NUM_STAGES];
+template<typename T> std::atomic<uint64_t> Stats::State<T>::counters[Stats::NUM_COUNTERS];
+
+/**
+ * @brief Times a stage from construction to destruction (or stop()) when stats are enabled
+ * */
+class StageTimer {
+public:
+    explicit StageTimer(const Stats::Stage stage) : stage(stage), running(Stats::timers_enabled()) {
+        if (running) {
+            begin = std::chrono::steady_clock::now();
+        }
+    }
+
+    inline void stop() {
+        if (running) {
+            running = false;
+            Stats::add_time(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+        }
+    }
+
+    ~StageTimer() {
+        stop();
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    const Stats::Stage stage;
+    bool running;
+    std::chrono::steady_clock::time_point begin;
+};
+
+#endif /* __STATS_HPP__ */
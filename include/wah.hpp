@@ -22,6 +22,9 @@
  * SOFTWARE.
  ******************************************************************************/
 
+#include <bitset>
+#include <iostream>
+#include <vector>
 #include "constexpr.hpp"
 
 #ifndef __WAH_HPP__
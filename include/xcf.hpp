@@ -36,6 +36,7 @@
 
 #include "vcf.h"
 #include "hts.h"
+#include "hfile.h"
 #include "synced_bcf_reader.h"
 
 bool has_extension(const std::string& filename, const std::string& extension);
@@ -61,6 +62,17 @@ typedef struct bcf_file_reader_info_t {
 
 } bcf_file_reader_info_t;
 
+/**
+ * @brief Checks if the file is a single-file XSI container (variant BCF embedded in the XSI file)
+ * */
+bool is_xsi_container(const std::string& filename);
+
+/**
+ * @brief Adds a reader as bcf_sr_add_reader() but also opens the variant BCF
+ *        embedded in single-file XSI containers
+ * */
+int xsi_bcf_sr_add_reader(bcf_srs_t* sr, const std::string& filename);
+
 void initialize_bcf_file_reader(bcf_file_reader_info_t& bcf_fri, const std::string& filename);
 
 void destroy_bcf_file_reader(bcf_file_reader_info_t& bcf_fri);
@@ -32,6 +32,10 @@
 #include "internal_gt_record.hpp"
 
 #include "gt_block.hpp"
+#include "site_block.hpp"
+#include "id_index.hpp"
+#include "rare_stream.hpp"
+#include "stats.hpp"
 
 namespace {
 
@@ -233,13 +237,7 @@ public:
         }
 
         // Alignment padding...
-        size_t mod_uint32 = size_t(s.tellp()) % sizeof(uint32_t);
-        if (mod_uint32) {
-            size_t padding = sizeof(uint32_t) - mod_uint32;
-            for (size_t i = 0; i < padding; ++i) {
-                s.write("", sizeof(char));
-            }
-        }
+        write_alignment_padding(s, sizeof(uint32_t));
 
         written_bytes = size_t(s.tellp()) - total_bytes;
         total_bytes += written_bytes;
@@ -418,18 +416,64 @@ protected:
 /// @todo check this derivation !
 class EncodingBinaryBlockWithGT : public EncodingBinaryBlock<uint32_t, uint32_t, BlockWithZstdCompressor> {
 public:
-    EncodingBinaryBlockWithGT(const size_t num_samples, const size_t block_bcf_lines, const size_t MAC_THRESHOLD, const int32_t default_phasing) :
+    EncodingBinaryBlockWithGT(const size_t num_samples, const size_t block_bcf_lines, const size_t MAC_THRESHOLD, const int32_t default_phasing,
+                              const bool sites = false, const std::vector<std::string>& site_info_fields = std::vector<std::string>(),
+                              const size_t sample_tile_size = 0 /* 0 is no tiles */) :
         EncodingBinaryBlock(block_bcf_lines) {
-        // Add the gt writable encoder
-        this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY] =
-            ((num_samples <= std::numeric_limits<uint16_t>::max()) ?
-            std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<GtBlock<uint16_t, uint16_t> >(num_samples, block_bcf_lines, MAC_THRESHOLD, default_phasing)) :
-            std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<GtBlock<uint32_t, uint16_t> >(num_samples, block_bcf_lines, MAC_THRESHOLD, default_phasing)));
-        this->writable_dictionary[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY] =
-            std::static_pointer_cast<IWritable>(this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY]);
+        if (sample_tile_size and sample_tile_size < num_samples) {
+            // Add one gt writable encoder per tile of samples, the MAC threshold is scaled to the tile
+            const size_t num_tiles = (num_samples + sample_tile_size - 1) / sample_tile_size;
+            for (size_t tile = 0; tile < num_tiles; ++tile) {
+                const size_t first_sample = tile * sample_tile_size;
+                const size_t tile_samples = std::min(sample_tile_size, num_samples - first_sample);
+                const size_t tile_mac_threshold = MAC_THRESHOLD * tile_samples / num_samples;
+                const uint32_t key = IBinaryBlock<uint32_t, uint32_t>::KEY_GT_TILE_ENTRY + tile;
+                this->writable_block_encoders[key] =
+                    ((num_samples <= std::numeric_limits<uint16_t>::max()) ?
+                    std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<GtTileBlock<uint16_t, uint16_t> >(tile, first_sample, tile_samples, block_bcf_lines, tile_mac_threshold, default_phasing)) :
+                    std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<GtTileBlock<uint32_t, uint16_t> >(tile, first_sample, tile_samples, block_bcf_lines, tile_mac_threshold, default_phasing)));
+                this->writable_dictionary[key] =
+                    std::static_pointer_cast<IWritable>(this->writable_block_encoders[key]);
+                gt_summaries.push_back(std::dynamic_pointer_cast<IZoneMapSummary>(this->writable_block_encoders[key]));
+                rare_line_sources.push_back(std::dynamic_pointer_cast<IRareLineSource>(this->writable_block_encoders[key]));
+            }
+        } else {
+            // Add the gt writable encoder
+            this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY] =
+                ((num_samples <= std::numeric_limits<uint16_t>::max()) ?
+                std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<GtBlock<uint16_t, uint16_t> >(num_samples, block_bcf_lines, MAC_THRESHOLD, default_phasing)) :
+                std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<GtBlock<uint32_t, uint16_t> >(num_samples, block_bcf_lines, MAC_THRESHOLD, default_phasing)));
+            this->writable_dictionary[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY] =
+                std::static_pointer_cast<IWritable>(this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY]);
+            gt_summaries.push_back(std::dynamic_pointer_cast<IZoneMapSummary>(this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY]));
+            rare_line_sources.push_back(std::dynamic_pointer_cast<IRareLineSource>(this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_GT_ENTRY]));
+        }
+        // Add the optional site store
+        if (sites) {
+            this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_SITE_ENTRY] =
+                std::static_pointer_cast<IWritableBCFLineEncoder>(std::make_shared<SiteBlock>(block_bcf_lines, site_info_fields));
+            this->writable_dictionary[IBinaryBlock<uint32_t, uint32_t>::KEY_SITE_ENTRY] =
+                std::static_pointer_cast<IWritable>(this->writable_block_encoders[IBinaryBlock<uint32_t, uint32_t>::KEY_SITE_ENTRY]);
+        }
+    }
+
+    // Adds the summary of the GT block(s) to the zone map of the block
+    void add_to_zone_map(zone_map_entry_t& zone) const {
+        for (const auto& summary : gt_summaries) {
+            summary->add_to_zone_map(zone);
+        }
+    }
+
+    // The GT block(s) in sample order, they give the sparse lines of the last encoded line to the rare stream
+    const std::vector<std::shared_ptr<IRareLineSource> >& get_rare_line_sources() const {
+        return rare_line_sources;
     }
 
     virtual ~EncodingBinaryBlockWithGT() {}
+
+protected:
+    std::vector<std::shared_ptr<IZoneMapSummary> > gt_summaries;
+    std::vector<std::shared_ptr<IRareLineSource> > rare_line_sources;
 };
 
 template <typename A_T = uint32_t, typename WAH_T = uint16_t>
@@ -438,15 +482,21 @@ class XsiFactoryExt : public XsiFactoryInterface {
 public:
     XsiFactoryExt(std::string filename, const size_t RESET_SORT_BLOCK_LENGTH, const size_t MINOR_ALLELE_COUNT_THRESHOLD,
                   int32_t default_phased, const std::vector<std::string>& sample_list,
-                  bool zstd_compression_on = false, int zstd_compression_level = 7) :
+                  bool zstd_compression_on = false, int zstd_compression_level = 7, const size_t BM_OFFSET_BITS = 0 /* 0 is default */,
+                  const bool SITES = false, const std::vector<std::string>& SITE_INFO_FIELDS = std::vector<std::string>(),
+                  const bool ID_INDEX = false, const size_t SAMPLE_TILE_SIZE = 0 /* 0 is no tiles */,
+                  const bool RARE_STREAM = false) :
         filename(filename), zstd_compression_on(zstd_compression_on), zstd_compression_level(zstd_compression_level),
         s(filename, s.binary | s.out | s.trunc),
         RESET_SORT_BLOCK_LENGTH(RESET_SORT_BLOCK_LENGTH), MINOR_ALLELE_COUNT_THRESHOLD(MINOR_ALLELE_COUNT_THRESHOLD),
+        SITES(SITES), SITE_INFO_FIELDS(SITE_INFO_FIELDS), ID_INDEX(ID_INDEX),
+        SAMPLE_TILE_SIZE((SAMPLE_TILE_SIZE < sample_list.size()) ? SAMPLE_TILE_SIZE : 0),
+        RARE_STREAM(RARE_STREAM),
         block_counter(0), default_phased(default_phased),
         entry_counter(0), variant_counter(0),
         sample_list(sample_list)
     {
-        current_block = make_unique<EncodingBinaryBlockWithGT>(sample_list.size(), RESET_SORT_BLOCK_LENGTH, MINOR_ALLELE_COUNT_THRESHOLD, default_phased);
+        current_block = make_unique<EncodingBinaryBlockWithGT>(sample_list.size(), RESET_SORT_BLOCK_LENGTH, MINOR_ALLELE_COUNT_THRESHOLD, default_phased, SITES, SITE_INFO_FIELDS, this->SAMPLE_TILE_SIZE);
 
         //std::cout << "XSI Factory Ext is used" << std::endl;
         //std::cerr << "XSI Factory created with :" << std::endl;
@@ -466,9 +516,9 @@ public:
         // Prepare the header //
         ////////////////////////
         header = {
-            .version = (uint32_t)4, // New testing version
+            .version = (uint32_t)5, // Version 5 has 64-bit offsets
             .ploidy = (uint8_t)-1, // Will be rewritten
-            .ind_bytes = sizeof(uint32_t), // Should never change
+            .ind_bytes = sizeof(uint64_t), // Block indices are 64-bit since version 5
             .aet_bytes = sizeof(A_T), // Depends on number of hap samples
             .wah_bytes = sizeof(WAH_T), // Should never change
             .hap_samples = (uint64_t)-1, // Will be rewritten
@@ -477,10 +527,10 @@ public:
             .number_of_blocks = (uint32_t)1, // This version is single block (this is the old meaning of block...)
             .ss_rate = (uint32_t)this->RESET_SORT_BLOCK_LENGTH,
             .number_of_ssas = (uint32_t)-1, /* Set later */
-            .indices_offset = (uint32_t)-1, /* Set later */
+            .indices_offset = (uint32_t)-1, /* Unused (64-bit offset is used) */
             .ssas_offset = (uint32_t)-1, /* Unused */
-            .wahs_offset = (uint32_t)-1, /* Set later */
-            .samples_offset = (uint32_t)-1, /* Set later */
+            .wahs_offset = (uint32_t)-1, /* Unused (64-bit offset is used) */
+            .samples_offset = (uint32_t)-1, /* Unused (64-bit offset is used) */
             .rearrangement_track_offset = (uint32_t)-1, /* Unused */
             .xcf_entries = (uint64_t)0, //this->entry_counter,
             .num_samples = (uint64_t)num_samples,
@@ -494,6 +544,9 @@ public:
         header.zstd = zstd_compression_on;
         header.rare_threshold = this->MINOR_ALLELE_COUNT_THRESHOLD;
         header.default_phased = this->default_phased;
+        header.bm_offset_bits = (uint8_t)(BM_OFFSET_BITS ? BM_OFFSET_BITS : default_bm_offset_bits(this->RESET_SORT_BLOCK_LENGTH));
+        header.has_sites = SITES;
+        header.sample_tile_size = (uint32_t)this->SAMPLE_TILE_SIZE;
 
         /////////////////////////////
         // Write Unfinished Header //
@@ -506,15 +559,21 @@ public:
         total_bytes += written_bytes;
         std::cout << "header " << written_bytes << " bytes, total " << total_bytes << " bytes written" << std::endl;
 
-        current_block = make_unique<EncodingBinaryBlockWithGT>(num_samples, RESET_SORT_BLOCK_LENGTH, MINOR_ALLELE_COUNT_THRESHOLD, default_phased);
+        current_block = make_unique<EncodingBinaryBlockWithGT>(num_samples, RESET_SORT_BLOCK_LENGTH, MINOR_ALLELE_COUNT_THRESHOLD, default_phased, SITES, SITE_INFO_FIELDS, SAMPLE_TILE_SIZE);
 
-        header.wahs_offset = total_bytes;
+        header.wahs_offset_64 = total_bytes;
     }
 
     void append(const bcf_file_reader_info_t& bcf_fri) override {
         check_flush_block();
 
+        StageTimer timer(Stats::STAGE_ENCODE);
+        Stats::count(Stats::COUNTER_RECORDS_ENCODED);
+        update_position_index(bcf_fri);
         current_block->encode_line(bcf_fri);
+        if (RARE_STREAM) {
+            rare_block.encode_line(current_block->get_rare_line_sources(), bcf_fri.line->n_allele, variant_counter - block_first_variant);
+        }
 
         variant_counter += bcf_fri.line->n_allele-1;
         entry_counter++;
@@ -525,17 +584,106 @@ public:
     }
 
 private:
+    inline void update_position_index(const bcf_file_reader_info_t& bcf_fri) {
+        const bcf1_t* line = bcf_fri.line;
+        const char* contig = bcf_hdr_id2name(bcf_fri.sr->readers[0].header, line->rid);
+        auto contig_it = contig_ids.find(contig);
+        uint32_t contig_id;
+        if (contig_it == contig_ids.end()) {
+            contig_id = contigs.size();
+            contig_ids[contig] = contig_id;
+            contigs.push_back(contig);
+        } else {
+            contig_id = contig_it->second;
+        }
+
+        const uint32_t offset = variant_counter - block_first_variant;
+        // New run on block or contig change
+        if (!position_entry.n_records or position_entry.block_id != block_counter or position_entry.contig_id != contig_id) {
+            flush_position_index_entry();
+            position_entry.block_id = block_counter;
+            position_entry.contig_id = contig_id;
+            position_entry.first_offset = offset;
+            position_entry.min_pos = line->pos;
+            position_entry.max_end = line->pos + line->rlen;
+            position_entry.first_record = entry_counter;
+        }
+        position_entry.min_pos = std::min(position_entry.min_pos, (int64_t)line->pos);
+        position_entry.max_end = std::max(position_entry.max_end, (int64_t)(line->pos + line->rlen));
+        position_entry.end_offset = offset + line->n_allele-1;
+        position_entry.n_records++;
+
+        update_zone_map(line, contig_id);
+
+        if (ID_INDEX) {
+            update_id_index(bcf_fri, contig_id, offset);
+        }
+    }
+
+    inline void update_zone_map(const bcf1_t* line, const uint32_t contig_id) {
+        if (!zone_entry.n_records) {
+            zone_entry.contig_id = contig_id;
+            zone_entry.min_pos = line->pos;
+            zone_entry.max_end = line->pos + line->rlen;
+        } else if (zone_entry.contig_id != contig_id) {
+            zone_entry.flags |= ZONE_MAP_MULTIPLE_CONTIGS;
+        }
+        zone_entry.min_pos = std::min(zone_entry.min_pos, (int64_t)line->pos);
+        zone_entry.max_end = std::max(zone_entry.max_end, (int64_t)(line->pos + line->rlen));
+        zone_entry.n_records++;
+        zone_entry.n_binary_lines += line->n_allele-1;
+    }
+
+    inline void update_id_index(const bcf_file_reader_info_t& bcf_fri, const uint32_t contig_id, const uint32_t offset) {
+        id_index_entry_t entry;
+        entry.bm = (uint32_t)((block_counter << header.bm_offset_bits) | offset);
+        entry.contig_id = contig_id;
+        entry.pos = bcf_fri.line->pos;
+        for (const auto& key : VariantIdIndex::line_keys(bcf_fri.sr->readers[0].header, bcf_fri.line)) {
+            entry.hash = variant_id_hash(key);
+            id_index.push_back(entry);
+        }
+    }
+
+    inline void flush_position_index_entry() {
+        if (position_entry.n_records) {
+            position_index.push_back(position_entry);
+            position_entry = position_index_entry_t();
+        }
+    }
+
     inline void check_flush_block() {
         // Start new block
         if ((entry_counter % RESET_SORT_BLOCK_LENGTH) == 0) {
+            block_first_variant = variant_counter;
             // if there was a previous block, write it
             if (entry_counter) {
-                block_counter++;
-                indices.push_back((uint32_t)s.tellp());
-                current_block->write_to_file(s, zstd_compression_on, zstd_compression_level);
+                write_current_block();
             }
             // Here replace the pointer instead of resetting the block, check performance...
-            current_block = make_unique<EncodingBinaryBlockWithGT>(num_samples, RESET_SORT_BLOCK_LENGTH, MINOR_ALLELE_COUNT_THRESHOLD, default_phased);
+            current_block = make_unique<EncodingBinaryBlockWithGT>(num_samples, RESET_SORT_BLOCK_LENGTH, MINOR_ALLELE_COUNT_THRESHOLD, default_phased, SITES, SITE_INFO_FIELDS, SAMPLE_TILE_SIZE);
+        }
+    }
+
+    inline void write_current_block() {
+        StageTimer timer(Stats::STAGE_WRITE);
+        MemStats::block_boundary();
+        block_counter++;
+        indices.push_back((uint64_t)s.tellp());
+        current_block->write_to_file(s, zstd_compression_on, zstd_compression_level);
+        Stats::count(Stats::COUNTER_BLOCKS_WRITTEN);
+        Stats::count(Stats::COUNTER_BYTES_WRITTEN, (uint64_t)s.tellp() - indices.back());
+
+        current_block->add_to_zone_map(zone_entry);
+        zone_map.push_back(zone_entry);
+        zone_entry = zone_map_entry_t();
+
+        if (RARE_STREAM) {
+            // The rare lines of the block are a separate section right after the block
+            write_alignment_padding(s, sizeof(uint32_t));
+            rare_indices.push_back((uint64_t)s.tellp());
+            rare_block.write_to_stream(s);
+            rare_block.clear();
         }
     }
 
@@ -551,19 +699,11 @@ public:
 
         // Write the last block if necessary
         if (current_block->get_effective_bcf_lines_in_block()) {
-            block_counter++;
-            indices.push_back((uint32_t)s.tellp());
-            current_block->write_to_file(s, zstd_compression_on, zstd_compression_level);
+            write_current_block();
         }
 
         // Alignment padding...
-        size_t mod_uint32 = size_t(s.tellp()) % sizeof(uint32_t);
-        if (mod_uint32) {
-            size_t padding = sizeof(uint32_t) - mod_uint32;
-            for (size_t i = 0; i < padding; ++i) {
-                s.write("", sizeof(char));
-            }
-        }
+        write_alignment_padding(s, sizeof(uint32_t));
 
         written_bytes = size_t(s.tellp()) - total_bytes;
         total_bytes += written_bytes;
@@ -572,7 +712,7 @@ public:
         ///////////////////////
         // Write the indices //
         ///////////////////////
-        header.indices_offset = total_bytes;
+        header.indices_offset_64 = total_bytes;
         s.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(decltype(indices.back())));
 
         written_bytes = size_t(s.tellp()) - total_bytes;
@@ -585,7 +725,7 @@ public:
         ////////////////////////////
         // Write the sample names //
         ////////////////////////////
-        header.samples_offset = total_bytes;
+        header.samples_offset_64 = total_bytes;
         for(const auto& sample : this->sample_list) {
             s.write(reinterpret_cast<const char*>(sample.c_str()), sample.length()+1 /*termination char*/);
         }
@@ -596,6 +736,68 @@ public:
 
         header.sparse_offset = (uint32_t)-1; // Not used
 
+        //////////////////////////////
+        // Write the position index //
+        //////////////////////////////
+        flush_position_index_entry();
+        // Alignment padding...
+        write_alignment_padding(s, sizeof(uint64_t));
+        total_bytes = s.tellp();
+        header.position_index_offset_64 = total_bytes;
+        header.position_index_entries = position_index.size();
+        header.number_of_contigs = contigs.size();
+        s.write(reinterpret_cast<const char*>(position_index.data()), position_index.size() * sizeof(position_index_entry_t));
+        for (const auto& contig : contigs) {
+            s.write(reinterpret_cast<const char*>(contig.c_str()), contig.length()+1 /*termination char*/);
+        }
+
+        written_bytes = size_t(s.tellp()) - total_bytes;
+        total_bytes += written_bytes;
+        std::cout << "position index " << written_bytes << " bytes, " << total_bytes << " total bytes written" << std::endl;
+
+        ////////////////////////////////
+        // Write the variant ID index //
+        ////////////////////////////////
+        if (ID_INDEX) {
+            // Sorted by hash for binary search, lines of the same key stay in file order
+            std::stable_sort(id_index.begin(), id_index.end(), [](const id_index_entry_t& a, const id_index_entry_t& b) {return a.hash < b.hash;});
+            write_alignment_padding(s, sizeof(uint64_t));
+            total_bytes = s.tellp();
+            header.id_index_offset_64 = total_bytes;
+            header.id_index_entries = id_index.size();
+            s.write(reinterpret_cast<const char*>(id_index.data()), id_index.size() * sizeof(id_index_entry_t));
+
+            written_bytes = size_t(s.tellp()) - total_bytes;
+            total_bytes += written_bytes;
+            std::cout << "variant ID index " << written_bytes << " bytes, " << total_bytes << " total bytes written" << std::endl;
+        }
+
+        //////////////////////////////
+        // Write the block zone map //
+        //////////////////////////////
+        write_alignment_padding(s, sizeof(uint64_t));
+        total_bytes = s.tellp();
+        header.zone_map_offset_64 = total_bytes;
+        s.write(reinterpret_cast<const char*>(zone_map.data()), zone_map.size() * sizeof(zone_map_entry_t));
+
+        written_bytes = size_t(s.tellp()) - total_bytes;
+        total_bytes += written_bytes;
+        std::cout << "block zone map " << written_bytes << " bytes, " << total_bytes << " total bytes written" << std::endl;
+
+        /////////////////////////////////////////
+        // Write the rare variant stream index //
+        /////////////////////////////////////////
+        if (RARE_STREAM) {
+            write_alignment_padding(s, sizeof(uint64_t));
+            total_bytes = s.tellp();
+            header.rare_index_offset_64 = total_bytes;
+            s.write(reinterpret_cast<const char*>(rare_indices.data()), rare_indices.size() * sizeof(uint64_t));
+
+            written_bytes = size_t(s.tellp()) - total_bytes;
+            total_bytes += written_bytes;
+            std::cout << "rare variant stream index " << written_bytes << " bytes, " << total_bytes << " total bytes written" << std::endl;
+        }
+
         header.default_phased = this->default_phased;
 
         s.flush();
@@ -619,11 +821,34 @@ protected:
 
     const size_t RESET_SORT_BLOCK_LENGTH;
     const size_t MINOR_ALLELE_COUNT_THRESHOLD;
+    const bool SITES;
+    const std::vector<std::string> SITE_INFO_FIELDS;
+    const bool ID_INDEX;
+    const size_t SAMPLE_TILE_SIZE;
+    const bool RARE_STREAM;
 
-    std::unique_ptr<EncodingBinaryBlock<uint32_t, uint32_t, BlockWithZstdCompressor> > current_block;
+    // Rare variant stream, one section per block
+    RareStreamBlock rare_block;
+    std::vector<uint64_t> rare_indices;
+
+    std::unique_ptr<EncodingBinaryBlockWithGT> current_block;
 
     size_t block_counter = 0;
-    std::vector<uint32_t> indices;
+    std::vector<uint64_t> indices;
+
+    // Position index
+    size_t block_first_variant = 0;
+    position_index_entry_t position_entry;
+    std::vector<position_index_entry_t> position_index;
+    std::vector<std::string> contigs;
+    std::unordered_map<std::string, uint32_t> contig_ids;
+
+    // Variant ID index
+    std::vector<id_index_entry_t> id_index;
+
+    // Block zone maps
+    zone_map_entry_t zone_entry;
+    std::vector<zone_map_entry_t> zone_map;
 
     int32_t default_phased;
 
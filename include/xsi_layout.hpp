@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef __XSI_LAYOUT_HPP__
+#define __XSI_LAYOUT_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/**
+ * XSI file layout constants and single-file container helpers (the variant BCF
+ * and its CSI index are sections of the XSI file). The helpers read and patch
+ * the raw XSI header at fixed positions, so that the htslib glue (xcf.cpp) does
+ * not depend on the packed structures of compression.hpp, the positions are
+ * checked against header_t there.
+ * */
+
+// BM is stored as a positive 32-bit integer in the variant BCF, block and offset share 31 bits
+const uint8_t  BM_TOTAL_BITS = 31;
+
+const size_t   XSI_HEADER_SIZE = 256;
+const uint32_t XSI_HEADER_MAGIC = 0xfeed1767;
+const size_t   XSI_HEADER_FIRST_MAGIC_POS = 4;
+const size_t   XSI_HEADER_VERSION_POS = 8;
+const size_t   XSI_HEADER_VARIANT_BCF_OFFSET_POS = 160;
+const size_t   XSI_HEADER_VARIANT_BCF_SIZE_POS = 168;
+const size_t   XSI_HEADER_VARIANT_CSI_OFFSET_POS = 176;
+const size_t   XSI_HEADER_VARIANT_CSI_SIZE_POS = 184;
+const size_t   XSI_HEADER_LAST_MAGIC_POS = 252;
+
+/**
+ * @brief Positions and sizes of the embedded variant BCF and CSI in the XSI file
+ * */
+struct embedded_variant_file_s {
+    uint64_t bcf_offset = 0;
+    uint64_t bcf_size = 0;
+    uint64_t csi_offset = 0;
+    uint64_t csi_size = 0;
+};
+
+typedef struct embedded_variant_file_s embedded_variant_file_t;
+
+template<typename T>
+inline T get_raw_header_field(const char* raw_header, const size_t pos) {
+    T value;
+    memcpy(&value, raw_header + pos, sizeof(T));
+    return value;
+}
+
+/**
+ * @brief Gets the embedded variant file sections from a raw XSI header (XSI_HEADER_SIZE bytes)
+ *
+ * @return false if the header is not the one of a single-file container
+ * */
+inline bool get_embedded_variant_file(const char* raw_header, embedded_variant_file_t& evf) {
+    if ((get_raw_header_field<uint32_t>(raw_header, XSI_HEADER_FIRST_MAGIC_POS) != XSI_HEADER_MAGIC) or
+        (get_raw_header_field<uint32_t>(raw_header, XSI_HEADER_LAST_MAGIC_POS) != XSI_HEADER_MAGIC) or
+        (get_raw_header_field<uint32_t>(raw_header, XSI_HEADER_VERSION_POS) < 5)) {
+        return false;
+    }
+    evf.bcf_offset = get_raw_header_field<uint64_t>(raw_header, XSI_HEADER_VARIANT_BCF_OFFSET_POS);
+    evf.bcf_size = get_raw_header_field<uint64_t>(raw_header, XSI_HEADER_VARIANT_BCF_SIZE_POS);
+    evf.csi_offset = get_raw_header_field<uint64_t>(raw_header, XSI_HEADER_VARIANT_CSI_OFFSET_POS);
+    evf.csi_size = get_raw_header_field<uint64_t>(raw_header, XSI_HEADER_VARIANT_CSI_SIZE_POS);
+    return evf.bcf_offset and evf.bcf_size;
+}
+
+/**
+ * @brief Reads the embedded variant file sections of an XSI file
+ *
+ * @return false if the file is not a single-file container
+ * */
+inline bool read_embedded_variant_file(const std::string& filename, embedded_variant_file_t& evf) {
+    std::ifstream s(filename, std::ios::binary);
+    char raw_header[XSI_HEADER_SIZE];
+    if (!s.is_open() or !s.read(raw_header, XSI_HEADER_SIZE)) {
+        return false;
+    }
+    return get_embedded_variant_file(raw_header, evf);
+}
+
+/**
+ * @brief Writes zero bytes until the stream position is a multiple of alignment
+ * */
+inline void write_alignment_padding(std::ostream& s, const size_t alignment) {
+    size_t mod = size_t(s.tellp()) % alignment;
+    if (mod) {
+        size_t padding = alignment - mod;
+        for (size_t i = 0; i < padding; ++i) {
+            s.write("", sizeof(char));
+        }
+    }
+}
+
+/**
+ * @brief Appends the variant BCF and its index to the XSI file (single-file container)
+ *
+ * @param filename the XSI file
+ * @param variant_filename the variant BCF file
+ * @param index_filename the CSI index of the variant BCF file
+ * */
+inline void embed_variant_file(const std::string& filename, const std::string& variant_filename, const std::string& index_filename) {
+    std::fstream s(filename, s.binary | s.in | s.out);
+    std::ifstream bcf(variant_filename, std::ios::binary);
+    std::ifstream csi(index_filename, std::ios::binary);
+    if (!s.is_open() or !bcf.is_open() or !csi.is_open()) {
+        std::cerr << "Failed to open " << filename << ", " << variant_filename << " or " << index_filename << std::endl;
+        throw "Cannot embed variant file";
+    }
+
+    char raw_header[XSI_HEADER_SIZE];
+    if (!s.read(raw_header, XSI_HEADER_SIZE) or
+        (get_raw_header_field<uint32_t>(raw_header, XSI_HEADER_FIRST_MAGIC_POS) != XSI_HEADER_MAGIC) or
+        (get_raw_header_field<uint32_t>(raw_header, XSI_HEADER_LAST_MAGIC_POS) != XSI_HEADER_MAGIC) or
+        (get_raw_header_field<uint32_t>(raw_header, XSI_HEADER_VERSION_POS) < 5)) {
+        std::cerr << "File " << filename << " is not a version 5 XSI file" << std::endl;
+        throw "Cannot embed variant file";
+    }
+    embedded_variant_file_t evf;
+
+    // Returns the offset, size is set
+    auto append = [&s](std::ifstream& in, uint64_t& size) -> uint64_t {
+        s.seekp(0, std::ios_base::end);
+        write_alignment_padding(s, sizeof(uint64_t));
+        const uint64_t offset = s.tellp();
+        s << in.rdbuf();
+        size = size_t(s.tellp()) - offset;
+        return offset;
+    };
+    evf.bcf_offset = append(bcf, evf.bcf_size);
+    evf.csi_offset = append(csi, evf.csi_size);
+
+    // Patch the header
+    auto patch = [&s](const size_t pos, const uint64_t value) {
+        s.seekp(pos, std::ios_base::beg);
+        s.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    patch(XSI_HEADER_VARIANT_BCF_OFFSET_POS, evf.bcf_offset);
+    patch(XSI_HEADER_VARIANT_BCF_SIZE_POS, evf.bcf_size);
+    patch(XSI_HEADER_VARIANT_CSI_OFFSET_POS, evf.csi_offset);
+    patch(XSI_HEADER_VARIANT_CSI_SIZE_POS, evf.csi_size);
+    if (!s.good()) {
+        std::cerr << "Failed to write the variant file into " << filename << std::endl;
+        throw "Cannot embed variant file";
+    }
+    s.close();
+}
+
+#endif /* __XSI_LAYOUT_HPP__ */
@@ -39,6 +39,8 @@ public:
         app.add_flag("-p,--fast-pipe", fast_pipe, "Outputs uncompressed BCF (-Ou) when writing to stdout");
         app.add_flag("-c,--compress", compress, "Compress");
         app.add_flag("-v,--verbose", verbose, "Verbose, prints progress");
+        app.add_flag("--stats", stats, "Prints per stage timings and counters as JSON on stderr");
+        app.add_flag("--mem-stats", mem_stats, "Prints peak RSS, heap allocations and the memory of the main components as JSON on stderr");
         app.add_flag("-d,--decompress", decompress, "Decompress");
         app.add_flag("-x,--extract", decompress, "Extract (Decompress)");
         //app.add_flag("--wait", wait, "DEBUG - wait for int input");
@@ -55,6 +57,13 @@ public:
         app.add_option("--maf", maf, "Minor Allele Frequency threshold");
         app.add_flag("-i,--info", info, "Get info on file");
         app.add_option("--variant-block-length", reset_sort_block_length, "Number of VCF lines to compress together (default 8192)");
+        app.add_flag("--single-file", single_file, "Embed the variant BCF and its index in the XSI file (single-file container)");
+        app.add_flag("--sites", sites, "Embed a columnar site store (CHROM, POS, ID, REF, ALT) in the blocks");
+        app.add_option("--site-info", site_info_fields, "Comma-separated list of numeric INFO fields added to the site store (e.g., AF,AC)")->delimiter(',');
+        app.add_flag("--id-index", id_index, "Embeds an index from variant IDs (rsID and CHROM:POS:REF:ALT) to BM, for extraction with --ids");
+        app.add_flag("--rare-stream", rare_stream, "Store the carriers of the rare variants in a separate section per block, rare variant queries then read only this section");
+        app.add_option("--sample-tile-size", sample_tile_size, "Split the GT blocks in tiles of this many samples (e.g., 4096, for 8192 diploid haplotypes), a sample subset only decodes the tiles it touches (default 0, no tiles)");
+        app.add_option("--bm-offset-bits", bm_offset_bits, "Number of bits of the BM index used for the offset inside a block, the others are for the block (default depends on block length, 15 for 8192)");
 
         //app.add_flag("--sandbox", sandbox, "DEBUG - ...");
         //app.add_flag("--inject-phase-switches", inject_phase_switches, "DEBUG injects phase switches");
@@ -87,9 +96,16 @@ public:
         app.add_option("-S,--samples-file", samples_file, "File of sample names to include or exclude if prefixed with \"^\". One sample per line.");
         app.add_option("-r,--regions", regions, "chr|chr:pos|chr:beg-end|chr:beg-[,...]"); //"Comma-separated list of regions, see also -R, --regions-file. Overlapping records are matched even when the starting coordinate is outside of the region, unlike the -t/-T options where only the POS coordinate is checked. Note that -r cannot be used in combination with -R.");
         app.add_option("-R,--regions-file", regions_file, "Region file (same as bcftools)"); //"Regions can be specified either on command line or in a VCF, BED, or tab-delimited file (the default). The columns of the tab-delimited file can contain either positions (two-column format) or intervals (three-column format): CHROM, POS, and, optionally, END, where positions are 1-based and inclusive. The columns of the tab-delimited BED file are also CHROM, POS and END (trailing columns are ignored), but coordinates are 0-based, half-open. To indicate that a file be treated as BED rather than the 1-based tab-delimited file, the file must have the ".bed" or ".bed.gz" suffix (case-insensitive). Uncompressed files are stored in memory, while bgzip-compressed and tabix-indexed region files are streamed. Note that sequence names must match exactly, "chr20" is not the same as "20". Also note that chromosome ordering in FILE will be respected, the VCF will be processed in the order in which chromosomes first appear in FILE. However, within chromosomes, the VCF will always be processed in ascending genomic coordinate order no matter what order they appear in FILE. Note that overlapping regions in FILE can result in duplicated out of order positions in the output. This option requires indexed VCF/BCF files. Note that -R cannot be used in combination with -r.");
+        app.add_option("--ids", ids, "Comma-separated list of variant IDs (rsID or CHROM:POS:REF:ALT) to extract, requires a file compressed with --id-index");
+        app.add_option("--ids-file", ids_file, "File of variant IDs to extract, one per line");
         app.add_option("-t,--targets", targets, "[^]chr|chr:pos|chr:from-to|chr:from-[,...]"); //"Similar as -r, --regions, but the next position is accessed by streaming the whole VCF/BCF rather than using the tbi/csi index. Both -r and -t options can be applied simultaneously: -r uses the index to jump to a region and -t discards positions which are not in the targets. Unlike -r, targets can be prefixed with "^" to request logical complement. For example, "^X,Y,MT" indicates that sequences X, Y and MT should be skipped. Yet another difference between the -t/-T and -r/-R is that -r/-R checks for proper overlaps and considers both POS and the end position of an indel, while -t/-T considers the POS coordinate only. Note that -t cannot be used in combination with -T.");
         //app.add_option("-T,--targets-file", targets_file, ""); // "Same -t, --targets, but reads regions from a file. Note that -T cannot be used in combination with -t.\nWith the call -C alleles command, third column of the targets file must be comma-separated list of alleles, starting with the reference allele. Note that the file must be compressed and indexed.");
+        app.add_option("--threads", threads, "Number of worker threads for region extraction (-r/-R), the output stays in genomic order");
         app.add_flag("-H,--no-header", no_header, "Suppress the header in VCF output (-Ov/-Oz)");
+        app.add_option("--min-ac", min_ac, "Minimum count of non-reference alleles of extracted sites");
+        app.add_option("--max-ac", max_ac, "Maximum count of non-reference alleles of extracted sites");
+        app.add_option("--min-maf", min_maf, "Minimum minor allele frequency of extracted sites, frequency of all but the most frequent allele (as bcftools --min-af <freq>:nonmajor)");
+        app.add_option("--max-maf", max_maf, "Maximum minor allele frequency of extracted sites (as bcftools --max-af <freq>:nonmajor)");
     }
     CLI::App app{"xSqueezeIt - VCF/BCF Compressor"};
 
@@ -100,6 +116,8 @@ public:
     std::string output_type = "b"; // CL11 doesn't convert to char (runtime e.g., with -O v)
     bool compress = false;
     bool verbose = false;
+    bool stats = false;
+    bool mem_stats = false;
     bool decompress = false;
     bool info = false;
     bool wait = false;
@@ -110,6 +128,13 @@ public:
     int  zstd_compression_level = 7; // Some acceptable default value
     double maf = 0.001;
     size_t reset_sort_block_length = 8192;
+    size_t bm_offset_bits = 0; // 0 is default given block length
+    bool single_file = false;
+    bool id_index = false;
+    size_t sample_tile_size = 0; // 0 is no tiles
+    bool rare_stream = false;
+    bool sites = false;
+    std::vector<std::string> site_info_fields;
     bool no_sort = false;
     bool count_xcf = false;
     bool sandbox = false;
@@ -141,7 +166,14 @@ public:
     std::string regions_file = "";
     std::string targets = "";
     std::string targets_file = "";
+    std::string ids = "";
+    std::string ids_file = "";
     bool no_header = false;
+    size_t threads = 1;
+    size_t min_ac = 0;
+    size_t max_ac = (size_t)-1;
+    double min_maf = 0.0;
+    double max_maf = 1.0; // Multi-allelic sites can go above 0.5
 };
 
 #endif /* __XSQUEEZEIT_HPP__ */
\ No newline at end of file
@@ -0,0 +1,134 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "accessor.hpp"
+#include "gt_ld.hpp"
+#include "xcf.hpp"
+#include "time.hpp"
+#include "CLI11.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+/**
+ * @brief Computes r2 and D' between the ALT alleles of the variants within a window
+ *
+ * @param is_xsi the lines are taken from the compressed XSI structures, else from the BCF
+ * */
+void ld(const std::string& filename, bool is_xsi, size_t window_bp, size_t max_variants, double min_r2, std::ostream& os, size_t& pairs) {
+    std::unique_ptr<Accessor> accessor;
+    std::unique_ptr<LdLineReader> reader;
+    std::string bcf_filename = filename;
+    std::string fname = filename;
+    if (is_xsi) {
+        accessor = make_unique<Accessor>(fname);
+        reader = make_unique<LdLineReader>(*accessor);
+        bcf_filename = accessor->get_variant_filename();
+    }
+
+    os << "#CHROM_A\tPOS_A\tID_A\tALT_A\tCHROM_B\tPOS_B\tID_B\tALT_B\tR2\tDPRIME\n";
+
+    pairs = 0;
+    LdWindow window(window_bp, max_variants);
+    auto report = [&](const LdWindow::Entry& first, const LdWindow::Entry& second, const LdStats& stats) {
+        if (stats.r2 >= min_r2) {
+            os << first.label << "\t" << second.label << "\t" << stats.r2 << "\t" << stats.d_prime << "\n";
+            pairs++;
+        }
+    };
+
+    bcf_file_reader_info_t bcf_fri;
+    initialize_bcf_file_reader(bcf_fri, bcf_filename);
+    const bcf_hdr_t *hdr = bcf_fri.sr->readers[0].header;
+    while (bcf_next_line(bcf_fri)) {
+        bcf1_t *rec = bcf_fri.line;
+        bcf_unpack(rec, BCF_UN_STR);
+        if (!is_xsi) {
+            bcf_fri.ngt = bcf_get_genotypes(hdr, rec, &(bcf_fri.gt_arr), &(bcf_fri.size_gt_arr));
+        }
+        for (size_t alt = 1; alt < rec->n_allele; ++alt) {
+            std::stringstream label;
+            label << bcf_seqname(hdr, rec) << "\t" << rec->pos + 1 << "\t" << rec->d.id << "\t" << rec->d.allele[alt];
+            window.add(rec->rid, rec->pos, label.str(),
+                       is_xsi ? reader->read(hdr, rec, alt) : LdLine(bcf_fri.gt_arr, bcf_fri.ngt, alt),
+                       report);
+        }
+    }
+    destroy_bcf_file_reader(bcf_fri);
+}
+
+int main(int argc, const char *argv[]) {
+    CLI::App app{"Linkage disequilibrium (r2 and D') app"};
+    std::string filename = "-";
+    std::string ofname = "-";
+    size_t window_bp = 1000000;
+    size_t max_variants = 0;
+    double min_r2 = 0.2;
+    app.add_option("-f,--file", filename, "Input file name (XSI or BCF)");
+    app.add_option("-w,--window", window_bp, "Window in base pairs (default 1000000)");
+    app.add_option("-n,--max-variants", max_variants, "Maximum number of ALT alleles in the window (default 0, no limit)");
+    app.add_option("--min-r2", min_r2, "Only report pairs with r2 at least this value (default 0.2)");
+    app.add_option("-o,--output", ofname, "Output file name (one line per pair), stdout by default");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (filename.compare("-") == 0) {
+        std::cerr << "Requires filename\n";
+        exit(app.exit(CLI::CallForHelp()));
+    }
+
+    const std::string extension = filename.substr(filename.find_last_of(".") + 1);
+    bool is_xsi = false;
+    if (extension == "bin" || extension == "xsi") {
+        is_xsi = true;
+    } else if (extension != "bcf" && extension != "vcf" && extension != "gz") {
+        std::cerr << "Unrecognized file type\n";
+        exit(-1);
+    }
+
+    std::ofstream ofs;
+    if (ofname.compare("-")) {
+        ofs.open(ofname);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file " << ofname << std::endl;
+            exit(-1);
+        }
+    }
+    std::ostream& os = ofs.is_open() ? ofs : std::cout;
+
+    try {
+        size_t pairs = 0;
+        auto start = std::chrono::steady_clock::now();
+        ld(filename, is_xsi, window_bp, max_variants, min_r2, os, pairs);
+        auto end = std::chrono::steady_clock::now();
+        std::cerr << "Reported pairs : " << pairs << std::endl;
+        printElapsedTime(start, end);
+    } catch (char const* e) {
+        std::cerr << e << std::endl;
+        exit(-1);
+    }
+
+    return 0;
+}
@@ -89,6 +89,56 @@ public:
         decompress_core();
     }
 
+    /**
+     * @brief Loads the genotype data without the variant file
+     * */
+    void decompress_xsi_only() {
+        decompress_checks();
+
+        XsiLineIterator it(accessor);
+        while (it.next()) {
+            it.fill_genotype_array(genotypes, header.hap_samples);
+        }
+    }
+
+    /**
+     * @brief Traverses the lines of a region with the position index of the XSI file (no variant BCF file)
+     * */
+    void decompress_xsi_only(const std::string& region) {
+        decompress_checks();
+
+        if (!accessor.has_position_index()) {
+            std::cerr << "File " << filename << " has no position index" << std::endl;
+            throw "No position index";
+        }
+
+        std::string contig;
+        int64_t beg, end;
+        Accessor::parse_region(region, contig, beg, end);
+
+        // The site store allows to keep only the lines in the region
+        DecodedSites sites;
+        size_t lines = 0;
+        for (const auto& entry : accessor.query_position_index(region)) {
+            const bool exact = accessor.fill_block_sites(entry.block_id, sites);
+            XsiLineIterator it(accessor, entry);
+            while (it.next()) {
+                if (exact) {
+                    const size_t line = it.get_line_in_block();
+                    const std::string alleles = sites.get_alleles(line);
+                    const int64_t ref_len = alleles.find(',') == std::string::npos ? alleles.length() : alleles.find(',');
+                    // 0-based position overlaps [beg-1, end)
+                    if ((sites.get_pos(line) >= end) or (sites.get_pos(line) + ref_len <= beg-1)) {
+                        continue;
+                    }
+                }
+                it.fill_genotype_array(genotypes, header.hap_samples);
+                lines++;
+            }
+        }
+        std::cout << "Decompressed " << lines << " lines " << (accessor.has_sites() ? "in " : "from the blocks overlapping ") << region << std::endl;
+    }
+
     /**
      * @brief Destructor
      * */
@@ -145,13 +195,13 @@ private:
                 // Non linear access (returns immediately if dp is already at correct position)
                 bm_index = values[0];
             } else {
-                if (header.version == 4) {
+                if (header.version >= 4) {
                     if (current_block_lines == header.ss_rate) {
                         current_block_lines = 0;
                         offset = 0;
                         block_id++;
                     }
-                    bm_index = block_id << 15 | offset;
+                    bm_index = accessor.bm_index(block_id, offset);
                     offset += bcf_fri.line->n_allele-1;
                     current_block_lines++;
                 } else {
@@ -37,11 +37,17 @@ void load_from_bcf(std::string& filename) {
     printElapsedTime(start, end);
 }
 
-void load_from_bin(std::string& filename) {
+void load_from_bin(std::string& filename, bool xsi_only, const std::string& region) {
     std::cout << "Loading gt data from file " << filename << "\n";
     NewLoader nl(filename);
     auto start = std::chrono::steady_clock::now();
-    nl.decompress();
+    if (xsi_only and region != "") {
+        nl.decompress_xsi_only(region);
+    } else if (xsi_only) {
+        nl.decompress_xsi_only();
+    } else {
+        nl.decompress();
+    }
     auto end = std::chrono::steady_clock::now();
     printElapsedTime(start, end);
 }
@@ -52,6 +58,10 @@ int main(int argc, const char *argv[]) {
     CLI::App app{"Loading time test app"};
     std::string filename = "-";
     app.add_option("-f,--file", filename, "Input file name");
+    bool xsi_only = false;
+    app.add_flag("--xsi-only", xsi_only, "Traverse the XSI file without the variant BCF file");
+    std::string region = "";
+    app.add_option("-r,--region", region, "chr|chr:pos|chr:beg-end|chr:beg- region for --xsi-only, uses the position index of the XSI file");
 
     CLI11_PARSE(app, argc, argv);
 
@@ -63,7 +73,7 @@ int main(int argc, const char *argv[]) {
     if (filename.substr(filename.find_last_of(".") + 1) == "bcf") {
         load_from_bcf(filename);
     } else if (filename.substr(filename.find_last_of(".") + 1) == "bin" || filename.substr(filename.find_last_of(".") + 1) == "xsi") {
-        load_from_bin(filename);
+        load_from_bin(filename, xsi_only, region);
     } else {
         std::cerr << "Unrecognized file type\n";
         exit(-1);
@@ -87,12 +87,12 @@ public:
         sr->collapse = COLLAPSE_NONE;
         sr->require_index = 1; // Must be set when number of readers is > 1
         int ret = 0;
-        ret = bcf_sr_add_reader(sr, bcf_filename1.c_str());
+        ret = c_xcf_bcf_sr_add_reader(sr, bcf_filename1.c_str());
         if (ret == 0) {
             std::cerr << "Could not load file : " << bcf_filename1 << std::endl;
             exit(-1);
         }
-        ret = bcf_sr_add_reader(sr, bcf_filename2.c_str());
+        ret = c_xcf_bcf_sr_add_reader(sr, bcf_filename2.c_str());
         if (ret == 0) {
             std::cerr << "Could not load file : " << bcf_filename2 << std::endl;
             exit(-1);
@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "accessor.hpp"
+#include "gt_matrix_product.hpp"
+#include "xcf.hpp"
+#include "time.hpp"
+#include "CLI11.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+/**
+ * @brief Loads the samples x K matrix of a phenotype file in the order of the samples
+ *
+ * The file is tab separated, the first line is the header (sample column then the
+ * K column names), then one line per sample with its ID and K values
+ * */
+std::vector<double> load_matrix(const std::string& filename, const std::vector<std::string>& samples, std::vector<std::string>& names) {
+    std::ifstream ifs(filename);
+    if (!ifs.is_open()) {
+        std::cerr << "Failed to open file " << filename << std::endl;
+        throw "Failed to open file";
+    }
+
+    std::string line;
+    std::string token;
+    if (!std::getline(ifs, line)) {
+        std::cerr << "Phenotype file " << filename << " is empty" << std::endl;
+        throw "Phenotype file error";
+    }
+    std::istringstream header(line);
+    std::getline(header, token, '\t'); // Sample column
+    names.clear();
+    while (std::getline(header, token, '\t')) {
+        names.push_back(token);
+    }
+    const size_t K = names.size();
+
+    std::unordered_map<std::string, std::vector<double> > rows;
+    while (std::getline(ifs, line)) {
+        if (line.empty()) continue;
+        std::istringstream iss(line);
+        std::string id;
+        std::getline(iss, id, '\t');
+        std::vector<double> row;
+        while (std::getline(iss, token, '\t')) {
+            row.push_back(std::stod(token));
+        }
+        if (row.size() != K) {
+            std::cerr << "Sample " << id << " has " << row.size() << " values, expected " << K << std::endl;
+            throw "Phenotype file error";
+        }
+        rows[id] = row;
+    }
+
+    std::vector<double> Y;
+    Y.reserve(samples.size() * K);
+    for (const auto& s : samples) {
+        auto it = rows.find(s);
+        if (it == rows.end()) {
+            std::cerr << "Sample " << s << " is not in the phenotype file" << std::endl;
+            throw "Phenotype file error";
+        }
+        Y.insert(Y.end(), it->second.begin(), it->second.end());
+    }
+    return Y;
+}
+
+/**
+ * @brief Random normal samples x K matrix (for benchmarking)
+ * */
+std::vector<double> random_matrix(const size_t n_samples, const size_t K, std::vector<std::string>& names) {
+    std::mt19937 gen;
+    gen.seed(0);
+    std::normal_distribution<double> d(0, 10);
+    std::vector<double> Y(n_samples * K);
+    for (auto& e : Y) {
+        e = d(gen);
+    }
+    names.clear();
+    for (size_t k = 0; k < K; ++k) {
+        names.push_back("Y" + std::to_string(k));
+    }
+    return Y;
+}
+
+/**
+ * @brief Computes X^T Y for all ALT alleles of a file in a single pass
+ *
+ * @param is_xsi the genotypes are taken from the compressed XSI structures, else from the BCF
+ * */
+void matrix_product(const std::string& filename, bool is_xsi, const std::string& phenotype_file, size_t K, std::ostream& os, double& checksum) {
+    std::unique_ptr<Accessor> accessor;
+    std::string bcf_filename = filename;
+    std::string fname = filename;
+    std::vector<std::string> samples;
+    if (is_xsi) {
+        accessor = make_unique<Accessor>(fname);
+        bcf_filename = accessor->get_variant_filename();
+        samples = accessor->get_sample_list();
+    } else {
+        samples = extract_samples(filename);
+    }
+
+    std::vector<std::string> names;
+    std::vector<double> Y = phenotype_file.empty() ? random_matrix(samples.size(), K, names) : load_matrix(phenotype_file, samples, names);
+    GenotypeMatrixProduct gmp(Y, samples.size(), names.size());
+
+    os << "#CHROM\tPOS\tID\tREF\tALT";
+    for (const auto& n : names) {
+        os << "\t" << n;
+    }
+    os << "\n";
+
+    bcf_file_reader_info_t bcf_fri;
+    initialize_bcf_file_reader(bcf_fri, bcf_filename);
+    const bcf_hdr_t *hdr = bcf_fri.sr->readers[0].header;
+    checksum = 0;
+    while (bcf_next_line(bcf_fri)) {
+        bcf1_t *rec = bcf_fri.line;
+        bcf_unpack(rec, BCF_UN_STR);
+        if (!is_xsi) {
+            bcf_fri.ngt = bcf_get_genotypes(hdr, rec, &(bcf_fri.gt_arr), &(bcf_fri.size_gt_arr));
+        }
+        for (size_t alt = 1; alt < rec->n_allele; ++alt) {
+            const std::vector<double>& result = is_xsi ?
+                gmp.product(*accessor, hdr, rec, alt) :
+                gmp.product(bcf_fri.gt_arr, bcf_fri.ngt, alt);
+            os << bcf_seqname(hdr, rec) << "\t" << rec->pos + 1 << "\t" << rec->d.id << "\t" << rec->d.allele[0] << "\t" << rec->d.allele[alt];
+            for (const auto& v : result) {
+                os << "\t" << v;
+                checksum += v;
+            }
+            os << "\n";
+        }
+    }
+    destroy_bcf_file_reader(bcf_fri);
+}
+
+int main(int argc, const char *argv[]) {
+    CLI::App app{"Genotype by matrix product (X^T Y) app"};
+    std::string filename = "-";
+    std::string ofname = "-";
+    std::string phenotype_file;
+    size_t K = 1;
+    app.add_option("-f,--file", filename, "Input file name (XSI or BCF)");
+    app.add_option("-p,--phenotypes", phenotype_file, "Tab separated matrix, header then sample ID and K values per line");
+    app.add_option("-k,--columns", K, "Number of random normal columns if no phenotype file is given");
+    app.add_option("-o,--output", ofname, "Output file name (one line per ALT allele with K values), stdout by default");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (filename.compare("-") == 0) {
+        std::cerr << "Requires filename\n";
+        exit(app.exit(CLI::CallForHelp()));
+    }
+
+    const std::string extension = filename.substr(filename.find_last_of(".") + 1);
+    bool is_xsi = false;
+    if (extension == "bin" || extension == "xsi") {
+        is_xsi = true;
+    } else if (extension != "bcf" && extension != "vcf" && extension != "gz") {
+        std::cerr << "Unrecognized file type\n";
+        exit(-1);
+    }
+
+    std::ofstream ofs;
+    if (ofname.compare("-")) {
+        ofs.open(ofname);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file " << ofname << std::endl;
+            exit(-1);
+        }
+    }
+    std::ostream& os = ofs.is_open() ? ofs : std::cout;
+
+    try {
+        double checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        matrix_product(filename, is_xsi, phenotype_file, K, os, checksum);
+        auto end = std::chrono::steady_clock::now();
+        std::cerr << "Checksum : " << checksum << std::endl;
+        printElapsedTime(start, end);
+    } catch (char const* e) {
+        std::cerr << e << std::endl;
+        exit(-1);
+    }
+
+    return 0;
+}
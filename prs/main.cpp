@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "prs.hpp"
+#include "time.hpp"
+#include "CLI11.hpp"
+
+#include <fstream>
+#include <iostream>
+
+int main(int argc, const char *argv[]) {
+    CLI::App app{"Polygenic scores from XSI (or BCF) files"};
+    std::string filename = "-";
+    std::string weights_filename = "-";
+    std::string ofname = "-";
+    size_t n_threads = 1;
+    app.add_option("-f,--file", filename, "Input file name (XSI or BCF)");
+    app.add_option("-w,--weights", weights_filename, "Weights file (ID, effect allele, then one weight column per score)");
+    app.add_option("-o,--output", ofname, "Output file name (one line per sample with the scores), stdout by default");
+    app.add_option("-t,--threads", n_threads, "Number of threads (XSI files only)");
+    app.footer("The score of a sample is the sum of the effect allele dosages times the weights. Missing genotypes have dosage 0 for any effect allele, REF included (no mean imputation).");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (filename.compare("-") == 0 or weights_filename.compare("-") == 0) {
+        std::cerr << "Requires filename and weights\n";
+        exit(app.exit(CLI::CallForHelp()));
+    }
+
+    std::ofstream ofs;
+    if (ofname.compare("-")) {
+        ofs.open(ofname);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file " << ofname << std::endl;
+            exit(-1);
+        }
+    }
+    std::ostream& os = ofs.is_open() ? ofs : std::cout;
+
+    try {
+        PrsWeights weights(weights_filename);
+        PrsEngine engine(filename, weights);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<double> scores = engine.compute(n_threads);
+        auto end = std::chrono::steady_clock::now();
+        printElapsedTime(start, end);
+
+        os << "sample";
+        for (const auto& n : weights.names) {
+            os << "\t" << n;
+        }
+        os << "\n";
+        const auto& samples = engine.get_sample_list();
+        for (size_t s = 0; s < samples.size(); ++s) {
+            os << samples[s];
+            for (size_t k = 0; k < weights.K; ++k) {
+                os << "\t" << scores[s * weights.K + k];
+            }
+            os << "\n";
+        }
+    } catch (char const* e) {
+        std::cerr << e << std::endl;
+        exit(-1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __PRS_HPP__
+#define __PRS_HPP__
+
+#include "accessor.hpp"
+#include "gt_matrix_product.hpp"
+#include "make_unique.hpp"
+#include "xcf.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief Weights of one or more polygenic scores
+ *
+ * The file is tab separated, the first line is the header (ID, effect allele, then
+ * the names of the K scores), then one line per variant with its ID (rsID or
+ * CHROM:POS:A1:A2), the effect allele and the K weights.
+ * */
+class PrsWeights {
+public:
+    class Entry {
+    public:
+        std::string id;
+        std::string effect_allele;
+        std::string other_allele; // Empty for rsIDs
+    };
+
+    PrsWeights(const std::string& filename) {
+        std::ifstream ifs(filename);
+        if (!ifs.is_open()) {
+            std::cerr << "Failed to open file " << filename << std::endl;
+            throw "Failed to open file";
+        }
+
+        std::string line;
+        std::string token;
+        if (!std::getline(ifs, line)) {
+            std::cerr << "Weights file " << filename << " is empty" << std::endl;
+            throw "Weights file error";
+        }
+        if (!line.empty() and line.back() == '\r') line.pop_back(); // CRLF files
+        std::istringstream header(line);
+        std::getline(header, token, '\t'); // ID
+        std::getline(header, token, '\t'); // Effect allele
+        while (std::getline(header, token, '\t')) {
+            names.push_back(token);
+        }
+        K = names.size();
+        if (K == 0) {
+            std::cerr << "Weights file " << filename << " has no score columns" << std::endl;
+            throw "Weights file error";
+        }
+
+        size_t line_number = 1;
+        while (std::getline(ifs, line)) {
+            line_number++;
+            if (!line.empty() and line.back() == '\r') line.pop_back(); // CRLF files
+            if (line.empty()) continue;
+            std::istringstream iss(line);
+            Entry e;
+            std::getline(iss, e.id, '\t');
+            std::getline(iss, e.effect_allele, '\t');
+            size_t n = 0;
+            while (std::getline(iss, token, '\t')) {
+                // Non numeric weights (e.g., NA) are an error rather than an exception of std::stod()
+                char* end = nullptr;
+                const double w = strtod(token.c_str(), &end);
+                if (token.empty() or *end != '\0' or !std::isfinite(w)) {
+                    std::cerr << "Line " << line_number << " of " << filename << " has the invalid weight \"" << token << "\"" << std::endl;
+                    throw "Weights file error";
+                }
+                weights.push_back(w);
+                n++;
+            }
+            if (n != K) {
+                std::cerr << "Variant " << e.id << " has " << n << " weights, expected " << K << std::endl;
+                throw "Weights file error";
+            }
+            to_upper(e.effect_allele);
+
+            // CHROM:POS:A1:A2 are matched by position and alleles, the others by ID
+            std::vector<std::string> fields;
+            std::istringstream ids(e.id);
+            while (std::getline(ids, token, ':')) {
+                fields.push_back(token);
+            }
+            if (fields.size() == 4) {
+                to_upper(fields[2]);
+                to_upper(fields[3]);
+                e.other_allele = (fields[2] == e.effect_allele) ? fields[3] : fields[2];
+                by_position[fields[0] + ":" + fields[1]].push_back(entries.size());
+            } else {
+                by_id[e.id].push_back(entries.size());
+            }
+            entries.push_back(e);
+        }
+    }
+
+    inline const double* get_weights(size_t entry) const {return weights.data() + entry * K;}
+
+    static inline void to_upper(std::string& s) {
+        std::transform(s.begin(), s.end(), s.begin(), ::toupper);
+    }
+
+    std::vector<std::string> names;
+    size_t K = 0;
+    std::vector<Entry> entries;
+    std::vector<double> weights;
+    std::unordered_map<std::string, std::vector<size_t> > by_id;
+    std::unordered_map<std::string, std::vector<size_t> > by_position;
+};
+
+/**
+ * @brief An allele of the variant file that has weights
+ * */
+class PrsAllele {
+public:
+    size_t position; // BM index (XSI) or record index (BCF)
+    size_t n_alleles;
+    size_t allele; // 0 is REF
+    size_t entry; // Entry in the weights
+};
+
+static inline std::string complement_strand(const std::string& allele) {
+    std::string c(allele);
+    for (auto& b : c) {
+        switch (b) {
+            case 'A': b = 'T'; break;
+            case 'T': b = 'A'; break;
+            case 'C': b = 'G'; break;
+            case 'G': b = 'C'; break;
+            default: break;
+        }
+    }
+    return c;
+}
+
+/**
+ * @brief Finds the allele of a record that is the effect allele of a weight entry
+ *
+ * REF/ALT swaps are handled (the REF allele can be the effect allele), as well as
+ * strand flips of bi-allelic SNPs that are not A/T or C/G (ambiguous)
+ *
+ * @return true if found
+ * */
+static inline bool prs_match_allele(bcf1_t *rec, const PrsWeights::Entry& e, size_t& allele) {
+    std::vector<std::string> alleles;
+    for (size_t i = 0; i < rec->n_allele; ++i) {
+        alleles.push_back(rec->d.allele[i]);
+        PrsWeights::to_upper(alleles.back());
+    }
+
+    for (int strand = 0; strand < 2; ++strand) {
+        const std::string effect = strand ? complement_strand(e.effect_allele) : e.effect_allele;
+        const std::string other = strand ? complement_strand(e.other_allele) : e.other_allele;
+        if (strand) {
+            if (e.effect_allele.size() != 1 or effect == e.other_allele or rec->n_allele != 2 or
+                alleles[0].size() != 1 or alleles[1].size() != 1) {
+                return false;
+            }
+        }
+        auto it = std::find(alleles.begin(), alleles.end(), effect);
+        if (it == alleles.end()) continue;
+        // The other allele (CHROM:POS:A1:A2 IDs) has to be on the record as well
+        if (!other.empty() and std::find(alleles.begin(), alleles.end(), other) == alleles.end()) continue;
+        allele = it - alleles.begin();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Polygenic scores over an XSI or BCF file
+ *
+ * The variant BCF is scanned once to match the weights, then the dosages of the
+ * effect alleles times their weights are accumulated per sample for all K scores
+ * in one pass. With XSI files this is done on the compressed binary lines and the
+ * blocks are split between the threads.
+ * */
+class PrsEngine {
+public:
+    PrsEngine(const std::string& filename, const PrsWeights& weights) : filename(filename), weights(weights) {
+        const std::string extension = filename.substr(filename.find_last_of(".") + 1);
+        is_xsi = (extension == "bin" || extension == "xsi");
+        if (is_xsi) {
+            accessor = make_unique<Accessor>(this->filename);
+            sample_list = accessor->get_sample_list();
+        } else {
+            sample_list = extract_samples(filename);
+        }
+    }
+
+    /**
+     * @brief Computes the scores
+     *
+     * @param n_threads number of threads (XSI files only)
+     * @return one row of K scores per sample
+     * */
+    std::vector<double> compute(size_t n_threads = 1) {
+        match();
+        if (is_xsi) {
+            return compute_xsi(std::max((size_t)1, n_threads));
+        } else {
+            return compute_bcf();
+        }
+    }
+
+    const std::vector<std::string>& get_sample_list() const {return sample_list;}
+
+protected:
+    void match() {
+        alleles.clear();
+        std::vector<size_t> matched_entries;
+        bcf_file_reader_info_t bcf_fri;
+        initialize_bcf_file_reader(bcf_fri, is_xsi ? accessor->get_variant_filename() : filename);
+        const bcf_hdr_t *hdr = bcf_fri.sr->readers[0].header;
+        size_t record = 0;
+        while (bcf_next_line(bcf_fri)) {
+            bcf1_t *rec = bcf_fri.line;
+            bcf_unpack(rec, BCF_UN_STR);
+
+            std::vector<size_t> candidates;
+            // The ID column can hold multiple IDs separated by ';'
+            if (rec->d.id and strcmp(rec->d.id, ".")) {
+                std::stringstream ss(rec->d.id);
+                std::string id;
+                while (std::getline(ss, id, ';')) {
+                    auto it = weights.by_id.find(id);
+                    if (it != weights.by_id.end()) {
+                        candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+                    }
+                }
+            }
+            auto it = weights.by_position.find(std::string(bcf_seqname(hdr, rec)) + ":" + std::to_string(rec->pos + 1));
+            if (it != weights.by_position.end()) {
+                candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+            }
+
+            if (!candidates.empty()) {
+                const size_t position = is_xsi ? accessor->position_from_bm_entry(hdr, rec) : record;
+                for (const auto entry : candidates) {
+                    PrsAllele pa;
+                    if (prs_match_allele(rec, weights.entries[entry], pa.allele)) {
+                        pa.position = position;
+                        pa.n_alleles = rec->n_allele;
+                        pa.entry = entry;
+                        alleles.push_back(pa);
+                        matched_entries.push_back(entry);
+                    }
+                }
+            }
+            record++;
+        }
+        destroy_bcf_file_reader(bcf_fri);
+
+        std::sort(matched_entries.begin(), matched_entries.end());
+        const size_t matched = std::unique(matched_entries.begin(), matched_entries.end()) - matched_entries.begin();
+        std::cerr << "Matched " << matched << " of " << weights.entries.size() << " weighted variants (" << alleles.size() << " alleles)" << std::endl;
+    }
+
+    std::vector<double> compute_bcf() {
+        GenotypeTransposedProduct xv(sample_list.size(), false, weights.K);
+        bcf_file_reader_info_t bcf_fri;
+        initialize_bcf_file_reader(bcf_fri, filename);
+        size_t record = 0;
+        auto it = alleles.begin();
+        while (it != alleles.end() and bcf_next_line(bcf_fri)) {
+            if (it->position == record) {
+                bcf_fri.ngt = bcf_get_genotypes(bcf_fri.sr->readers[0].header, bcf_fri.line, &(bcf_fri.gt_arr), &(bcf_fri.size_gt_arr));
+                for (; it != alleles.end() and it->position == record; ++it) {
+                    xv.add(bcf_fri.gt_arr, bcf_fri.ngt, it->allele, weights.get_weights(it->entry));
+                }
+            }
+            record++;
+        }
+        destroy_bcf_file_reader(bcf_fri);
+        return xv.get_result();
+    }
+
+    std::vector<double> compute_xsi(const size_t n_threads) {
+        // Split the alleles in contiguous chunks at block boundaries, one per thread
+        const size_t BM_BLOCK_BITS = get_bm_offset_bits(accessor->get_header_ref());
+        auto block_of = [BM_BLOCK_BITS](const PrsAllele& pa) {return (pa.position & 0xFFFFFFFF) >> BM_BLOCK_BITS;};
+        std::vector<size_t> bounds(1, 0);
+        for (size_t t = 1; t < n_threads; ++t) {
+            size_t b = std::max(bounds.back(), t * alleles.size() / n_threads);
+            while (b > bounds.back() and b < alleles.size() and block_of(alleles[b]) == block_of(alleles[b-1])) {
+                b++;
+            }
+            bounds.push_back(b);
+        }
+        bounds.push_back(alleles.size());
+
+        const size_t n_chunks = bounds.size() - 1;
+        std::vector<std::vector<double> > chunk_results(n_chunks);
+        std::mutex mutex;
+        bool fail = false;
+
+        auto worker_fn = [&](const size_t chunk) {
+            try {
+                // Each thread has its own accessor (decompression state), the first uses the main one
+                std::unique_ptr<Accessor> thread_accessor;
+                if (chunk) {
+                    thread_accessor = make_unique<Accessor>(filename);
+                }
+                Accessor& acc = chunk ? *thread_accessor : *accessor;
+                GenotypeTransposedProduct xv(sample_list.size(), false, weights.K);
+                for (size_t i = bounds[chunk]; i < bounds[chunk+1]; ++i) {
+                    const PrsAllele& pa = alleles[i];
+                    xv.add(acc, pa.position, pa.n_alleles, pa.allele, weights.get_weights(pa.entry));
+                }
+                chunk_results[chunk] = xv.get_result();
+            } catch (const char* e) {
+                std::cerr << e << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                fail = true;
+            } catch (...) {
+                // Any exception escaping the thread would terminate the process
+                std::cerr << "Score computation worker failed" << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                fail = true;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t chunk = 1; chunk < n_chunks; ++chunk) {
+            workers.emplace_back(worker_fn, chunk);
+        }
+        worker_fn(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (fail) {
+            throw "Failed to compute scores";
+        }
+
+        // Summed in chunk order so that the result does not depend on scheduling
+        std::vector<double> result(sample_list.size() * weights.K, 0);
+        for (const auto& r : chunk_results) {
+            for (size_t i = 0; i < result.size(); ++i) {
+                result[i] += r[i];
+            }
+        }
+        return result;
+    }
+
+    std::string filename;
+    const PrsWeights& weights;
+    bool is_xsi = false;
+    std::unique_ptr<Accessor> accessor;
+    std::vector<std::string> sample_list;
+    std::vector<PrsAllele> alleles;
+};
+
+#endif /* __PRS_HPP__ */
@@ -0,0 +1,67 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#include "CLI11.hpp"
+#include "time.hpp"
+#include "synth_gen.hpp"
+
+#include <iostream>
+
+int main(int argc, const char *argv[]) {
+    CLI::App app{"Synthetic phased genotype dataset generator"};
+    SynthOptions opt;
+    std::string ofname = "-";
+    std::string output_type = "b";
+    app.add_option("-o,--output", ofname, "Output file name, default is stdio");
+    app.add_option("-O,--output-type", output_type, "Output type b|u|z|v");
+    app.add_option("-n,--samples", opt.num_samples, "Number of (diploid) samples")->check(CLI::PositiveNumber);
+    app.add_option("-m,--variants", opt.num_variants, "Number of variant sites (BCF lines)");
+    app.add_option("--founders", opt.num_founders, "Number of founder haplotypes of the copying model")->check(CLI::PositiveNumber);
+    app.add_option("--seed", opt.seed, "Random seed");
+    app.add_option("--chrom", opt.chromosome, "Chromosome name");
+    app.add_option("--mean-spacing", opt.mean_spacing, "Mean distance between two sites in bp")->check(CLI::PositiveNumber);
+    app.add_option("--recombination", opt.recombination, "Probability per haplotype and site to switch founder")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--mutation", opt.mutation, "Probability per haplotype and site to differ from the founder")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--multi-allelic", opt.multi_allelic, "Fraction of sites with two ALT alleles")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--missing", opt.missing, "Fraction of missing genotypes")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--haploid", opt.haploid_samples, "Fraction of haploid samples (mixed ploidy)")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--phase-errors", opt.phase_errors, "Probability that a heterozygous genotype has its phase flipped")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--unphased", opt.unphased, "Fraction of genotypes written unphased")->check(CLI::Range(0.0, 1.0));
+
+    CLI11_PARSE(app, argc, argv);
+
+    try {
+        std::cerr << "Generating " << opt.num_variants << " sites for " << opt.num_samples << " samples" << std::endl;
+        auto begin = std::chrono::steady_clock::now();
+        SynthGenerator generator(opt);
+        generator.generate(ofname, output_type);
+        auto end = std::chrono::steady_clock::now();
+        printElapsedTime(begin, end);
+    } catch (const char* e) {
+        std::cerr << e << std::endl;
+        exit(-1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+/*******************************************************************************
+ * Copyright (C) 2021 Rick Wertenbroek, University of Lausanne (UNIL),
+ * University of Applied Sciences and Arts Western Switzerland (HES-SO),
+ * School of Management and Engineering Vaud (HEIG-VD).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+#ifndef __SYNTH_GEN_HPP__
+#define __SYNTH_GEN_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "vcf.h"
+#include "hts.h"
+
+/**
+ * @brief Draws the distance to the next event of a Bernoulli process with probability p
+ *
+ * Checking a rare event (recombination, missing genotype, phase error) for every
+ * haplotype of every site only costs a decrement, the geometric distance to the
+ * next event is drawn once per event.
+ * */
+class BernoulliStream {
+public:
+    BernoulliStream(const double p, std::mt19937_64& rng) : p(p), rng(rng), geo(p > 0.0 and p < 1.0 ? p : 0.5) {
+        draw();
+    }
+
+    inline bool next() {
+        if (p <= 0.0) return false;
+        if (p >= 1.0) return true;
+        if (countdown) {
+            countdown--;
+            return false;
+        }
+        draw();
+        return true;
+    }
+
+private:
+    inline void draw() {
+        countdown = geo(rng);
+    }
+
+    const double p;
+    std::mt19937_64& rng;
+    std::geometric_distribution<uint64_t> geo;
+    uint64_t countdown = 0;
+};
+
+/**
+ * @brief Options of the synthetic dataset generator, see README.md
+ * */
+struct SynthOptions {
+    size_t num_samples = 1000;
+    size_t num_variants = 10000;
+    size_t num_founders = 256; // Haplotypes copied in the mosaic model
+    uint64_t seed = 42;
+    std::string chromosome = "20";
+    size_t mean_spacing = 100; // Mean distance between two sites (bp)
+    double recombination = 0.001; // Probability per haplotype and site to switch founder
+    double mutation = 0.0001; // Probability per haplotype and site to differ from its founder
+    double multi_allelic = 0.05; // Fraction of sites with a second ALT allele
+    double missing = 0.0; // Fraction of missing genotypes
+    double haploid_samples = 0.0; // Fraction of haploid samples (mixed ploidy)
+    double phase_errors = 0.0; // Probability that a heterozygous genotype is flipped
+    double unphased = 0.0; // Fraction of genotypes written unphased
+};
+
+/**
+ * @brief Generates phased multi-allelic genotypes with a haplotype copying model
+ *
+ * Each haplotype is a mosaic of a small pool of founder haplotypes (Li and Stephens
+ * like copying), switching founder at a given recombination rate, which gives
+ * linkage disequilibrium and haplotype sharing as in real cohorts. The derived
+ * allele count of each site is drawn from the neutral site frequency spectrum
+ * (P(k) ~ 1/k), common alleles are carried by founders, alleles rarer than a
+ * founder are recent mutations placed on random haplotypes.
+ * */
+class SynthGenerator {
+public:
+    SynthGenerator(const SynthOptions& options) :
+        opt(options),
+        N_HAPS(options.num_samples * 2),
+        rng(options.seed),
+        recombination_stream(options.recombination, rng),
+        mutation_stream(options.mutation, rng),
+        missing_stream(options.missing, rng),
+        phase_error_stream(options.phase_errors, rng),
+        unphased_stream(options.unphased, rng),
+        founder_of(N_HAPS),
+        founder_alleles(options.num_founders),
+        haplotypes(N_HAPS),
+        gt_arr(N_HAPS),
+        haploid(options.num_samples, false) {
+        if (!opt.num_samples or !opt.num_founders) {
+            std::cerr << "Requires at least one sample and one founder" << std::endl;
+            throw "Bad generator options";
+        }
+        if (!opt.mean_spacing) {
+            std::cerr << "The mean spacing between sites should be at least 1 bp" << std::endl;
+            throw "Bad generator options";
+        }
+        for (const double p : {opt.recombination, opt.mutation, opt.multi_allelic, opt.missing,
+                               opt.haploid_samples, opt.phase_errors, opt.unphased}) {
+            // Also rejects NaN
+            if (!(p >= 0.0 and p <= 1.0)) {
+                std::cerr << "Probabilities and fractions should be in [0,1], got " << p << std::endl;
+                throw "Bad generator options";
+            }
+        }
+        std::uniform_int_distribution<uint32_t> founder_dist(0, opt.num_founders-1);
+        for (auto& f : founder_of) {
+            f = founder_dist(rng);
+        }
+        std::bernoulli_distribution haploid_dist(opt.haploid_samples);
+        for (size_t i = 0; i < opt.num_samples; ++i) {
+            haploid[i] = (opt.haploid_samples > 0.0) and haploid_dist(rng);
+        }
+    }
+
+    void generate(const std::string& ofname, const std::string& output_type) {
+        const char* flags = "wb";
+        switch (output_type[0]) {
+            case 'b': flags = "wb"; break;
+            case 'u': flags = "wbu"; break;
+            case 'z': flags = "wz"; break;
+            case 'v': flags = "w"; break;
+            default:
+                std::cerr << "Unrecognized output type : " << output_type << std::endl;
+                std::cerr << "Will default to BCF" << std::endl;
+                break;
+        }
+
+        htsFile* fp = hts_open(ofname.c_str(), flags);
+        if (!fp) {
+            std::cerr << "Could not open " << ofname << std::endl;
+            throw "File open error";
+        }
+        bcf_hdr_t* hdr = create_header();
+        if (bcf_hdr_write(fp, hdr) < 0) {
+            std::cerr << "Failed to write header" << std::endl;
+            throw "Failed to write header";
+        }
+
+        bcf1_t* rec = bcf_init();
+        int64_t pos = 0;
+        std::uniform_int_distribution<size_t> spacing_dist(1, std::max((size_t)1, opt.mean_spacing * 2 - 1));
+        for (size_t v = 0; v < opt.num_variants; ++v) {
+            pos += spacing_dist(rng);
+            const size_t n_alleles = generate_site();
+            fill_record(hdr, rec, pos, n_alleles);
+            if (bcf_write1(fp, hdr, rec)) {
+                std::cerr << "Failed to write record" << std::endl;
+                throw "Failed to write record";
+            }
+        }
+
+        bcf_destroy(rec);
+        bcf_hdr_destroy(hdr);
+        hts_close(fp);
+    }
+
+protected:
+    bcf_hdr_t* create_header() {
+        bcf_hdr_t* hdr = bcf_hdr_init("w");
+        const std::string contig = "##contig=<ID=" + opt.chromosome + ",length=" + std::to_string((opt.num_variants + 1) * opt.mean_spacing * 2) + ">";
+        bcf_hdr_append(hdr, "##source=xsqueezeit_synth_gen");
+        bcf_hdr_append(hdr, contig.c_str());
+        bcf_hdr_append(hdr, "##INFO=<ID=AC,Number=A,Type=Integer,Description=\"Allele count in genotypes\">");
+        bcf_hdr_append(hdr, "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Total number of alleles in called genotypes\">");
+        bcf_hdr_append(hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">");
+        for (size_t i = 0; i < opt.num_samples; ++i) {
+            const std::string sample = "SAMPLE_" + std::to_string(i);
+            bcf_hdr_add_sample(hdr, sample.c_str());
+        }
+        bcf_hdr_add_sample(hdr, NULL);
+        if (bcf_hdr_sync(hdr) < 0) {
+            std::cerr << "Failed to create header" << std::endl;
+            throw "Failed to create header";
+        }
+        return hdr;
+    }
+
+    /// @brief Draws a derived allele count from the neutral site frequency spectrum
+    inline size_t draw_allele_count() {
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+        // Continuous approximation of P(k) ~ 1/k on [1, N_HAPS)
+        const size_t k = (size_t)std::exp(u(rng) * std::log((double)N_HAPS));
+        return std::min(std::max(k, (size_t)1), N_HAPS-1);
+    }
+
+    /// @brief Places an allele on k random haplotypes (recent mutation)
+    inline void place_recent(const size_t k, const int allele) {
+        std::uniform_int_distribution<size_t> hap_dist(0, N_HAPS-1);
+        for (size_t i = 0; i < k; ++i) {
+            haplotypes[hap_dist(rng)] = allele;
+        }
+    }
+
+    /// @brief Generates the haplotypes of the next site, returns the number of alleles
+    size_t generate_site() {
+        // Founder switches (recombination) are applied at every site
+        std::uniform_int_distribution<uint32_t> founder_dist(0, opt.num_founders-1);
+        for (auto& f : founder_of) {
+            if (recombination_stream.next()) {
+                f = founder_dist(rng);
+            }
+        }
+
+        const size_t k = draw_allele_count();
+        const double freq = (double)k / (double)N_HAPS;
+        if (freq * opt.num_founders < 1.0) {
+            // Rarer than a founder, recent mutation
+            std::fill(haplotypes.begin(), haplotypes.end(), 0);
+            place_recent(k, 1);
+        } else {
+            // Carried by founders, copied with mutations
+            std::bernoulli_distribution founder_carries(freq);
+            size_t carriers = 0;
+            while (!carriers) {
+                for (auto& a : founder_alleles) {
+                    a = founder_carries(rng);
+                    carriers += a;
+                }
+            }
+            for (size_t i = 0; i < N_HAPS; ++i) {
+                haplotypes[i] = founder_alleles[founder_of[i]];
+                if (mutation_stream.next()) {
+                    haplotypes[i] ^= 1;
+                }
+            }
+        }
+
+        std::bernoulli_distribution multi_allelic(opt.multi_allelic);
+        if (opt.multi_allelic > 0.0 and multi_allelic(rng)) {
+            // The second ALT allele is a recent mutation
+            place_recent(std::min(draw_allele_count(), std::max(N_HAPS / opt.num_founders, (size_t)1)), 2);
+            return 3;
+        }
+        return 2;
+    }
+
+    void fill_record(bcf_hdr_t* hdr, bcf1_t* rec, const int64_t pos, const size_t n_alleles) {
+        static const char* alleles[] = {"A,C", "A,C,G"};
+        bcf_clear(rec);
+        rec->rid = 0;
+        rec->pos = pos - 1; // 0-based
+        bcf_update_alleles_str(hdr, rec, alleles[n_alleles - 2]);
+
+        std::vector<int32_t> ac(n_alleles - 1, 0);
+        int32_t an = 0;
+        for (size_t i = 0; i < opt.num_samples; ++i) {
+            int32_t* gt = gt_arr.data() + i * 2;
+            int a0 = haplotypes[i * 2];
+            int a1 = haplotypes[i * 2 + 1];
+            if (missing_stream.next()) {
+                gt[0] = bcf_gt_missing;
+                gt[1] = haploid[i] ? bcf_int32_vector_end : bcf_gt_missing;
+                continue;
+            }
+            if (haploid[i]) {
+                gt[0] = bcf_gt_unphased(a0);
+                gt[1] = bcf_int32_vector_end;
+                if (a0) ac[a0-1]++;
+                an++;
+                continue;
+            }
+            if (a0 != a1 and phase_error_stream.next()) {
+                std::swap(a0, a1);
+            }
+            if (unphased_stream.next()) {
+                gt[0] = bcf_gt_unphased(a0);
+                gt[1] = bcf_gt_unphased(a1);
+            } else {
+                gt[0] = bcf_gt_unphased(a0);
+                gt[1] = bcf_gt_phased(a1);
+            }
+            if (a0) ac[a0-1]++;
+            if (a1) ac[a1-1]++;
+            an += 2;
+        }
+
+        bcf_update_info_int32(hdr, rec, "AC", ac.data(), n_alleles - 1);
+        bcf_update_info_int32(hdr, rec, "AN", &an, 1);
+        if (bcf_update_genotypes(hdr, rec, gt_arr.data(), gt_arr.size())) {
+            std::cerr << "Failed to update genotypes" << std::endl;
+            throw "Failed to update genotypes";
+        }
+    }
+
+    const SynthOptions opt;
+    const size_t N_HAPS;
+    std::mt19937_64 rng;
+    BernoulliStream recombination_stream;
+    BernoulliStream mutation_stream;
+    BernoulliStream missing_stream;
+    BernoulliStream phase_error_stream;
+    BernoulliStream unphased_stream;
+    std::vector<uint32_t> founder_of; // Founder copied by each haplotype
+    std::vector<uint8_t> founder_alleles;
+    std::vector<uint8_t> haplotypes;
+    std::vector<int32_t> gt_arr;
+    std::vector<bool> haploid;
+};
+
+#endif /* __SYNTH_GEN_HPP__ */
@@ -0,0 +1,182 @@
+#!/bin/bash
+
+# Runs an application (dot_prod, matrix_prod, prs, ld) on the BCF file and on the
+# XSI compressed file and compares the outputs. The numbers are compared with a
+# relative tolerance because the compressive computations sum in another order.
+
+if ! command -v realpath &> /dev/null
+then
+    realpath() {
+        [[ $1 = /* ]] && echo "$1" || echo "$PWD/${1#./}"
+    }
+fi
+
+# Get the path of this script
+SCRIPTPATH=$(realpath  $(dirname "$0"))
+
+TOOL=""
+TOOL_ARGS=""
+ZSTD=""
+SAMPLE_TILE_SIZE=""
+BLOCK_SIZE="--variant-block-length 8192"
+MAF="--maf 0.002"
+TOLERANCE="1e-4"
+EXPECT=""
+unset -v NO_KEEP
+
+POSITIONAL=()
+while [[ $# -gt 0 ]]
+do
+key="$1"
+
+case $key in
+    -f|--filename)
+    FILENAME="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --tool)
+    TOOL="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --tool-args)
+    TOOL_ARGS="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --maf)
+    MAF="--maf $2"
+    shift # past argument
+    shift # past value
+    ;;
+    --block-size)
+    BLOCK_SIZE="--variant-block-length $2"
+    shift # past argument
+    shift # past value
+    ;;
+    --sample-tile-size)
+    SAMPLE_TILE_SIZE="--sample-tile-size $2"
+    shift # past argument
+    shift # past value
+    ;;
+    --expect)
+    EXPECT="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --tolerance)
+    TOLERANCE="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --zstd)
+    ZSTD="--zstd"
+    shift # past argument
+    ;;
+    --no-keep)
+    NO_KEEP="YES"
+    shift # past argument
+    ;;
+    *)    # unknown option
+    POSITIONAL+=("$1") # save it in an array for later
+    shift # past argument
+    ;;
+esac
+done
+set -- "${POSITIONAL[@]}" # restore positional parameters
+
+if [ -z "${FILENAME}" ] || [ -z "${TOOL}" ]
+then
+    echo "Specify a filename with --filename, -f <filename> and an application with --tool <name>"
+    exit 1
+fi
+
+TOOLPATH="${SCRIPTPATH}/../../${TOOL}/${TOOL}"
+if [ ! -x "${TOOLPATH}" ]
+then
+    echo "Failed to find ${TOOLPATH}, build it with make -C ${TOOL}"
+    exit 1
+fi
+
+echo "FILENAME        = ${FILENAME}"
+echo "Tool : ${TOOL} ${TOOL_ARGS}"
+
+TMPDIR=$(mktemp -d -t xsi_XXXXXX) || { echo "Failed to create temporary directory"; exit 1; }
+
+echo "Temporary director : ${TMPDIR}"
+
+function exit_fail_rm_tmp {
+    echo "Removing directory : ${TMPDIR}"
+    rm -r ${TMPDIR}
+    exit 1
+}
+
+command -v bcftools || { echo "Failed to find bcftools, is it installed ?"; exit_fail_rm_tmp; }
+
+# The applications recognize the files by their extension
+bcftools view -Ob -o ${TMPDIR}/input.bcf ${FILENAME} || { echo "Failed to convert ${FILENAME}"; exit_fail_rm_tmp; }
+"${SCRIPTPATH}"/../../xsqueezeit -c ${ZSTD} ${SAMPLE_TILE_SIZE} ${BLOCK_SIZE} ${MAF} -f ${TMPDIR}/input.bcf -o ${TMPDIR}/compressed.xsi || { echo "Failed to compress ${FILENAME}"; exit_fail_rm_tmp; }
+
+# dot_prod prints a checksum among other lines, the other applications print tables
+function run_tool {
+    if [ "${TOOL}" == "dot_prod" ]
+    then
+        "${TOOLPATH}" -f $1 ${TOOL_ARGS} | grep "^Checksum"
+    else
+        "${TOOLPATH}" -f $1 ${TOOL_ARGS}
+    fi
+}
+
+run_tool ${TMPDIR}/input.bcf > ${TMPDIR}/bcf_output.txt 2> ${TMPDIR}/bcf_log.txt || { echo "Failed to run ${TOOL} on the BCF file"; exit_fail_rm_tmp; }
+run_tool ${TMPDIR}/compressed.xsi > ${TMPDIR}/xsi_output.txt 2> ${TMPDIR}/xsi_log.txt || { echo "Failed to run ${TOOL} on the XSI file"; exit_fail_rm_tmp; }
+
+# Messages both runs have to print (e.g., the number of matched variants)
+if [ -n "${EXPECT}" ]
+then
+    grep -qF "${EXPECT}" ${TMPDIR}/bcf_log.txt || { echo "The BCF run did not print \"${EXPECT}\""; cat ${TMPDIR}/bcf_log.txt; exit_fail_rm_tmp; }
+    grep -qF "${EXPECT}" ${TMPDIR}/xsi_log.txt || { echo "The XSI run did not print \"${EXPECT}\""; cat ${TMPDIR}/xsi_log.txt; exit_fail_rm_tmp; }
+fi
+
+# Same lines and fields, numbers within the relative tolerance (absolute below 1)
+awk -v tol=${TOLERANCE} '
+function is_num(x) { return x ~ /^[-+]?([0-9]+\.?[0-9]*|\.[0-9]+)([eE][-+]?[0-9]+)?$/ }
+function abs(x) { return x < 0 ? -x : x }
+FILENAME == ARGV[1] { ref[FNR] = $0; n_ref = FNR; next }
+{
+    n_out = FNR
+    if (!(FNR in ref)) { print "Line " FNR " only in XSI output : " $0; bad++; next }
+    n = split(ref[FNR], r)
+    if (n != NF) { print "Line " FNR " differs :\n< " ref[FNR] "\n> " $0; bad++; next }
+    for (i = 1; i <= NF; ++i) {
+        if (is_num($i) && is_num(r[i])) {
+            scale = abs(r[i]) > 1 ? abs(r[i]) : 1
+            if (abs($i - r[i]) > tol * scale) { print "Line " FNR " differs :\n< " ref[FNR] "\n> " $0; bad++; break }
+        } else if ($i != r[i]) {
+            print "Line " FNR " differs :\n< " ref[FNR] "\n> " $0; bad++; break
+        }
+    }
+}
+END {
+    if (n_out != n_ref) { print "BCF output has " n_ref " lines, XSI output has " n_out " lines"; bad++ }
+    exit(bad > 0)
+}' ${TMPDIR}/bcf_output.txt ${TMPDIR}/xsi_output.txt > ${TMPDIR}/difflog.txt
+
+if [ $? -ne 0 ] || [ ! -s ${TMPDIR}/bcf_output.txt ]
+then
+    if [ -z "${NO_KEEP}" ]
+    then
+        echo
+        echo "[KO] The outputs differ, check out ${TMPDIR}/difflog.txt"
+        exit 1
+    else
+        cat ${TMPDIR}/difflog.txt
+        exit_fail_rm_tmp # For unit testing
+    fi
+else
+    echo
+    echo "[OK] The outputs are the same"
+fi
+
+rm -r $TMPDIR
+exit 0
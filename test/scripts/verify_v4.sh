@@ -14,8 +14,23 @@ ZSTD=""
 REGIONS=""
 TARGETS=""
 SAMPLES=""
+FILTERS=""
+BCFTOOLS_FILTERS=""
+IDS=""
+IDS_LIST=""
+IDS_FILE=""
 ZSTD_LEVEL=""
+SINGLE_FILE=""
+SAMPLE_TILE_SIZE=""
+RARE_STREAM=""
+STATS=""
+MEM_STATS=""
 BLOCK_SIZE="--variant-block-length 8192"
+THREADS=""
+ID_INDEX=""
+BM_OFFSET_BITS=""
+SITES=""
+SITE_INFO=""
 unset -v NO_KEEP
 
 POSITIONAL=()
@@ -36,6 +51,11 @@ case $key in
     shift # past argument
     shift # past value
     ;;
+    -R|--regions-file)
+    REGIONS="-R $2"
+    shift # past argument
+    shift # past value
+    ;;
     -t|--targets)
     TARGETS="-t $2"
     shift # past argument
@@ -46,6 +66,54 @@ case $key in
     shift # past argument
     shift # past value
     ;;
+    --min-ac|--max-ac)
+    FILTERS="${FILTERS} $1 $2"
+    BCFTOOLS_FILTERS="${BCFTOOLS_FILTERS} $1 $2"
+    shift # past argument
+    shift # past value
+    ;;
+    --min-maf)
+    FILTERS="${FILTERS} $1 $2"
+    BCFTOOLS_FILTERS="${BCFTOOLS_FILTERS} --min-af $2:nonmajor"
+    shift # past argument
+    shift # past value
+    ;;
+    --max-maf)
+    FILTERS="${FILTERS} $1 $2"
+    BCFTOOLS_FILTERS="${BCFTOOLS_FILTERS} --max-af $2:nonmajor"
+    shift # past argument
+    shift # past value
+    ;;
+    --ids)
+    IDS="--ids $2"
+    IDS_LIST="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --ids-file)
+    IDS="--ids-file $2"
+    IDS_FILE="$2"
+    shift # past argument
+    shift # past value
+    ;;
+    --id-index)
+    ID_INDEX="--id-index"
+    shift # past argument
+    ;;
+    --bm-offset-bits)
+    BM_OFFSET_BITS="--bm-offset-bits $2"
+    shift # past argument
+    shift # past value
+    ;;
+    --sites)
+    SITES="--sites"
+    shift # past argument
+    ;;
+    --site-info)
+    SITE_INFO="--site-info $2"
+    shift # past argument
+    shift # past value
+    ;;
     --block-size)
     BLOCK_SIZE="--variant-block-length $2"
     shift # past argument
@@ -60,6 +128,32 @@ case $key in
     shift # past argument
     shift # past value
     ;;
+    --single-file)
+    SINGLE_FILE="--single-file"
+    shift # past argument
+    ;;
+    --rare-stream)
+    RARE_STREAM="--rare-stream"
+    shift # past argument
+    ;;
+    --stats)
+    STATS="--stats"
+    shift # past argument
+    ;;
+    --mem-stats)
+    MEM_STATS="--mem-stats"
+    shift # past argument
+    ;;
+    --sample-tile-size)
+    SAMPLE_TILE_SIZE="--sample-tile-size $2"
+    shift # past argument
+    shift # past value
+    ;;
+    --threads)
+    THREADS="--threads $2"
+    shift # past argument
+    shift # past value
+    ;;
     --no-keep)
     NO_KEEP="YES"
     shift # past argument
@@ -86,6 +180,20 @@ echo "Temporary director : ${TMPDIR}"
 echo "Region : ${REGIONS}"
 echo "Targets : ${TARGETS}"
 echo "Samples : ${SAMPLES}"
+echo "Filters : ${FILTERS}"
+echo "IDs : ${IDS}"
+
+# bcftools selects the requested IDs with an expression on a file of IDs
+ID_FILTER=""
+if [ -n "${IDS_LIST}" ]
+then
+    IDS_FILE=${TMPDIR}/ids.txt
+    echo "${IDS_LIST}" | tr ',' '\n' > ${IDS_FILE}
+fi
+if [ -n "${IDS_FILE}" ]
+then
+    ID_FILTER="-i ID=@${IDS_FILE}"
+fi
 
 function exit_fail_rm_tmp {
     echo "Removing directory : ${TMPDIR}"
@@ -95,8 +203,8 @@ function exit_fail_rm_tmp {
 
 # --variant-block-length 65536
 # --variant-block-length 1024
-"${SCRIPTPATH}"/../../xsqueezeit -c ${ZSTD} ${ZSTD_LEVEL} ${BLOCK_SIZE} --maf 0.002 -f ${FILENAME} -o ${TMPDIR}/compressed.bin || { echo "Failed to compress ${FILENAME}"; exit_fail_rm_tmp; }
-"${SCRIPTPATH}"/../../xsqueezeit -x ${REGIONS} ${TARGETS} ${SAMPLES} -f ${TMPDIR}/compressed.bin -o ${TMPDIR}/uncompressed.bcf || { echo "Failed to uncompress ${FILENAME}"; exit_fail_rm_tmp; }
+"${SCRIPTPATH}"/../../xsqueezeit -c ${ZSTD} ${ZSTD_LEVEL} ${SINGLE_FILE} ${SAMPLE_TILE_SIZE} ${RARE_STREAM} ${STATS} ${MEM_STATS} ${ID_INDEX} ${BM_OFFSET_BITS} ${SITES} ${SITE_INFO} ${BLOCK_SIZE} --maf 0.002 -f ${FILENAME} -o ${TMPDIR}/compressed.bin || { echo "Failed to compress ${FILENAME}"; exit_fail_rm_tmp; }
+"${SCRIPTPATH}"/../../xsqueezeit -x ${STATS} ${MEM_STATS} ${THREADS} ${REGIONS} ${TARGETS} ${SAMPLES} ${FILTERS} ${IDS} -f ${TMPDIR}/compressed.bin -o ${TMPDIR}/uncompressed.bcf || { echo "Failed to uncompress ${FILENAME}"; exit_fail_rm_tmp; }
 
 command -v bcftools || { echo "Failed to find bcftools, is it installed ?"; exit_fail_rm_tmp; }
 
@@ -109,7 +217,7 @@ echo
 # a streaming program, it will load everything in memory first...
 # E.g., 1KGP3 chr20 -> about 9 GB (uncompressed view output) times 2 (two files)
 #diff <(bcftools view ${FILENAME}) <(bcftools view ${TMPDIR}/uncompressed.bcf) | tee ${TMPDIR}/difflog.txt
-diff <(bcftools view ${REGIONS} ${TARGETS} ${SAMPLES} ${FILENAME}) <(bcftools view ${TMPDIR}/uncompressed.bcf) > ${TMPDIR}/difflog.txt
+diff <(bcftools view ${REGIONS} ${TARGETS} ${SAMPLES} ${BCFTOOLS_FILTERS} ${ID_FILTER} ${FILENAME}) <(bcftools view ${TMPDIR}/uncompressed.bcf) > ${TMPDIR}/difflog.txt
 DIFFLINES=$(wc -l ${TMPDIR}/difflog.txt | awk '{print $1}')
 #echo $DIFFLINES
 if [ ${DIFFLINES} -gt 4 ]
@@ -24,6 +24,29 @@
 
 #include "xcf.hpp"
 #include "fs.hpp"
+#include "xsi_layout.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Custom hFILE backends and URL schemes are only declared in the internal header of
+// htslib (as used by its plugins), it is not installed, only the in-tree htslib (git
+// submodule, see the Makefile) has it. The API used here is the one of htslib 1.10+.
+// Builds against an installed htslib read single-file containers without index.
+#if !defined(XSI_NO_HTSLIB_INTERNALS) and defined(HTS_VERSION) and (HTS_VERSION >= 101000) and defined(__has_include)
+#if __has_include("../hfile_internal.h")
+#define XSI_HTSLIB_INTERNALS
+extern "C" {
+#include "../hfile_internal.h"
+}
+#endif
+#endif
 
 bool has_extension(const std::string& filename, const std::string& extension) {
     const std::regex ext_regex(std::string(".+\\") + extension);
@@ -56,9 +79,260 @@ void create_index_file(std::string filename, int n_threads) {
     }
 }
 
+bool is_xsi_container(const std::string& filename) {
+    if (filename.compare("-") == 0 or !fs::exists(filename)) {
+        return false;
+    }
+    embedded_variant_file_t evf;
+    return read_embedded_variant_file(filename, evf);
+}
+
+#ifdef XSI_HTSLIB_INTERNALS
+
+// Scheme names of the BCF and CSI slices of a single-file XSI container, e.g., "xsi-bcf:file.xsi"
+#define XSI_BCF_SCHEME "xsi-bcf"
+#define XSI_CSI_SCHEME "xsi-csi"
+
+/**
+ * @brief Read-only mapping of a single-file XSI container
+ *
+ * Mapped once per process and shared by all the readers (e.g., one per thread),
+ * unmapped when the last reader is closed
+ * */
+class ContainerMapping {
+public:
+    std::string filename;
+    const char* data = nullptr;
+    size_t size = 0;
+    embedded_variant_file_t evf;
+    size_t refs = 0;
+};
+
+static std::mutex container_mappings_mutex;
+static std::map<std::string, ContainerMapping*> container_mappings;
+
+static ContainerMapping* acquire_container_mapping(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(container_mappings_mutex);
+    auto it = container_mappings.find(filename);
+    if (it != container_mappings.end()) {
+        it->second->refs++;
+        return it->second;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open file " << filename << std::endl;
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) or (size_t)st.st_size < XSI_HEADER_SIZE) {
+        std::cerr << "File " << filename << " is too small to be an XSI file" << std::endl;
+        close(fd);
+        return nullptr;
+    }
+    const size_t size = st.st_size;
+    void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "Failed to mmap file " << filename << std::endl;
+        return nullptr;
+    }
+
+    // A truncated or corrupt container must not hand memory outside the file to htslib
+    embedded_variant_file_t evf;
+    if (!get_embedded_variant_file((const char*)p, evf) or
+        evf.bcf_offset > size or evf.bcf_size > size - evf.bcf_offset or
+        evf.csi_offset > size or evf.csi_size > size - evf.csi_offset) {
+        std::cerr << "File " << filename << " has no valid embedded variant BCF" << std::endl;
+        munmap(p, size);
+        return nullptr;
+    }
+
+    ContainerMapping* mapping = new ContainerMapping;
+    mapping->filename = filename;
+    mapping->data = (const char*)p;
+    mapping->size = size;
+    mapping->evf = evf;
+    mapping->refs = 1;
+    container_mappings[filename] = mapping;
+    return mapping;
+}
+
+static void release_container_mapping(ContainerMapping* mapping) {
+    std::lock_guard<std::mutex> lock(container_mappings_mutex);
+    if (--mapping->refs == 0) {
+        munmap((void*)mapping->data, mapping->size);
+        container_mappings.erase(mapping->filename);
+        delete mapping;
+    }
+}
+
+/**
+ * @brief hFILE reading a slice (the BCF or the CSI) of a mapped container
+ *
+ * htslib only fills its own small buffer from the mapping, the slice is never copied as a whole
+ * */
+typedef struct {
+    hFILE base;
+    ContainerMapping* mapping;
+    const char* data;
+    size_t size;
+    size_t pos;
+} hFILE_xsi_slice;
+
+static ssize_t xsi_slice_read(hFILE* fpv, void* buffer, size_t nbytes) {
+    hFILE_xsi_slice* fp = (hFILE_xsi_slice*)fpv;
+    const size_t n = std::min(nbytes, fp->size - fp->pos);
+    memcpy(buffer, fp->data + fp->pos, n);
+    fp->pos += n;
+    return n;
+}
+
+static ssize_t xsi_slice_write(hFILE*, const void*, size_t) {
+    errno = EROFS;
+    return -1;
+}
+
+static off_t xsi_slice_seek(hFILE* fpv, off_t offset, int whence) {
+    hFILE_xsi_slice* fp = (hFILE_xsi_slice*)fpv;
+    size_t origin;
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->size; break;
+    default: errno = EINVAL; return -1;
+    }
+    if ((offset < 0 and (size_t)(-offset) > origin) or (offset > 0 and (size_t)offset > fp->size - origin)) {
+        errno = EINVAL;
+        return -1;
+    }
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static int xsi_slice_close(hFILE* fpv) {
+    release_container_mapping(((hFILE_xsi_slice*)fpv)->mapping);
+    return 0;
+}
+
+static const struct hFILE_backend xsi_slice_backend = {
+    xsi_slice_read, xsi_slice_write, xsi_slice_seek, NULL /* flush */, xsi_slice_close
+};
+
+static hFILE* xsi_slice_open(const char* url, const char* mode) {
+    if (strchr(mode, 'w') or strchr(mode, 'a')) {
+        errno = EROFS;
+        return NULL;
+    }
+    const std::string u(url);
+    const bool csi = (u.compare(0, sizeof(XSI_CSI_SCHEME), XSI_CSI_SCHEME ":") == 0);
+    const std::string filename = u.substr(u.find(':') + 1);
+
+    ContainerMapping* mapping = acquire_container_mapping(filename);
+    if (!mapping) {
+        errno = EINVAL;
+        return NULL;
+    }
+    hFILE_xsi_slice* fp = (hFILE_xsi_slice*)hfile_init(sizeof(hFILE_xsi_slice), mode, 0);
+    if (!fp) {
+        release_container_mapping(mapping);
+        return NULL;
+    }
+    fp->mapping = mapping;
+    fp->data = mapping->data + (csi ? mapping->evf.csi_offset : mapping->evf.bcf_offset);
+    fp->size = csi ? mapping->evf.csi_size : mapping->evf.bcf_size;
+    fp->pos = 0;
+    fp->base.backend = &xsi_slice_backend;
+    return &fp->base;
+}
+
+static void register_xsi_schemes() {
+    static const struct hFILE_scheme_handler handler = {xsi_slice_open, hfile_always_local, "xsqueezeit", 50, NULL};
+    hfile_add_scheme_handler(XSI_BCF_SCHEME, &handler);
+    hfile_add_scheme_handler(XSI_CSI_SCHEME, &handler);
+}
+
+/**
+ * @brief Adds the variant BCF embedded in a single-file XSI container to a synced reader
+ *
+ * The container is mapped once per process, the BCF and its CSI index are opened
+ * by htslib as slices of the mapping through the xsi-bcf: and xsi-csi: schemes.
+ *
+ * @return 1 on success, 0 on failure (as bcf_sr_add_reader())
+ * */
+int bcf_sr_add_embedded_reader(bcf_srs_t* sr, const std::string& filename) {
+    static std::once_flag schemes_registered;
+    std::call_once(schemes_registered, register_xsi_schemes);
+
+    const std::string bcf_url = std::string(XSI_BCF_SCHEME ":") + filename;
+    hFILE* hfile = hopen(bcf_url.c_str(), "r");
+    if (!hfile) {
+        std::cerr << "Failed to open the embedded variant BCF of " << filename << std::endl;
+        return 0;
+    }
+    htsFile* fp = hts_hopen(hfile, filename.c_str(), "rb");
+    if (!fp) {
+        std::cerr << "Failed to open the embedded variant BCF of " << filename << std::endl;
+        hclose_abruptly(hfile);
+        return 0;
+    }
+
+    std::string index_url;
+    if (sr->require_index) {
+        embedded_variant_file_t evf;
+        if (read_embedded_variant_file(filename, evf) and evf.csi_size) {
+            index_url = std::string(XSI_CSI_SCHEME ":") + filename;
+        }
+    }
+
+    return bcf_sr_add_hreader(sr, fp, 1 /* autoclose */, index_url.empty() ? NULL : index_url.c_str());
+}
+#else
+/**
+ * @brief Adds the variant BCF embedded in a single-file XSI container to a synced reader
+ *
+ * Without the htslib internals the BCF is read from its offset in the container
+ * through the public hFILE API, sequentially (the BGZF EOF block of the BCF ends
+ * the reading), the CSI index cannot be loaded (no region queries).
+ *
+ * @return 1 on success, 0 on failure (as bcf_sr_add_reader())
+ * */
+int bcf_sr_add_embedded_reader(bcf_srs_t* sr, const std::string& filename) {
+    if (sr->require_index) {
+        std::cerr << "Indexed reading of the single-file container " << filename << " requires xSqueezeIt built with the in-tree htslib (git submodule)" << std::endl;
+        return 0;
+    }
+    embedded_variant_file_t evf;
+    if (!read_embedded_variant_file(filename, evf)) {
+        std::cerr << "File " << filename << " has no valid embedded variant BCF" << std::endl;
+        return 0;
+    }
+    hFILE* hfile = hopen(filename.c_str(), "r");
+    if (!hfile or (hseek(hfile, evf.bcf_offset, SEEK_SET) != (off_t)evf.bcf_offset)) {
+        std::cerr << "Failed to open the embedded variant BCF of " << filename << std::endl;
+        if (hfile) hclose_abruptly(hfile);
+        return 0;
+    }
+    htsFile* fp = hts_hopen(hfile, filename.c_str(), "rb");
+    if (!fp) {
+        std::cerr << "Failed to open the embedded variant BCF of " << filename << std::endl;
+        hclose_abruptly(hfile);
+        return 0;
+    }
+    return bcf_sr_add_hreader(sr, fp, 1 /* autoclose */, NULL);
+}
+#endif
+
+int xsi_bcf_sr_add_reader(bcf_srs_t* sr, const std::string& filename) {
+    if (is_xsi_container(filename)) {
+        return bcf_sr_add_embedded_reader(sr, filename);
+    }
+    return bcf_sr_add_reader(sr, filename.c_str());
+}
+
 static void initialize_bcf_file_reader_common(bcf_file_reader_info_t& bcf_fri, const std::string& filename) {
-    while(!bcf_sr_add_reader(bcf_fri.sr, filename.c_str())) {
-        if (bcf_fri.sr->errnum == idx_load_failed) {
+    while(!xsi_bcf_sr_add_reader(bcf_fri.sr, filename)) {
+        if (bcf_fri.sr->errnum == idx_load_failed and !is_xsi_container(filename)) {
             bcf_sr_destroy(bcf_fri.sr);
             bcf_fri.sr = bcf_sr_init();
             bcf_fri.sr->collapse = COLLAPSE_NONE;
@@ -691,6 +965,12 @@ size_t replace_samples_by_pos_in_binary_matrix(const std::string& ifname, const
         }
         if (offset >> BM_BLOCK_BITS) {
             std::cerr << "Offset cannot be represented on " << BM_BLOCK_BITS << " bits !" << std::endl;
+            std::cerr << "Use a smaller block length or more BM offset bits" << std::endl;
+            throw "Variant BCF generation error, BM bits";
+        }
+        if (block >> (BM_TOTAL_BITS - BM_BLOCK_BITS)) {
+            std::cerr << "Block cannot be represented on " << BM_TOTAL_BITS - BM_BLOCK_BITS << " bits !" << std::endl;
+            std::cerr << "Use a larger block length or fewer BM offset bits" << std::endl;
             throw "Variant BCF generation error, BM bits";
         }
         int32_t _ = block << BM_BLOCK_BITS | offset;
@@ -30,6 +30,7 @@
 #include "gt_compressor_new.hpp"
 #include "gt_decompressor_new.hpp"
 #include "time.hpp"
+#include "stats.hpp"
 
 // Getting some insights (remove for release)
 #include "sandbox.hpp"
@@ -42,6 +43,13 @@ int main(int argc, const char *argv[]) {
     GlobalAppOptions& opt = global_app_options;
     CLI11_PARSE(app, argc, argv);
 
+    if (opt.mem_stats) {
+        MemStats::enable();
+    }
+    if (opt.stats or opt.mem_stats) {
+        Stats::enable(true, opt.stats);
+    }
+
     if (opt.wait) {
         // Wait for input
         int _;
@@ -90,7 +98,12 @@ int main(int argc, const char *argv[]) {
                     std::cerr << "INFO : Indices is\t\t\t" << hdr.ssas_offset - hdr.indices_offset << " bytes" << std::endl;
                     std::cerr << "INFO : Subsampled permutation arrays is\t" << hdr.wahs_offset - hdr.ssas_offset << " bytes" << std::endl;
                 }
-                std::cerr << "INFO : WAH Genotype data is\t\t" << hdr.samples_offset - hdr.wahs_offset << " bytes" << std::endl;
+                std::cerr << "INFO : WAH Genotype data is\t\t" << get_samples_offset(hdr) - get_wahs_offset(hdr) << " bytes" << std::endl;
+                if (hdr.version >= 5 and hdr.zone_map_offset_64) {
+                    // Block level summary (each block with --verbose), without decompressing the blocks
+                    Accessor accessor(filename);
+                    accessor.print_zone_map_info(opt.verbose);
+                }
                 //std::cerr << "INFO : Samples list is\t\t\t" << fs::file_size(filename) - hdr.samples_offset << " bytes" << std::endl;
             }
         }
@@ -119,11 +132,17 @@ int main(int argc, const char *argv[]) {
             exit(app.exit(CLI::RuntimeError()));
         }
 
+        const size_t bm_offset_bits = opt.bm_offset_bits ? opt.bm_offset_bits : default_bm_offset_bits(opt.reset_sort_block_length);
+        if (bm_offset_bits >= BM_TOTAL_BITS) {
+            std::cerr << "BM offset bits must be less than " << (size_t)BM_TOTAL_BITS << std::endl << std::endl;
+            exit(app.exit(CLI::CallForHelp()));
+        }
+
         bool fail = false;
         std::string variant_file(ofname + XSI_BCF_VAR_EXTENSION);
         auto variant_thread = std::thread([&]{
             try {
-                replace_samples_by_pos_in_binary_matrix(filename, variant_file, ofname, opt.v4, opt.reset_sort_block_length);
+                replace_samples_by_pos_in_binary_matrix(filename, variant_file, ofname, opt.v4, opt.reset_sort_block_length, bm_offset_bits);
             } catch (const char *e) {
                 std::cerr << e << std::endl;
                 fail = true;
@@ -135,6 +154,11 @@ int main(int argc, const char *argv[]) {
                 NewCompressor c(-1 /* v4 is -1, this will be unused */);
                 c.set_maf(opt.maf);
                 c.set_reset_sort_block_length(opt.reset_sort_block_length);
+                c.set_bm_offset_bits(bm_offset_bits);
+                c.set_sites(opt.sites or !opt.site_info_fields.empty(), opt.site_info_fields);
+                c.set_id_index(opt.id_index);
+                c.set_sample_tile_size(opt.sample_tile_size);
+                c.set_rare_stream(opt.rare_stream);
                 c.set_zstd_compression_on(opt.zstd);
                 c.set_zstd_compression_level(opt.zstd_compression_level);
                 c.init_compression(filename);
@@ -150,6 +174,18 @@ int main(int argc, const char *argv[]) {
             std::cout << "Generated file " << variant_file << " containing variants only" << std::endl;
         }
         compress_thread.join();
+        if (!fail and opt.single_file) {
+            try {
+                std::string variant_file_index(variant_file + ".csi");
+                embed_variant_file(ofname, variant_file, variant_file_index);
+                remove(variant_file.c_str());
+                remove(variant_file_index.c_str());
+                std::cout << "Embedded " << variant_file << " and its index in " << ofname << std::endl;
+            } catch (const char* e) {
+                std::cerr << e << std::endl;
+                fail = true;
+            }
+        }
         if (!fail) {
             std::cout << "File " << ofname << " written" << std::endl;
         } else {
@@ -169,14 +205,15 @@ int main(int argc, const char *argv[]) {
             exit(app.exit(CLI::RuntimeError()));
         }
 
-        std::string variant_file(filename + XSI_BCF_VAR_EXTENSION);
+        std::string variant_file(Accessor::get_variant_filename(filename));
+        const bool container = is_xsi_container(filename);
         if(!fs::exists(variant_file)) {
             std::cerr << "File " << variant_file << " is missing and required to decompress the .xsi" << std::endl;
             exit(app.exit(CLI::RuntimeError()));
         }
 
         std::string variant_file_index(filename + XSI_BCF_VAR_EXTENSION + ".csi");
-        if(!fs::exists(variant_file_index)) {
+        if(!container and !fs::exists(variant_file_index)) {
             std::cerr << "Index for " << variant_file << " is missing, reindexing now..." << std::endl;
             create_index_file(variant_file);
         }
@@ -193,5 +230,9 @@ int main(int argc, const char *argv[]) {
         exit(app.exit(CLI::CallForHelp()));
     }
 
+    if (opt.stats or opt.mem_stats) {
+        Stats::print_json(std::cerr);
+    }
+
     return 0;
 }
\ No newline at end of file